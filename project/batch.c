@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include "batch.h"
+
+#define UDP_MAX_PAYLOAD 65507                   // IPv4 datagram limit, GSO sends included
+// room for one UDP_SEGMENT or UDP_GRO value, and an SCM_TXTIME departure time
+#define CMSG_SIZE (CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint64_t)))
+
+/* Turns on GRO for the socket, and checks that the kernel knows about GSO.
+A kernel without UDP_SEGMENT would ignore the control message and send one huge datagram.
+Returns false if either is missing, then packets are sent and received one datagram at a time. */
+bool batch_enable_offload(int sockfd) {
+    int segment;
+    socklen_t len = sizeof(segment);
+    if (getsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &segment, &len) < 0)
+        return false;
+    int on = 1;
+    return setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+}
+
+/* Lets packets carry a departure time on the monotonic clock. The fq qdisc holds each one
+until then, other qdiscs send it at once. Returns false if the kernel lacks SO_TXTIME. */
+bool batch_enable_txtime(int sockfd) {
+    struct sock_txtime config = {.clockid = CLOCK_MONOTONIC, .flags = 0};
+    return setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0;
+}
+
+/* Allocates room for size messages of msg_size bytes each,
+and points each receive message at its buffer and address.
+A packet to send takes up to SEGMENT_IOVS iovecs. */
+void batch_init(batch *b, uint32_t size, uint32_t msg_size, bool offload) {
+    b->size = size;
+    b->count = 0;
+    b->next = 0;
+    b->offset = 0;
+    b->msg_size = msg_size;
+    b->offload = offload;
+    b->txtime = false;
+    b->ring = NULL;
+    b->niov = 0;
+    b->bufs = malloc((size_t) size * msg_size);
+    b->addrs = malloc(size * sizeof(struct sockaddr_in));
+    b->iovs = malloc(size * SEGMENT_IOVS * sizeof(struct iovec));
+    b->first = malloc((size + 1) * sizeof(uint32_t));
+    b->lens = malloc(size * sizeof(uint32_t));
+    b->txtimes = malloc(size * sizeof(uint64_t));
+    b->msgs = calloc(size, sizeof(struct mmsghdr));
+    b->cmsgs = calloc(size, CMSG_SIZE);
+    if (b->bufs == NULL || b->addrs == NULL || b->iovs == NULL || b->first == NULL || b->lens == NULL ||
+            b->txtimes == NULL || b->msgs == NULL || b->cmsgs == NULL)
+        die("batch initialization malloc failed");
+    for (uint32_t i = 0; i < size; i++) {
+        b->iovs[i].iov_base = b->bufs + (size_t) i * msg_size;
+        b->iovs[i].iov_len = msg_size;
+        b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+/* Returns the size of the datagrams the kernel coalesced into a received message,
+or the whole message if it wasn't coalesced. */
+static uint32_t gro_segment_size(struct msghdr *h, uint32_t len) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(h); c != NULL; c = CMSG_NXTHDR(h, c)) {
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(c), sizeof(size));
+            return size;
+        }
+    }
+    return len;
+}
+
+/* Hands out the next received packet in host byte order, along with its sender.
+Once the batch is used up, reads as many messages as are waiting, up to the batch size.
+A coalesced message is handed out one datagram at a time.
+Datagrams that are empty, truncated or malformed are skipped.
+Returns false if there are none. */
+bool batch_recv(batch *b, int sockfd, struct sockaddr_in *addr, packet *pkt, bool compact) {
+    for (;;) {
+        if (b->next == b->count) {
+            for (uint32_t i = 0; i < b->size; i++) {
+                struct msghdr *h = &b->msgs[i].msg_hdr;
+                h->msg_namelen = sizeof(struct sockaddr_in);
+                h->msg_control = b->offload ? b->cmsgs + i * CMSG_SIZE : NULL;
+                h->msg_controllen = b->offload ? CMSG_SIZE : 0;
+            }
+            int n = recvmmsg(sockfd, b->msgs, b->size, MSG_DONTWAIT, NULL);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) die("receive");
+            if (n <= 0)
+                return false;
+            b->count = n;
+            b->next = 0;
+            b->offset = 0;
+        }
+        uint32_t i = b->next;
+        uint32_t len = b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC ? 0 : b->msgs[i].msg_len;
+        uint32_t segment = len - b->offset;
+        if (b->offload) {
+            uint32_t gro = gro_segment_size(&b->msgs[i].msg_hdr, len);
+            if (gro < segment)
+                segment = gro;
+        }
+        uint8_t *data = b->bufs + (size_t) i * b->msg_size + b->offset;
+        b->offset += segment;
+        if (b->offset >= len) {
+            b->next++;
+            b->offset = 0;
+        }
+        if (segment == 0 || !wire_decode(pkt, data, segment, compact))
+            continue;
+        *addr = b->addrs[i];
+        trace_packet(TR_RECV, pkt->seq, pkt->ack, pkt->length, pkt->flags);
+        return true;
+    }
+}
+
+/* Returns true if received messages are waiting to be handed out. */
+bool batch_pending(const batch *b) {
+    return b->next < b->count;
+}
+
+/* Queues a packet for the next sendmmsg, logging it as sent.
+The batch is flushed when full. */
+void batch_send(batch *b, int sockfd, struct sockaddr_in *addr, const packet *pkt, bool compact,
+                trace_event op) {
+    trace_packet(op, pkt->seq, pkt->ack, pkt->length, pkt->flags);
+    struct iovec *iov = &b->iovs[b->niov];
+    iov->iov_base = b->bufs + (size_t) b->count * b->msg_size;
+    iov->iov_len = wire_encode(iov->iov_base, pkt, compact);
+    b->first[b->count] = b->niov++;
+    b->lens[b->count] = iov->iov_len;
+    b->txtimes[b->count] = 0;
+    b->addrs[b->count] = *addr;
+    b->count++;
+    if (b->count == b->size)
+        batch_flush(b, sockfd);
+}
+
+/* Queues a segment for the next sendmmsg, logging it as sent.
+Only its header and trailer are copied, the payload must stay put until the batch is flushed.
+The batch is flushed when full. */
+void batch_send_segment(batch *b, int sockfd, struct sockaddr_in *addr, const segment *seg,
+                        trace_event op) {
+    trace_packet(op, seg->seq, seg->ack, seg->length, seg->flags);
+    int n;
+    b->lens[b->count] = wire_gather(b->bufs + (size_t) b->count * b->msg_size, seg, &b->iovs[b->niov], &n);
+    b->first[b->count] = b->niov;
+    b->niov += n;
+    b->txtimes[b->count] = b->txtime ? seg->txtime : 0;
+    b->addrs[b->count] = *addr;
+    b->count++;
+    if (b->count == b->size)
+        batch_flush(b, sockfd);
+}
+
+static bool same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/* Returns how many queued packets from first on can go out as one GSO send:
+same destination and departure time, and every datagram but the last as long as the first. */
+static uint32_t gso_run(batch *b, uint32_t first) {
+    size_t segment = b->lens[first];
+    size_t total = segment;
+    uint32_t i = first + 1;
+    for (; i < b->count && i - first < GSO_MAX_SEGMENTS; i++) {
+        if (b->lens[i - 1] != segment || b->lens[i] > segment ||
+                total + b->lens[i] > UDP_MAX_PAYLOAD || !same_addr(&b->addrs[first], &b->addrs[i]) ||
+                b->txtimes[i] != b->txtimes[first])
+            break;
+        total += b->lens[i];
+    }
+    return i - first;
+}
+
+/* Builds the messages for the queued packets from first on. Returns the number of messages. */
+static uint32_t batch_build(batch *b, uint32_t first) {
+    uint32_t n = 0;
+    b->first[b->count] = b->niov;
+    for (uint32_t i = first; i < b->count; n++) {
+        uint32_t segments = b->offload ? gso_run(b, i) : 1;
+        struct msghdr *h = &b->msgs[n].msg_hdr;
+        h->msg_name = &b->addrs[i];
+        h->msg_namelen = sizeof(struct sockaddr_in);
+        h->msg_iov = &b->iovs[b->first[i]];
+        h->msg_iovlen = b->first[i + segments] - b->first[i];
+        uint8_t *control = b->cmsgs + n * CMSG_SIZE;
+        size_t used = 0;
+        if (segments > 1) {
+            struct cmsghdr *c = (struct cmsghdr*) control;
+            c->cmsg_level = SOL_UDP;
+            c->cmsg_type = UDP_SEGMENT;
+            c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segment = b->lens[i];
+            memcpy(CMSG_DATA(c), &segment, sizeof(segment));
+            used += CMSG_SPACE(sizeof(uint16_t));
+        }
+        if (b->txtimes[i] != 0) {
+            struct cmsghdr *c = (struct cmsghdr*) (control + used);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_TXTIME;
+            c->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            memcpy(CMSG_DATA(c), &b->txtimes[i], sizeof(uint64_t));
+            used += CMSG_SPACE(sizeof(uint64_t));
+        }
+        h->msg_control = used > 0 ? control : NULL;
+        h->msg_controllen = used;
+        i += segments;
+    }
+    return n;
+}
+
+/* Sends every queued packet, in as few syscalls as the kernel allows, or through io_uring.
+If the kernel or the device can't segment a GSO send, offload is turned off for good
+and the rest goes out one datagram per message.
+If the socket buffer is full the rest of the batch is dropped, like a loss on the link.
+A datagram larger than the device takes, a path mtu probe, is dropped on its own. */
+void batch_flush(batch *b, int sockfd) {
+    uint32_t first = 0;  // first packet not sent yet
+    while (first < b->count) {
+        uint32_t n = batch_build(b, first);
+        uint32_t sent = 0;
+        int err = 0;
+        while (sent < n) {
+            int r = b->ring != NULL ? ur_sendmmsg(b->ring, b->msgs + sent, n - sent) :
+                    sendmmsg(sockfd, b->msgs + sent, n - sent, 0);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0) {
+                err = errno;
+                break;
+            }
+            sent += r;
+        }
+        if (sent == n)
+            break;
+        struct msghdr *failed = &b->msgs[sent].msg_hdr;
+        uint32_t iov = failed->msg_iov - b->iovs;
+        while (b->first[first] != iov)
+            first++;
+        bool gso = failed->msg_iovlen > b->first[first + 1] - iov;  // more than its first packet
+        if (gso && (err == EIO || err == EINVAL || err == EMSGSIZE || err == EOPNOTSUPP)) {
+            b->offload = false;
+            continue;
+        }
+        if (err == EMSGSIZE && !gso) {
+            first++;
+            continue;
+        }
+        if (err != EAGAIN && err != ENOBUFS) {
+            errno = err;
+            die("send");
+        }
+        break;
+    }
+    b->count = 0;
+    b->niov = 0;
+}
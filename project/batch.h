@@ -0,0 +1,51 @@
+#ifndef PROJECT_BATCH_H_
+#define PROJECT_BATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+#include "utils.h"
+#include "wire.h"
+#include "uring.h"
+
+#define BATCH_MAX 1024          // most datagrams the kernel takes in one sendmmsg
+#define GSO_MAX_SEGMENTS 63     // segments per offloaded send, they must fit in 64 KB
+#define GRO_MAX_SIZE 65536      // largest datagram the kernel coalesces
+
+/* Datagrams waiting to be sent, or received and not yet handled.
+Each batch moves in or out of the socket with one recvmmsg or sendmmsg.
+With offload, runs of equal sized packets are sent as one GSO message that the
+kernel segments, and received GRO messages are split back into packets.
+A packet to send is one or more iovecs, its payload may point into the send buffer. */
+typedef struct {
+    uint32_t size;              // capacity in datagrams
+    uint32_t count;             // packets queued to send, or messages received
+    uint32_t next;              // next received message to hand out
+    uint32_t offset;            // where its next packet starts
+    uint32_t msg_size;          // receive buffer per message
+    bool offload;               // send with GSO and receive with GRO
+    bool txtime;                // departure times are passed to the kernel with SO_TXTIME
+    uint32_t niov;              // iovecs used by the queued packets
+    uint8_t *bufs;              // datagrams to send, or received messages, as on the wire
+    struct sockaddr_in *addrs;
+    struct iovec *iovs;         // one per received message, or the pieces of the queued packets in order
+    uint32_t *first;            // first iovec of each queued packet, and niov after the last
+    uint32_t *lens;             // size of each queued packet on the wire
+    uint64_t *txtimes;          // departure time of each queued packet in ns, 0 for none
+    struct mmsghdr *msgs;       // only batch.c sees the definition, it needs _GNU_SOURCE
+    uint8_t *cmsgs;             // GSO or GRO segment size and departure time control messages, per message
+    uring *ring;                // sends go through it instead of sendmmsg, NULL for none
+} batch;
+
+bool batch_enable_offload(int sockfd);
+bool batch_enable_txtime(int sockfd);
+void batch_init(batch *b, uint32_t size, uint32_t msg_size, bool offload);
+bool batch_recv(batch *b, int sockfd, struct sockaddr_in *addr, packet *pkt, bool compact);
+void batch_send(batch *b, int sockfd, struct sockaddr_in *addr, const packet *pkt, bool compact,
+                trace_event op);
+void batch_send_segment(batch *b, int sockfd, struct sockaddr_in *addr, const segment *seg,
+                        trace_event op);
+void batch_flush(batch *b, int sockfd);
+bool batch_pending(const batch *b);
+
+#endif  // PROJECT_BATCH_H_
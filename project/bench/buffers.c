@@ -0,0 +1,127 @@
+// Compares the ring buffers against the linked list deque they replaced.
+// Usage: bench/buffers [packets per run]
+// send: a full window where every ack releases one packet and another is sent
+// recv: the first packet of every window is lost, the rest are buffered out of
+//       order until it is resent, then the whole window is drained
+// Prints the average time per packet in ns for windows from 20 to 65536.
+// The list needs a few minutes for the largest window.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "deque.h"
+#include "sbuf.h"
+#include "rbuf.h"
+
+static const uint32_t windows[] = {20, 64, 256, 1024, 4096, 16384, 65536};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static packet make_pkt(uint32_t i) {
+    packet pkt = {.seq = i * MSS, .length = MSS, .flags = PKT_ACK};
+    return pkt;
+}
+
+static double send_list(uint32_t window, uint32_t count) {
+    q_handle_t q = q_init(window);
+    uint32_t i = 0;
+    for (; i < window; i++) {
+        packet pkt = make_pkt(i);
+        q_push_back(q, &pkt);
+    }
+    uint64_t start = now_ns();
+    for (uint32_t end = i + count; i < end; i++) {
+        packet pkt = make_pkt(i);
+        q_pop_front(q, NULL);
+        q_push_back(q, &pkt);
+    }
+    uint64_t elapsed = now_ns() - start;
+    q_destroy(q);
+    return (double) elapsed / count;
+}
+
+static double send_ring(uint32_t window, uint32_t count) {
+    sb_handle_t q = sb_init(window, window * MSS);
+    uint32_t i = 0;
+    for (; i < window; i++)
+        sb_push_back(q, i * MSS, MSS, PKT_ACK);
+    uint64_t start = now_ns();
+    for (uint32_t end = i + count; i < end; i++) {
+        sb_pop_front(q);
+        sb_release(q);
+        sb_push_back(q, i * MSS, MSS, PKT_ACK);
+    }
+    uint64_t elapsed = now_ns() - start;
+    sb_destroy(q);
+    return (double) elapsed / count;
+}
+
+static double recv_list(uint32_t window, uint32_t count) {
+    q_handle_t q = q_init(window);
+    uint32_t rounds = count / window > 0 ? count / window : 1;
+    uint32_t next = 0;
+    uint64_t start = now_ns();
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint32_t first = r * window;
+        for (uint32_t i = first + 1; i < first + window; i++) {
+            packet pkt = make_pkt(i);
+            q_try_insert_keep_sorted(q, &pkt);
+        }
+        next += MSS;  // the lost packet is resent and written out
+        for (packet *pkt = q_front(q); pkt != NULL && pkt->seq == next;
+                pkt = q_pop_front_get_next(q))
+            next += pkt->length;
+    }
+    uint64_t elapsed = now_ns() - start;
+    if (next != rounds * window * MSS)
+        die("list lost packets");
+    q_destroy(q);
+    return (double) elapsed / (rounds * window);
+}
+
+static double recv_ring(uint32_t window, uint32_t count) {
+    rb_handle_t q = rb_init(window * MSS);
+    uint32_t rounds = count / window > 0 ? count / window : 1;
+    uint32_t next = 0;
+    uint64_t start = now_ns();
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint32_t first = r * window;
+        for (uint32_t i = first + 1; i < first + window; i++) {
+            packet pkt = make_pkt(i);
+            rb_insert(q, next, &pkt);
+        }
+        next += MSS;
+        for (rb_entry *e = rb_pop(q, next); e != NULL; e = rb_pop(q, next))
+            next += e->length;
+    }
+    uint64_t elapsed = now_ns() - start;
+    if (next != rounds * window * MSS)
+        die("ring lost packets");
+    rb_destroy(q);
+    return (double) elapsed / (rounds * window);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t count = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (count == 0 || (uint64_t) count * MSS > UINT32_MAX) {
+        fprintf(stderr, "usage: %s [packets per run, at most %u]\n", argv[0], UINT32_MAX / MSS);
+        return 1;
+    }
+    printf("%8s %10s %10s %10s %10s   (ns per packet)\n",
+           "window", "send list", "send ring", "recv list", "recv ring");
+    for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+        uint32_t w = windows[i];
+        // the list scans the buffer on every out of order insert, so large windows get fewer rounds
+        uint32_t list_count = (uint64_t) count * w > (1 << 28) ? (1 << 28) / w : count;
+        if (list_count < w)
+            list_count = w;
+        printf("%8u %10.1f %10.1f %10.1f %10.1f\n", w,
+               send_list(w, count), send_ring(w, count),
+               recv_list(w, list_count), recv_ring(w, count));
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+# Compares congestion control algorithms over links emulated by bench/relay,
+# sending a random file from client to server and reporting goodput.
+# Usage: bench/cc.sh [megabytes] [window packets]
+# Run from the project directory after `make build`.
+
+MB=${1:-8}
+WINDOW=${2:-1024}
+PORT=9311
+TMP=$(mktemp -d)
+TIMEOUT=120
+
+make -s bench/relay || exit 1
+
+cleanup() {
+    kill $SERVER $CLIENT $RELAY 2>/dev/null
+    rm -rf $TMP
+}
+trap cleanup EXIT
+
+now_ms() {
+    date +%s%3N
+}
+
+head -c $((MB * 1024 * 1024)) /dev/urandom > $TMP/in.bin
+SIZE=$(stat -c %s $TMP/in.bin)
+
+# run <relay args> <endpoint args>, prints goodput in Mbit/s
+run() {
+    PORT=$((PORT + 2))
+    bench/relay $((PORT + 1)) $PORT $1 &
+    RELAY=$!
+    ./server $2 $PORT < /dev/null > $TMP/out.bin 2>/dev/null &
+    SERVER=$!
+    sleep 0.1
+    START=$(now_ms)
+    ./client $2 localhost $((PORT + 1)) < $TMP/in.bin > /dev/null 2>/dev/null &
+    CLIENT=$!
+    while [ "$(stat -c %s $TMP/out.bin)" -lt "$SIZE" ]; do
+        if [ $(($(now_ms) - START)) -gt $((TIMEOUT * 1000)) ]; then
+            break
+        fi
+        sleep 0.02
+    done
+    END=$(now_ms)
+    kill $SERVER $CLIENT $RELAY 2>/dev/null
+    wait $SERVER $CLIENT $RELAY 2>/dev/null
+    if cmp -s $TMP/in.bin $TMP/out.bin; then
+        awk -v b=$SIZE -v ms=$((END - START)) 'BEGIN { printf "%10.1f", b * 8 / ms / 1000 }'
+    else
+        printf "%10s" "-"
+    fi
+}
+
+# loss %, one way delay ms, rate Mbit/s, queue packets
+LINKS="0:5:50:64 0:25:50:64 1:5:50:64 1:25:50:64 5:25:50:64"
+
+printf "%-20s%10s%10s%10s%10s%10s%10s\n" "loss/delay/rate/q" \
+    "fixed-20" "fixed" "newreno" "cubic" "reno+sack" "cubic+sack"
+for link in $LINKS; do
+    args=$(echo $link | tr ':' ' ')
+    printf "%-20s" "$link"
+    run "$args" "-c fixed -w 20"
+    run "$args" "-c fixed -w $WINDOW"
+    run "$args" "-c newreno -w $WINDOW"
+    run "$args" "-c cubic -w $WINDOW"
+    run "$args" "-c newreno -w $WINDOW -s"
+    run "$args" "-c cubic -w $WINDOW -s"
+    echo
+done
+echo "goodput in Mbit/s for $MB MB, window $WINDOW packets"
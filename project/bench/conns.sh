@@ -0,0 +1,87 @@
+#!/bin/sh
+# Runs many clients at once against one server started with -m, each sending
+# from /dev/zero, and reports the aggregate goodput and how evenly the clients
+# shared it (Jain's fairness index: 1 when equal, 1/n when one client gets all).
+# The bytes delivered per client come from the stats lines the server prints
+# on SIGUSR1, taken after a warmup and again after the measured interval.
+# The clients run on the same machine, so with more clients than cores the
+# scheduler shares the CPU between them too; the server's share is reported.
+# Usage: [ARGS="options"] [SARGS="options"] bench/conns.sh [clients...] (default 1 10 1000)
+# ARGS is passed to the server and the clients, SARGS to the server only,
+# for example SARGS="-n 4" to spread the clients over 4 worker threads.
+# WARMUP and DURATION set the phases, PORT the server port.
+# Run from the project directory after `make build`.
+
+COUNTS=${*:-1 10 1000}
+WARMUP=${WARMUP:-2}
+DURATION=${DURATION:-5}
+PORT=${PORT:-9411}
+TMP=$(mktemp -d)
+HZ=$(getconf CLK_TCK)
+
+cpu_ticks() {  # utime + stime of a pid
+    awk '{print $14 + $15}' /proc/$1/stat
+}
+
+now_ms() {
+    date +%s%3N
+}
+
+cleanup() {
+    kill $SERVER $CLIENTS 2>/dev/null
+    rm -rf $TMP
+}
+trap cleanup EXIT
+
+# run <clients>, prints one line of results
+run() {
+    ./server $ARGS $SARGS -m $1 $PORT < /dev/null > /dev/null 2> $TMP/stats &
+    SERVER=$!
+    sleep 0.2
+    CLIENTS=
+    i=0
+    while [ $i -lt $1 ]; do
+        ./client $ARGS localhost $PORT < /dev/zero > /dev/null 2>/dev/null &
+        CLIENTS="$CLIENTS $!"
+        i=$((i + 1))
+    done
+    sleep $WARMUP
+    kill -USR1 $SERVER
+    START=$(now_ms)
+    BUSY=$(cpu_ticks $SERVER)
+    sleep 0.2
+    cp $TMP/stats $TMP/before
+    sleep $DURATION
+    kill -USR1 $SERVER
+    END=$(now_ms)
+    BUSY=$(( $(cpu_ticks $SERVER) - BUSY ))
+    sleep 0.2
+    kill $SERVER $CLIENTS 2>/dev/null
+    wait 2>/dev/null
+    LINES=$(wc -l < $TMP/before)
+    tail -n +$((LINES + 1)) $TMP/stats > $TMP/after
+
+    awk -v n=$1 -v ms=$((END - START)) -v busy=$BUSY -v hz=$HZ '
+    {
+        peer = $0; sub(/.*"peer":"/, "", peer); sub(/".*/, "", peer)
+        bytes = $0; sub(/.*"bytes_delivered":/, "", bytes); sub(/,.*/, "", bytes)
+        if (FILENAME ~ /before$/) before[peer] = bytes; else after[peer] = bytes
+    }
+    END {
+        conns = 0; sum = 0; squares = 0
+        for (p in after) {
+            d = after[p] - before[p]
+            conns++; sum += d; squares += d * d
+        }
+        # clients without a connection got nothing
+        fairness = squares > 0 ? sum * sum / (n * squares) : 0
+        printf "%8d%8d%14.2f%14.3f%10.3f%12.1f\n", n, conns, sum / ms / 1000, sum / ms / 1000 / n,
+               fairness, 100 * busy / hz / (ms / 1000)
+    }' $TMP/before $TMP/after
+    PORT=$((PORT + 1))
+}
+
+printf "%8s%8s%14s%14s%10s%12s\n" "clients" "conns" "total MB/s" "MB/s each" "fairness" "server cpu%"
+for n in $COUNTS; do
+    run $n
+done
@@ -4,7 +4,7 @@
 typedef struct queue_node_t node;
 
 struct queue_node_t {
-    packet* p;
+    q_entry e;  // first member, so an entry pointer is also its node
     node* next;
     node* prev;
 };
@@ -25,7 +25,6 @@ q_handle_t q_init(uint32_t capacity) {
             free(self);
             self = NULL;
         } else {
-            self->dummy_head->p = NULL;
             self->dummy_head->next = self->dummy_head;
             self->dummy_head->prev = self->dummy_head;
         }
@@ -42,7 +41,6 @@ void q_destroy(q_handle_t self) {
 void q_clear(q_handle_t self) {
     for (node* curr = self->dummy_head->next; curr != self->dummy_head;) {
         node* next = curr->next;
-        free(curr->p);
         free(curr);
         curr = next;
     }
@@ -54,13 +52,10 @@ void q_clear(q_handle_t self) {
 static node* make_node(const packet *pkt) {
     node* new_node = malloc(sizeof(node));
     if (new_node == NULL) return NULL;
-    new_node->p = malloc(sizeof(packet));
-    if (new_node->p == NULL) {
-        free(new_node);
-        return NULL;
-    } else {
-        *(new_node->p) = *pkt;
-    }
+    new_node->e.pkt = *pkt;
+    new_node->e.sent_at = 0;
+    new_node->e.tx_count = 0;
+    new_node->e.sacked = false;
     return new_node;
 }
 
@@ -97,8 +92,8 @@ bool q_try_insert_keep_sorted(q_handle_t self, const packet *pkt) {
     // Prevent duplicates
     node* curr;
     for (curr = self->dummy_head->next; curr != self->dummy_head; curr = curr->next) {
-        if (curr->p->seq == pkt->seq) return false;
-        if (curr->p->seq > pkt->seq) break;
+        if (curr->e.pkt.seq == pkt->seq) return false;
+        if (curr->e.pkt.seq > pkt->seq) break;
     }
     node* new_node = make_node(pkt);
     new_node->next = curr;
@@ -116,8 +111,7 @@ bool q_pop_front(q_handle_t self, packet *pkt) {
     self->dummy_head->next = target->next;
     target->next->prev = self->dummy_head;
     if (pkt != NULL)
-        *pkt = *(target->p);
-    free(target->p);
+        *pkt = target->e.pkt;
     free(target);
     self->size--;
     return true;
@@ -129,7 +123,22 @@ packet* q_pop_front_get_next(q_handle_t self) {
 }
 
 packet* q_front(q_handle_t self) {
-    return self->dummy_head->next->p;
+    q_entry* e = q_front_entry(self);
+    return e == NULL ? NULL : &e->pkt;
+}
+
+q_entry* q_front_entry(q_handle_t self) {
+    return q_empty(self) ? NULL : &self->dummy_head->next->e;
+}
+
+q_entry* q_back_entry(q_handle_t self) {
+    return q_empty(self) ? NULL : &self->dummy_head->prev->e;
+}
+
+/* Returns the entry after e in the queue, or NULL if e is the last one. */
+q_entry* q_next_entry(q_handle_t self, q_entry *e) {
+    node* next = ((node*) e)->next;
+    return next == self->dummy_head ? NULL : &next->e;
 }
 
 size_t q_size(q_handle_t self) {
@@ -151,6 +160,6 @@ void q_set_capacity(q_handle_t self, uint32_t capacity) {
 void q_print(q_handle_t self, const char *str) {
     fprintf(stderr, "%s", str);
     for (node* curr = self->dummy_head->next; curr != self->dummy_head; curr = curr->next)
-        fprintf(stderr, " %u", curr->p->seq);
+        fprintf(stderr, " %u", curr->e.pkt.seq);
     fprintf(stderr, "\n");
 }
@@ -7,6 +7,13 @@
 
 typedef struct queue_t* q_handle_t;
 
+typedef struct {
+    packet pkt;
+    uint64_t sent_at;   // monotonic time of the last transmission in us
+    uint32_t tx_count;  // number of times the packet has been sent
+    bool sacked;        // the receiver has reported holding the packet
+} q_entry;
+
 q_handle_t q_init(uint32_t capacity);
 void q_destroy(q_handle_t self);
 void q_clear(q_handle_t self);
@@ -16,6 +23,9 @@ bool q_try_insert_keep_sorted(q_handle_t self, const packet *pkt);
 bool q_pop_front(q_handle_t self, packet *pkt);
 packet* q_pop_front_get_next(q_handle_t self);
 packet* q_front(q_handle_t self);
+q_entry* q_front_entry(q_handle_t self);
+q_entry* q_back_entry(q_handle_t self);
+q_entry* q_next_entry(q_handle_t self, q_entry *e);
 size_t q_size(q_handle_t self);
 bool q_full(q_handle_t self);
 bool q_empty(q_handle_t self);
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Sweeps the size of a transfer over the simulated link of bench/sim, with and without fast open
+# (-k), and reports the time until the server got all the data and until both sides had closed.
+# Fast open saves a round trip when the data fits in the syn, and gains nothing on larger ones.
+# The cookie is issued on a first transfer that isn't timed, as a client's first connection
+# to a server would get it. Then it closes the connection over a lossy link for a range of seeds
+# and reports the worst time from the end of the transfer until both sides had closed, and how
+# many of them stalled: a side whose last ack was lost must not wait forever on a peer that left.
+# Usage: bench/fastopen.sh [rtt ms] [endpoint options]
+# Run from the project directory.
+
+RTT=${1:-50}
+[ $# -gt 0 ] && shift
+OPTIONS=${*:--w 64 -c cubic -s}
+SEED=1
+SEEDS=30
+TMP=$(mktemp -d)
+trap 'rm -rf $TMP' EXIT
+
+make -s bench/sim || exit 1
+
+field() {
+    echo "$1" | sed "s/.*$2=\([^ ]*\).*/\1/"
+}
+
+FAST_OPEN="-S \"-k $TMP/key\" -C \"-k $TMP/cookies\""
+eval bench/sim -r $RTT -n 1 $FAST_OPEN -- $OPTIONS > /dev/null
+
+printf "over a 100 Mbit/s link with a %s ms rtt, %s\n" "$RTT" "$OPTIONS"
+printf "%-9s %-10s %8s %9s\n" "bytes" "fast open" "time s" "close s"
+for BYTES in 500 1000 4096 16384 65536 1048576; do
+    for FO in off on; do
+        [ $FO = on ] && K=$FAST_OPEN || K=
+        LINE=$(eval bench/sim -r $RTT -s $SEED -n $BYTES $K -- $OPTIONS)
+        printf "%-9s %-10s %8s %9s\n" $BYTES $FO $(field "$LINE" time_s) $(field "$LINE" close_s)
+    done
+done
+
+printf "\nclosing over a lossy link, seeds 1 to %s, %s\n" "$SEEDS" "$OPTIONS"
+printf "%-6s %-10s %8s %8s\n" "loss" "fast open" "worst s" "stalled"
+for LOSS in 5 20 30; do
+    for FO in off on; do
+        [ $FO = on ] && K=$FAST_OPEN || K=
+        WORST=0
+        STALLED=0
+        for S in $(seq 1 $SEEDS); do
+            LINE=$(eval bench/sim -r $RTT -l $LOSS -s $S -n 16384 $K -- $OPTIONS)
+            CLOSE=$(field "$LINE" close_s)
+            if [ "$CLOSE" = stalled ]; then
+                STALLED=$((STALLED + 1))
+            else
+                WORST=$(awk -v c="$CLOSE" -v t="$(field "$LINE" time_s)" -v w=$WORST \
+                    'BEGIN { printf "%.3f", (c - t > w) ? c - t : w }')
+            fi
+        done
+        printf "%-6s %-10s %8s %8s\n" "$LOSS%" $FO $WORST $STALLED
+    done
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Sweeps loss and RTT over the simulated link of bench/sim, with and without forward error
+# correction (-f), and reports the goodput, the share of the data retransmitted, the share of
+# the bytes sent that were parity, and the median and 99th percentile delivery latency.
+# Every run takes the same seed, so two sweeps of the same tree give the same table.
+# Usage: bench/fec.sh [megabytes] [endpoint options]
+# Run from the project directory.
+
+MB=${1:-2}
+[ $# -gt 0 ] && shift
+OPTIONS=${*:--w 64 -c cubic -s}
+SEED=1
+
+make -s bench/sim || exit 1
+
+field() {
+    echo "$1" | sed "s/.*$2=\([^ ]*\).*/\1/"
+}
+
+printf "%d MB over a 100 Mbit/s link, %s\n" "$MB" "$OPTIONS"
+printf "%-7s %-8s %-5s %14s %7s %7s %11s %11s\n" "loss %" "rtt ms" "fec" "goodput Mbit/s" "rtx %" \
+    "fec %" "p50 lat ms" "p99 lat ms"
+for LOSS in 0 1 5 10; do
+    for RTT in 20 200; do
+        for FEC in off on; do
+            [ $FEC = on ] && F=-f || F=
+            LINE=$(bench/sim -l $LOSS -r $RTT -s $SEED -n $((MB * 1024 * 1024)) -- $OPTIONS $F)
+            printf "%-7s %-8s %-5s %14s %7s %7s %11s %11s\n" $LOSS $RTT $FEC \
+                $(field "$LINE" goodput_mbps) $(field "$LINE" rtx_pct) $(field "$LINE" fec_pct) \
+                $(field "$LINE" lat_p50_ms) $(field "$LINE" lat_p99_ms)
+        done
+    done
+done
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Transfers a random file from client to server over loopback, then leaves
+# both endpoints idle, and reports throughput and CPU usage of each phase.
+# Usage: [ARGS="options"] bench/loopback.sh [megabytes] [idle seconds] [port]
+# ARGS is passed to both endpoints, for example ARGS="-w 256 -b 1".
+# Run from the project directory after `make build`.
+
+MB=${1:-20}
+IDLE=${2:-3}
+PORT=${3:-9123}
+TMP=$(mktemp -d)
+HZ=$(getconf CLK_TCK)
+
+cpu_ticks() {  # utime + stime of a pid
+    awk '{print $14 + $15}' /proc/$1/stat
+}
+
+now_ms() {
+    date +%s%3N
+}
+
+cleanup() {
+    kill $SERVER $CLIENT $HOLDER 2>/dev/null
+    rm -rf $TMP
+}
+trap cleanup EXIT
+
+head -c $((MB * 1024 * 1024)) /dev/urandom > $TMP/in.bin
+SIZE=$(stat -c %s $TMP/in.bin)
+mkfifo $TMP/idle
+sleep 100000 > $TMP/idle &  # keeps the server's stdin open but empty
+HOLDER=$!
+
+./server $ARGS $PORT < $TMP/idle > $TMP/out.bin 2>$TMP/server.err &
+SERVER=$!
+sleep 0.2
+START=$(now_ms)
+./client $ARGS localhost $PORT < $TMP/in.bin > /dev/null 2>/dev/null &
+CLIENT=$!
+
+while [ "$(stat -c %s $TMP/out.bin)" -lt "$SIZE" ]; do
+    sleep 0.01
+done
+END=$(now_ms)
+kill -USR1 $SERVER  # its stats line has the acks it sent
+S_BUSY=$(cpu_ticks $SERVER)
+C_BUSY=$(cpu_ticks $CLIENT)
+sleep $IDLE
+S_IDLE=$(( $(cpu_ticks $SERVER) - S_BUSY ))
+C_IDLE=$(( $(cpu_ticks $CLIENT) - C_BUSY ))
+
+cmp -s $TMP/in.bin $TMP/out.bin && RESULT=ok || RESULT=CORRUPT
+ELAPSED=$((END - START))
+ACKS=$(grep -o '"pkts_sent":[0-9]*' $TMP/server.err | tail -1 | cut -d: -f2)
+awk -v mb=$MB -v ms=$ELAPSED -v hz=$HZ -v idle=$IDLE \
+    -v sb=$S_BUSY -v cb=$C_BUSY -v si=$S_IDLE -v ci=$C_IDLE -v r=$RESULT -v acks=${ACKS:-0} 'BEGIN {
+    printf "transfer  %d MB in %.2f s, %.2f MB/s (%s)\n", mb, ms / 1000, mb * 1000 / ms, r
+    # full size data packets, and the acks going the other way, fewer with -d
+    printf "packets   %.0f kpps of data, %.0f kpps of acks\n", mb * 1048576 / 1012 / ms, acks / ms
+    printf "busy cpu  server %.2f s, client %.2f s\n", sb / hz, cb / hz
+    printf "idle cpu  server %.1f%%, client %.1f%% over %d s\n",
+           100 * si / hz / idle, 100 * ci / hz / idle, idle
+}'
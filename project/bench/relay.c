@@ -0,0 +1,158 @@
+// Emulates a lossy, delayed, rate limited link between a client and a server.
+// Usage: relay <listen port> <server port> [loss %] [delay ms] [rate Mbit/s] [queue packets] [seed]
+// Clients send to the listen port, and the relay forwards to the server on localhost.
+// Each direction has its own bottleneck with a tail drop queue, so the link
+// behaves like a shallow buffered switch port when the rate is set.
+// On SIGINT or SIGTERM it prints the datagrams and bytes carried each way.
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MAX_DGRAM 65536
+#define MAX_QUEUE 65536
+
+typedef struct {
+    uint64_t deliver_at;
+    int len;
+    uint8_t *data;
+} datagram;
+
+typedef struct {
+    datagram q[MAX_QUEUE];  // fifo, constant delay keeps it in delivery order
+    int head;
+    int size;
+    uint64_t link_free_at;  // when the bottleneck finishes serializing the backlog
+    uint64_t sent, dropped;
+    uint64_t bytes;         // delivered, UDP payload only
+} direction;
+
+static double loss;
+static uint64_t delay_us;
+static double rate_bps;
+static int queue_limit;
+static direction up, down;  // client to server, server to client
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *s) {
+    perror(s);
+    exit(1);
+}
+
+static void enqueue(direction *d, const uint8_t *buf, int len) {
+    uint64_t now = now_us();
+    int backlog = d->size;
+    if (drand48() * 100 < loss || d->size == MAX_QUEUE ||
+        (rate_bps > 0 && backlog >= queue_limit)) {
+        d->dropped++;
+        return;
+    }
+    uint64_t start = d->link_free_at > now ? d->link_free_at : now;
+    uint64_t tx = rate_bps > 0 ? (uint64_t) (len * 8 * 1e6 / rate_bps) : 0;
+    d->link_free_at = start + tx;
+    datagram *g = &d->q[(d->head + d->size) % MAX_QUEUE];
+    g->deliver_at = start + tx + delay_us;
+    g->len = len;
+    g->data = malloc(len);
+    memcpy(g->data, buf, len);
+    d->size++;
+}
+
+static void flush(direction *d, int fd, struct sockaddr_in *to) {
+    uint64_t now = now_us();
+    while (d->size > 0 && d->q[d->head].deliver_at <= now) {
+        datagram *g = &d->q[d->head];
+        if (to->sin_port != 0)
+            sendto(fd, g->data, g->len, 0, (struct sockaddr*) to, sizeof(*to));
+        free(g->data);
+        d->head = (d->head + 1) % MAX_QUEUE;
+        d->size--;
+        d->sent++;
+        d->bytes += g->len;
+    }
+}
+
+static int next_timeout(void) {
+    uint64_t next = UINT64_MAX;
+    if (up.size > 0)
+        next = up.q[up.head].deliver_at;
+    if (down.size > 0 && down.q[down.head].deliver_at < next)
+        next = down.q[down.head].deliver_at;
+    if (next == UINT64_MAX)
+        return -1;
+    uint64_t now = now_us();
+    return next <= now ? 0 : (int) ((next - now + 999) / 1000);
+}
+
+static void report(int sig) {
+    (void) sig;
+    fprintf(stderr, "up    %llu datagrams, %llu bytes, %llu dropped\n"
+                    "down  %llu datagrams, %llu bytes, %llu dropped\n",
+            (unsigned long long) up.sent, (unsigned long long) up.bytes,
+            (unsigned long long) up.dropped, (unsigned long long) down.sent,
+            (unsigned long long) down.bytes, (unsigned long long) down.dropped);
+    _exit(0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <listen port> <server port> [loss %%] [delay ms] "
+                        "[rate Mbit/s] [queue packets] [seed]\n", argv[0]);
+        return 1;
+    }
+    loss = argc > 3 ? atof(argv[3]) : 0;
+    delay_us = argc > 4 ? (uint64_t) (atof(argv[4]) * 1000) : 0;
+    rate_bps = argc > 5 ? atof(argv[5]) * 1e6 : 0;
+    queue_limit = argc > 6 ? atoi(argv[6]) : 100;
+    srand48(argc > 7 ? atol(argv[7]) : 1);
+    signal(SIGINT, report);
+    signal(SIGTERM, report);
+
+    int front = socket(AF_INET, SOCK_DGRAM, 0);
+    int back = socket(AF_INET, SOCK_DGRAM, 0);
+    if (front < 0 || back < 0) die("socket");
+    int size = 4 << 20;
+    setsockopt(front, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(back, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    struct sockaddr_in listen_addr = {0}, server = {0}, client = {0};
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_addr.sin_port = htons(atoi(argv[1]));
+    if (bind(front, (struct sockaddr*) &listen_addr, sizeof(listen_addr)) < 0) die("bind");
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(atoi(argv[2]));
+
+    uint8_t buf[MAX_DGRAM];
+    struct pollfd fds[2] = {{.fd = front, .events = POLLIN}, {.fd = back, .events = POLLIN}};
+    for (;;) {
+        if (poll(fds, 2, next_timeout()) < 0 && errno != EINTR) die("poll");
+        for (;;) {
+            socklen_t alen = sizeof(client);
+            int n = recvfrom(front, buf, sizeof(buf), MSG_DONTWAIT,
+                             (struct sockaddr*) &client, &alen);
+            if (n < 0) break;
+            enqueue(&up, buf, n);
+        }
+        for (;;) {
+            int n = recvfrom(back, buf, sizeof(buf), MSG_DONTWAIT, NULL, NULL);
+            if (n < 0) break;
+            enqueue(&down, buf, n);
+        }
+        flush(&up, back, &server);
+        flush(&down, front, &client);
+    }
+}
@@ -0,0 +1,687 @@
+// Runs a client and a server in one process over a simulated link, on a virtual clock,
+// so a transfer under any delay, loss, reordering and duplication runs much faster than
+// in real time, and gives the same result every time for the same seed.
+// Usage: bench/sim [-l loss %] [-r rtt ms] [-b rate Mbit/s] [-q queue packets] [-u duplicate %]
+//                  [-o reorder %] [-m mtu bytes] [-n bytes] [-s seed] [-C "client options"]
+//                  [-S "server options"] [-- endpoint options]
+// The client sends n bytes of seeded random data to the server, which checks them, then one line
+// is printed: the virtual time the transfer took, its goodput, the time until both sides had
+// closed the connection and exited, the share of the data sent that was retransmitted,
+// the share of the client's packet bytes that were parity packets (-f), the datagrams the link
+// dropped, the median and 99th percentile of the time from when bytes were read from the client's
+// stdin to when the server wrote them out, by bytes, and the real time the simulation took.
+// The endpoint options are given to both sides, like -w 64 -c cubic -s, and -C and -S add
+// options of one side only, split at spaces, like -S "-k key" -C "-k cookies". The server runs
+// one connection on one thread and writes it to stdout, so -m, -n, -o and -l can't be used.
+// The mains of the client and the server are compiled in under other names, and each runs as
+// a coroutine. The linker redirects the calls they make on sockets, epoll, the timerfd, stdin,
+// stdout and the clock to here (--wrap), so the code under test is the same as in the binaries.
+// io_uring goes around them, so -u can't be used either.
+// A host runs until it waits in epoll_wait with nothing ready, then the other one runs,
+// and once both wait the clock jumps to the next arrival or timer.
+// Each direction of the link has a bottleneck at the given rate with a tail drop queue,
+// then the propagation delay of half the RTT. A reordered datagram is held back for up to
+// another half RTT, at least 1 ms, and a duplicated one is queued twice. With -m, a datagram
+// that doesn't fit an IP packet of that size is dropped, like on a path with a smaller MTU
+// than the hosts' that filters the ICMP errors, so only the probes of -x find the size out.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include "wire.h"
+
+#define STACK_SIZE (1 << 20)
+#define FD_BASE 1000            // virtual fds of host h are FD_BASE + FD_SPAN * h + their kind
+#define FD_SPAN 8
+#define SERVER_PORT "8080"
+#define CLIENT_PORT 40000
+#define START_US 1000000        // the virtual clock starts here, timers take 0 as unset
+#define LIMIT_US 600000000      // a transfer still running after this long has stalled
+#define CLOSE_LIMIT_US 60000000 // and a connection still open this long after it finished
+#define MIN_REORDER_US 1000
+#define UDP_IP_HEADERS 28       // IPv4 and UDP headers, on top of a datagram
+#define MAX_ARGS 64
+
+// what a virtual fd of a host is, and the slots epoll watches
+enum { FD_SOCKET, FD_EPOLL, FD_TIMER, FD_WAKE, FD_STDIN, FD_STDOUT, FD_KINDS };
+
+typedef struct {
+    uint64_t arrival;
+    uint64_t order;             // sent before others arriving at the same time
+    uint32_t len;
+    uint8_t *data;
+} datagram;
+
+/* Datagrams on their way to a host, a min heap by arrival. */
+typedef struct {
+    datagram *items;
+    uint32_t size, capacity;
+} inbox;
+
+/* One direction of the link. */
+typedef struct {
+    uint64_t free_at;           // when the bottleneck finishes sending its backlog
+    uint64_t *departures;       // ring of the times the queued datagrams leave the bottleneck
+    uint32_t head, queued;
+    uint64_t datagrams, dropped;
+    uint64_t data_bytes;        // payload of the data packets sent, retransmissions included
+    uint64_t fec_bytes;         // and of the parity packets, path mtu probes count as neither
+} link_dir;
+
+/* A read from the client's stdin, for the delivery latency of its bytes. */
+typedef struct {
+    uint64_t end;               // stream offset after the bytes read
+    uint64_t at;                // when they were read, then how long they took to be written
+    uint32_t bytes;
+} source_read_t;
+
+typedef struct host {
+    int (*main)(int argc, char *argv[]);
+    int argc;
+    char *argv[MAX_ARGS];
+    ucontext_t ctx;
+    void *stack;
+    bool started, exited;
+    inbox in;
+    link_dir out;               // the direction this host sends on
+    struct host *peer;
+    struct sockaddr_in addr;
+    uint64_t timer;             // timerfd deadline in us, 0 if disarmed
+    bool watched[FD_KINDS];
+    uint32_t data[FD_KINDS];    // epoll data of each watched fd
+    uint64_t to_read;           // bytes of stdin left
+    uint64_t read_pos;
+    uint64_t written;           // bytes written to stdout
+    bool corrupt;               // and they weren't the data sent
+} host;
+
+int sim_client_main(int argc, char *argv[]);
+int sim_server_main(int argc, char *argv[]);
+
+int __real_fcntl(int fd, int cmd, ...);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+int __real_clock_gettime(clockid_t clock, struct timespec *ts);
+
+static double loss, duplicate, reorder;     // probabilities
+static uint64_t delay_us;                   // one way
+static double rate;                         // bytes per us
+static uint32_t queue_limit = 100;
+static uint32_t mtu;                        // largest IP packet the link carries, 0 for any
+static uint64_t total = 1 << 21;
+static uint64_t seed = 1;
+static uint64_t rng_state;
+
+static host hosts[2];           // the server first, so it is bound before the syn arrives
+static host *current;           // the host running, NULL in the scheduler
+static ucontext_t scheduler;
+static uint64_t now = START_US;
+static uint64_t sent_order;
+static bool finished;
+static uint64_t finished_at;
+static bool closed;             // both hosts exited
+static uint64_t closed_at;
+static source_read_t *reads;    // in stream order
+static uint32_t reads_size, reads_capacity, reads_written;
+
+static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/* Returns a uniform random number in [0, 1) from the link's generator. */
+static double random01(void) {
+    rng_state += 0x9e3779b97f4a7c15ull;
+    return (mix(rng_state) >> 11) * (1.0 / (1ull << 53));
+}
+
+/* The data sent, a function of the seed and the offset, so the receiver can check it. */
+static uint8_t pattern(uint64_t offset) {
+    return mix(~seed + offset / 8) >> (offset % 8 * 8);
+}
+
+static host* fd_host(int fd) {
+    if (fd < FD_BASE || fd >= FD_BASE + 2 * FD_SPAN)
+        return NULL;
+    return &hosts[(fd - FD_BASE) / FD_SPAN];
+}
+
+static int fd_kind(int fd) {
+    return (fd - FD_BASE) % FD_SPAN;
+}
+
+static int host_fd(const host *h, int kind) {
+    return FD_BASE + FD_SPAN * (h - hosts) + kind;
+}
+
+/* Returns the slot an fd takes in the epoll set of the current host, or -1. */
+static int watch_slot(int fd) {
+    if (fd_host(fd) != NULL)
+        return fd_kind(fd);
+    if (current != NULL && fd == STDIN_FILENO)
+        return FD_STDIN;
+    if (current != NULL && fd == STDOUT_FILENO)
+        return FD_STDOUT;
+    return -1;
+}
+
+static void inbox_push(inbox *q, datagram d) {
+    if (q->size == q->capacity) {
+        q->capacity = q->capacity ? 2 * q->capacity : 256;
+        q->items = realloc(q->items, q->capacity * sizeof(datagram));
+        if (q->items == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    uint32_t i = q->size++;
+    while (i > 0) {
+        datagram *parent = &q->items[(i - 1) / 2];
+        if (parent->arrival < d.arrival || (parent->arrival == d.arrival && parent->order < d.order))
+            break;
+        q->items[i] = *parent;
+        i = (i - 1) / 2;
+    }
+    q->items[i] = d;
+}
+
+static datagram inbox_pop(inbox *q) {
+    datagram top = q->items[0];
+    datagram last = q->items[--q->size];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= q->size)
+            break;
+        datagram *c = &q->items[child];
+        if (child + 1 < q->size && (c[1].arrival < c->arrival ||
+                (c[1].arrival == c->arrival && c[1].order < c->order)))
+            c++, child++;
+        if (last.arrival < c->arrival || (last.arrival == c->arrival && last.order < c->order))
+            break;
+        q->items[i] = *c;
+        i = child;
+    }
+    q->items[i] = last;
+    return top;
+}
+
+static bool inbox_ready(const inbox *q) {
+    return q->size > 0 && q->items[0].arrival <= now;
+}
+
+/* Puts a datagram on the link from h to its peer. */
+static void link_send(host *h, const uint8_t *data, uint32_t len) {
+    link_dir *d = &h->out;
+    d->datagrams++;
+    uint16_t length;
+    memcpy(&length, data + 8, sizeof(length));
+    if (len >= HEADER_SIZE && data[10] & PKT_FEC)
+        d->fec_bytes += ntohs(length);
+    else if (len >= HEADER_SIZE && !(data[10] & PKT_MSS))
+        d->data_bytes += ntohs(length);
+    if (mtu != 0 && len + UDP_IP_HEADERS > mtu) {
+        d->dropped++;
+        return;
+    }
+    if (random01() < loss) {
+        d->dropped++;
+        return;
+    }
+    for (int copies = random01() < duplicate ? 2 : 1; copies > 0; copies--) {
+        while (d->queued > 0 && d->departures[d->head] <= now) {
+            d->head = (d->head + 1) % queue_limit;
+            d->queued--;
+        }
+        if (d->queued == queue_limit) {
+            d->dropped++;
+            continue;
+        }
+        d->free_at = (d->free_at > now ? d->free_at : now) + (uint64_t) (len / rate) + 1;
+        d->departures[(d->head + d->queued++) % queue_limit] = d->free_at;
+        datagram g = {d->free_at + delay_us, sent_order++, len, malloc(len)};
+        if (random01() < reorder)
+            g.arrival += MIN_REORDER_US + (uint64_t) (random01() * delay_us);
+        memcpy(g.data, data, len);
+        inbox_push(&h->peer->in, g);
+    }
+}
+
+/* Returns true if the fd in the slot would make epoll_wait return. */
+static bool slot_ready(const host *h, int slot) {
+    switch (slot) {
+        case FD_SOCKET:
+            return inbox_ready(&h->in);
+        case FD_TIMER:
+            return h->timer != 0 && h->timer <= now;
+        case FD_STDIN:      // the data to send is always there, until end of file
+        case FD_STDOUT:     // and the output is taken at once
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int ready_events(const host *h, struct epoll_event *events, int max) {
+    int n = 0;
+    for (int slot = 0; slot < FD_KINDS && n < max; slot++) {
+        if (h->watched[slot] && slot_ready(h, slot)) {
+            events[n].events = slot == FD_STDOUT ? EPOLLOUT : EPOLLIN;
+            events[n++].data.u32 = h->data[slot];
+        }
+    }
+    return n;
+}
+
+static void host_start(void) {
+    optind = 0;  // both mains parse their options with getopt
+    current->main(current->argc, current->argv);
+    current->exited = true;
+}
+
+/* Runs the hosts until both exited, or nothing is left to happen before the limit, which is
+closer once the server got all the data. Returns true if the transfer finished. */
+static bool simulate(void) {
+    for (;;) {
+        bool ran = false;
+        for (int i = 0; i < 2; i++) {
+            host *h = &hosts[i];
+            struct epoll_event events[FD_KINDS];
+            if (h->exited || (h->started && ready_events(h, events, FD_KINDS) == 0))
+                continue;
+            if (!h->started) {
+                h->started = true;
+                getcontext(&h->ctx);
+                h->ctx.uc_stack.ss_sp = h->stack;
+                h->ctx.uc_stack.ss_size = STACK_SIZE;
+                h->ctx.uc_link = &scheduler;
+                makecontext(&h->ctx, host_start, 0);
+            }
+            current = h;
+            swapcontext(&scheduler, &h->ctx);
+            current = NULL;
+            ran = true;
+        }
+        if (hosts[0].exited && hosts[1].exited) {
+            closed = true;
+            closed_at = now;
+            return finished;
+        }
+        if (ran)
+            continue;
+        uint64_t next = UINT64_MAX;
+        for (int i = 0; i < 2; i++) {
+            if (hosts[i].exited)  // datagrams to it are dropped like at a closed port
+                continue;
+            if (hosts[i].in.size > 0 && hosts[i].in.items[0].arrival < next)
+                next = hosts[i].in.items[0].arrival;
+            if (hosts[i].timer != 0 && hosts[i].timer < next)
+                next = hosts[i].timer;
+        }
+        uint64_t limit = finished ? finished_at + CLOSE_LIMIT_US : START_US + LIMIT_US;
+        if (next == UINT64_MAX || next > limit)
+            return finished;
+        now = next;
+    }
+}
+
+/* Gives the host its options: those of both sides, then its own, split at spaces (NULL if none),
+then the positional arguments. */
+static void host_init(host *h, int (*main)(int, char **), const char *name, int nargs, char **args,
+                      char *own, const char *positional[], int npositional) {
+    h->main = main;
+    h->argc = 0;
+    h->argv[h->argc++] = (char*) name;
+    for (int i = 0; i < nargs && h->argc < MAX_ARGS - 3; i++)
+        h->argv[h->argc++] = args[i];
+    for (char *arg = own != NULL ? strtok(own, " ") : NULL; arg != NULL && h->argc < MAX_ARGS - 3;
+            arg = strtok(NULL, " "))
+        h->argv[h->argc++] = arg;
+    for (int i = 0; i < npositional; i++)
+        h->argv[h->argc++] = (char*) positional[i];
+    h->argv[h->argc] = NULL;
+    h->stack = malloc(STACK_SIZE);
+    h->out.departures = malloc(queue_limit * sizeof(uint64_t));
+    if (h->stack == NULL || h->out.departures == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    h->addr.sin_family = AF_INET;
+    h->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static int by_latency(const void *a, const void *b) {
+    const source_read_t *x = a, *y = b;
+    return (x->at > y->at) - (x->at < y->at);
+}
+
+/* Returns the delivery latency in ms that the given share of the bytes written didn't exceed. */
+static double latency_percentile(double share) {
+    uint64_t bytes = 0, target = (uint64_t) (share * total);
+    for (uint32_t i = 0; i < reads_written; i++) {
+        bytes += reads[i].bytes;
+        if (bytes >= target)
+            return reads[i].at / 1e3;
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-l loss %%] [-r rtt ms] [-b rate Mbit/s] [-q queue packets] "
+                    "[-u duplicate %%] [-o reorder %%] [-m mtu bytes] [-n bytes] [-s seed] "
+                    "[-C \"client options\"] [-S \"server options\"] [-- endpoint options]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    double mbps = 100;
+    char *client_own = NULL, *server_own = NULL;
+    int c;
+    while ((c = getopt(argc, argv, "l:r:b:q:u:o:m:n:s:C:S:")) != -1) {
+        switch (c) {
+            case 'l': loss = atof(optarg) / 100; break;
+            case 'r': delay_us = (uint64_t) (atof(optarg) * 1000 / 2); break;
+            case 'b': mbps = atof(optarg); break;
+            case 'q': queue_limit = atoi(optarg); break;
+            case 'u': duplicate = atof(optarg) / 100; break;
+            case 'o': reorder = atof(optarg) / 100; break;
+            case 'm': mtu = atoi(optarg); break;
+            case 'n': total = strtoull(optarg, NULL, 10); break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'C': client_own = optarg; break;
+            case 'S': server_own = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (mbps <= 0 || queue_limit == 0)
+        usage(argv[0]);
+    rate = mbps / 8;
+    rng_state = seed;
+
+    host *server = &hosts[0], *client = &hosts[1];
+    const char *server_args[] = {SERVER_PORT};
+    const char *client_args[] = {"localhost", SERVER_PORT};
+    host_init(server, sim_server_main, "server", argc - optind, argv + optind, server_own,
+              server_args, 1);
+    host_init(client, sim_client_main, "client", argc - optind, argv + optind, client_own,
+              client_args, 2);
+    server->peer = client;
+    client->peer = server;
+    server->addr.sin_port = htons(atoi(SERVER_PORT));
+    client->addr.sin_port = htons(CLIENT_PORT);
+    client->to_read = total;
+
+    struct timespec start, end;
+    __real_clock_gettime(CLOCK_MONOTONIC, &start);
+    bool done = simulate();
+    __real_clock_gettime(CLOCK_MONOTONIC, &end);
+    double real = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double elapsed = (finished_at - START_US) / 1e6;
+    uint64_t sent = client->out.data_bytes;
+    uint64_t parity = client->out.fec_bytes;
+    if (done && !server->corrupt)
+        printf("time_s=%.3f goodput_mbps=%.3f", elapsed, total * 8 / elapsed / 1e6);
+    else
+        printf("time_s=%s goodput_mbps=0", server->corrupt ? "corrupt" : "stalled");
+    if (done && closed)
+        printf(" close_s=%.3f", (closed_at - START_US) / 1e6);
+    else
+        printf(" close_s=stalled");
+    qsort(reads, reads_written, sizeof(source_read_t), by_latency);
+    printf(" rtx_pct=%.2f fec_pct=%.2f dropped=%llu lat_p50_ms=%.1f lat_p99_ms=%.1f real_s=%.3f\n",
+           sent > total ? (sent - total) * 100.0 / sent : 0,
+           sent + parity > 0 ? parity * 100.0 / (sent + parity) : 0,
+           (unsigned long long) (client->out.dropped + server->out.dropped),
+           latency_percentile(0.5), latency_percentile(0.99), real);
+    return done && !server->corrupt ? 0 : 1;
+}
+
+/* The syscalls redirected from the client and the server. Fds that aren't virtual,
+like stderr, and the stdin and stdout of the process outside of a host, go to the real ones. */
+
+int __wrap_socket(int domain, int type, int protocol) {
+    (void) domain, (void) type, (void) protocol;
+    return host_fd(current, FD_SOCKET);
+}
+
+int __wrap_bind(int fd, const struct sockaddr *addr, socklen_t len) {
+    (void) fd, (void) addr, (void) len;
+    return 0;  // the server's address is set already
+}
+
+int __wrap_fcntl(int fd, int cmd, ...) {
+    va_list ap;
+    va_start(ap, cmd);
+    long arg = va_arg(ap, long);
+    va_end(ap);
+    if (watch_slot(fd) >= 0)
+        return 0;
+    return __real_fcntl(fd, cmd, arg);
+}
+
+int __wrap_getsockopt(int fd, int level, int name, void *value, socklen_t *len) {
+    (void) fd, (void) level, (void) name, (void) value, (void) len;
+    errno = ENOPROTOOPT;  // no offload or departure times on the link
+    return -1;
+}
+
+int __wrap_setsockopt(int fd, int level, int name, const void *value, socklen_t len) {
+    (void) fd, (void) level, (void) name, (void) value, (void) len;
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+int __wrap_epoll_create1(int flags) {
+    (void) flags;
+    return host_fd(current, FD_EPOLL);
+}
+
+int __wrap_timerfd_create(int clock, int flags) {
+    (void) clock, (void) flags;
+    return host_fd(current, FD_TIMER);
+}
+
+int __wrap_eventfd(unsigned int value, int flags) {
+    (void) value, (void) flags;
+    return host_fd(current, FD_WAKE);
+}
+
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    host *h = fd_host(epfd);
+    int slot = watch_slot(fd);
+    h->watched[slot] = op != EPOLL_CTL_DEL;
+    if (op != EPOLL_CTL_DEL)
+        h->data[slot] = event->data.u32;
+    return 0;
+}
+
+/* Gives the other host and the clock their turn until something is ready, unless timeout is 0. */
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int max, int timeout) {
+    host *h = fd_host(epfd);
+    int n = ready_events(h, events, max);
+    while (n == 0 && timeout != 0) {
+        swapcontext(&h->ctx, &scheduler);
+        n = ready_events(h, events, max);
+    }
+    return n;
+}
+
+int __wrap_timerfd_settime(int fd, int flags, const struct itimerspec *value, struct itimerspec *old) {
+    (void) flags, (void) old;  // always an absolute deadline
+    fd_host(fd)->timer = (uint64_t) value->it_value.tv_sec * 1000000 + value->it_value.tv_nsec / 1000;
+    return 0;
+}
+
+int __wrap_clock_gettime(clockid_t clock, struct timespec *ts) {
+    (void) clock;
+    ts->tv_sec = now / 1000000;
+    ts->tv_nsec = now % 1000000 * 1000;
+    return 0;
+}
+
+/* Fills iov with the next bytes of the data to send, or returns 0 at its end. */
+static ssize_t source_read(host *h, const struct iovec *iov, int iovcnt) {
+    size_t n = 0;
+    uint64_t start = h->read_pos;
+    for (int i = 0; i < iovcnt && h->to_read > 0; i++) {
+        size_t take = iov[i].iov_len < h->to_read ? iov[i].iov_len : h->to_read;
+        uint8_t *out = iov[i].iov_base;
+        for (size_t j = 0; j < take; j++)
+            out[j] = pattern(h->read_pos + j);
+        h->read_pos += take;
+        h->to_read -= take;
+        n += take;
+    }
+    if (n == 0)
+        return 0;
+    if (reads_size == reads_capacity) {
+        reads_capacity = reads_capacity == 0 ? 1024 : 2 * reads_capacity;
+        reads = realloc(reads, reads_capacity * sizeof(source_read_t));
+        if (reads == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    reads[reads_size++] = (source_read_t) {h->read_pos, now, h->read_pos - start};
+    return n;
+}
+
+/* Takes everything written to stdout, checking it on the server. */
+static ssize_t sink_write(host *h, const struct iovec *iov, int iovcnt) {
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const uint8_t *in = iov[i].iov_base;
+        for (size_t j = 0; h == &hosts[0] && j < iov[i].iov_len; j++)
+            h->corrupt |= in[j] != pattern(h->written + j);
+        h->written += iov[i].iov_len;
+        n += iov[i].iov_len;
+    }
+    // a read is delivered once its last byte is written
+    for (; h == &hosts[0] && reads_written < reads_size && reads[reads_written].end <= h->written;
+            reads_written++)
+        reads[reads_written].at = now - reads[reads_written].at;
+    if (h == &hosts[0] && h->written >= total && !finished) {
+        finished = true;
+        finished_at = now;
+    }
+    return n;
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+    int slot = watch_slot(fd);
+    if (slot == FD_TIMER || slot == FD_WAKE) {
+        uint64_t one = 1;
+        memcpy(buf, &one, sizeof(one));
+        if (slot == FD_TIMER)
+            fd_host(fd)->timer = 0;  // one shot
+        return sizeof(one);
+    }
+    if (slot == FD_STDIN) {
+        struct iovec iov = {buf, count};
+        return source_read(current, &iov, 1);
+    }
+    return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_readv(int fd, const struct iovec *iov, int iovcnt) {
+    if (watch_slot(fd) == FD_STDIN)
+        return source_read(current, iov, iovcnt);
+    return __real_readv(fd, iov, iovcnt);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+    int slot = watch_slot(fd);
+    if (slot == FD_WAKE)
+        return count;
+    if (slot == FD_STDOUT) {
+        struct iovec iov = {(void*) buf, count};
+        return sink_write(current, &iov, 1);
+    }
+    return __real_write(fd, buf, count);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt) {
+    if (watch_slot(fd) == FD_STDOUT)
+        return sink_write(current, iov, iovcnt);
+    return __real_writev(fd, iov, iovcnt);
+}
+
+ssize_t __wrap_sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *to,
+                      socklen_t tolen) {
+    (void) flags, (void) to, (void) tolen;  // the peer is the other host
+    link_send(fd_host(fd), buf, len);
+    return len;
+}
+
+int __wrap_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+    (void) flags;
+    uint8_t buf[WIRE_MAX_SIZE];
+    for (unsigned int i = 0; i < vlen; i++) {
+        struct msghdr *h = &msgs[i].msg_hdr;
+        size_t len = 0;
+        for (size_t j = 0; j < h->msg_iovlen && len + h->msg_iov[j].iov_len <= sizeof(buf); j++) {
+            memcpy(buf + len, h->msg_iov[j].iov_base, h->msg_iov[j].iov_len);
+            len += h->msg_iov[j].iov_len;
+        }
+        link_send(fd_host(fd), buf, len);
+        msgs[i].msg_len = len;
+    }
+    return vlen;
+}
+
+/* Hands out the next datagram that has arrived, truncated to len like a real socket.
+Returns its full size, or -1 if none has arrived. */
+static ssize_t receive(host *h, void *buf, size_t len, struct sockaddr *from, socklen_t *fromlen,
+                       bool *truncated) {
+    if (!inbox_ready(&h->in)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    datagram g = inbox_pop(&h->in);
+    memcpy(buf, g.data, g.len < len ? g.len : len);
+    free(g.data);
+    *truncated = g.len > len;
+    if (from != NULL) {
+        memcpy(from, &h->peer->addr, sizeof(struct sockaddr_in));
+        *fromlen = sizeof(struct sockaddr_in);
+    }
+    return g.len;
+}
+
+ssize_t __wrap_recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *from,
+                        socklen_t *fromlen) {
+    bool truncated;
+    ssize_t n = receive(fd_host(fd), buf, len, from, fromlen, &truncated);
+    return n < 0 || flags & MSG_TRUNC || !truncated ? n : (ssize_t) len;
+}
+
+int __wrap_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout) {
+    (void) flags, (void) timeout;
+    unsigned int n = 0;
+    for (; n < vlen; n++) {
+        struct msghdr *h = &msgs[n].msg_hdr;
+        bool truncated;
+        ssize_t len = receive(fd_host(fd), h->msg_iov[0].iov_base, h->msg_iov[0].iov_len, h->msg_name,
+                              &h->msg_namelen, &truncated);
+        if (len < 0)
+            break;
+        msgs[n].msg_len = truncated ? h->msg_iov[0].iov_len : (size_t) len;
+        h->msg_flags = truncated ? MSG_TRUNC : 0;
+        h->msg_controllen = 0;
+    }
+    return n > 0 ? (int) n : -1;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Sweeps loss, RTT and window sizes over the simulated link of bench/sim, and reports
+# the completion time, goodput and share of the data retransmitted of each transfer.
+# Every run takes the same seed, so two sweeps of the same tree give the same table.
+# Usage: bench/sim.sh [megabytes] [endpoint options]
+# Run from the project directory.
+
+MB=${1:-2}
+[ $# -gt 0 ] && shift
+OPTIONS=${*:--c cubic -s}
+SEED=1
+
+make -s bench/sim || exit 1
+
+printf "%d MB over a 100 Mbit/s link, %s\n" "$MB" "$OPTIONS"
+printf "%-7s %-8s %-8s %10s %14s %9s\n" "loss %" "rtt ms" "window" "time s" "goodput Mbit/s" "rtx %"
+for LOSS in 0 1 5 20; do
+    for RTT in 0 20 200; do
+        for WINDOW in 20 64 256; do
+            LINE=$(bench/sim -l $LOSS -r $RTT -s $SEED -n $((MB * 1024 * 1024)) -- -w $WINDOW $OPTIONS)
+            TIME=$(echo "$LINE" | sed 's/.*time_s=\([^ ]*\).*/\1/')
+            GOODPUT=$(echo "$LINE" | sed 's/.*goodput_mbps=\([^ ]*\).*/\1/')
+            RTX=$(echo "$LINE" | sed 's/.*rtx_pct=\([^ ]*\).*/\1/')
+            printf "%-7s %-8s %-8s %10s %14s %9s\n" $LOSS $RTT $WINDOW $TIME $GOODPUT $RTX
+        done
+    done
+done
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Sends a random file to a server whose stdout is read slowly and in small pieces,
+# once with stdin and stdout handled on the protocol thread and once with -l,
+# and reports goodput and the ack latency the client saw, from its RTT histogram.
+# Usage: [ARGS="options"] bench/slowsink.sh [megabytes] [ms between reads] [port]
+# ARGS is passed to both endpoints, for example ARGS="-w 256 -c cubic -s".
+# Run from the project directory after `make build`.
+
+MB=${1:-10}
+PAUSE=${2:-5}
+PORT=${3:-9411}
+TMP=$(mktemp -d)
+TIMEOUT=120
+
+now_ms() {
+    date +%s%3N
+}
+
+cleanup() {
+    kill $SERVER $CLIENT $READER $HOLDER 2>/dev/null
+    rm -rf $TMP
+}
+trap cleanup EXIT
+
+# reads 16 KB at most at a time, pausing in between
+slow_reader() {
+    while :; do
+        dd bs=16k count=1 2>/dev/null
+        sleep $(awk -v ms=$PAUSE 'BEGIN { print ms / 1000 }')
+    done
+}
+
+head -c $((MB * 1024 * 1024)) /dev/urandom > $TMP/in.bin
+SIZE=$(stat -c %s $TMP/in.bin)
+mkfifo $TMP/idle
+sleep 100000 > $TMP/idle &  # keeps the server's stdin open, so neither side closes before USR1
+HOLDER=$!
+
+# run <server options>, prints goodput and the median and 99th percentile RTT
+run() {
+    PORT=$((PORT + 1))
+    rm -f $TMP/sink $TMP/out.bin
+    mkfifo $TMP/sink
+    slow_reader < $TMP/sink > $TMP/out.bin &
+    READER=$!
+    ./server $ARGS $1 $PORT < $TMP/idle > $TMP/sink 2>/dev/null &
+    SERVER=$!
+    sleep 0.2
+    START=$(now_ms)
+    ./client $ARGS localhost $PORT < $TMP/in.bin > /dev/null 2>$TMP/client.err &
+    CLIENT=$!
+    while [ "$(stat -c %s $TMP/out.bin)" -lt "$SIZE" ]; do
+        if [ $(($(now_ms) - START)) -gt $((TIMEOUT * 1000)) ]; then
+            break
+        fi
+        sleep 0.02
+    done
+    END=$(now_ms)
+    kill -USR1 $CLIENT
+    sleep 0.1
+    kill $SERVER $CLIENT $READER 2>/dev/null
+    wait $SERVER $CLIENT $READER 2>/dev/null
+    cmp -s $TMP/in.bin $TMP/out.bin && RESULT=ok || RESULT=CORRUPT
+    # bucket i of the histogram holds samples under 2^i us
+    grep -o '"rtt_us":\[[0-9,]*\]' $TMP/client.err | tail -1 | tr -d '"rtt_us:[]' |
+        awk -F, -v b=$SIZE -v ms=$((END - START)) -v r=$RESULT -v name="${1:-default}" '{
+        total = 0
+        for (i = 1; i <= NF; i++)
+            total += $i
+        seen = 0
+        for (i = 1; i <= NF; i++) {
+            seen += $i
+            if (p50 == "" && seen >= total * 0.5) p50 = 2 ^ (i - 1) / 1000
+            if (p99 == "" && seen >= total * 0.99) p99 = 2 ^ (i - 1) / 1000
+        }
+        printf "%-10s%12.1f%14s%14s%10s\n", name, b * 8 / ms / 1000, "<" p50, "<" p99, r
+    }'
+}
+
+printf "%-10s%12s%14s%14s%10s\n" "server" "Mbit/s" "rtt p50 ms" "rtt p99 ms" "data"
+run ""
+run "-l"
+echo "$MB MB, stdout read 16 KB at a time every $PAUSE ms"
@@ -0,0 +1,151 @@
+// Counts the syscalls an endpoint makes through libc, when preloaded into it.
+// Usage: SYSCOUNT=<file> LD_PRELOAD=bench/syscount.so ./server ...
+// The counts live in <file>, mapped shared, so they can be read at any time, even after the
+// process is killed, as 8 native unsigned integers (od -An -t u8 <file>), in this order:
+// sends (sendto, sendmsg, sendmmsg), receives (recvfrom, recvmsg, recvmmsg),
+// reads (read, readv), writes (write, writev), waits (epoll_wait, poll),
+// io_uring_enter, epoll_ctl and timerfd_settime.
+// The data in and out of stdio and eventfds is counted with the reads and writes.
+// Calls through the vDSO, like clock_gettime, don't enter the kernel and aren't counted.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+enum { SENDS, RECEIVES, READS, WRITES, WAITS, URING_ENTERS, EPOLL_CTLS, TIMER_SETS, COUNTERS };
+
+static uint64_t local[COUNTERS];  // until the file is mapped, and without SYSCOUNT
+static uint64_t *counts = local;
+
+__attribute__((constructor)) static void sc_init() {
+    const char *path = getenv("SYSCOUNT");
+    if (path == NULL)
+        return;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(local)) < 0)
+        return;
+    void *map = mmap(NULL, sizeof(local), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map != MAP_FAILED)
+        counts = map;
+}
+
+static void count(int which) {
+    __atomic_fetch_add(&counts[which], 1, __ATOMIC_RELAXED);
+}
+
+// looks up the libc function that the wrapper of the same name hides, once
+#define REAL(name) \
+    static __typeof__(name) *real; \
+    if (real == NULL) \
+        real = (__typeof__(name)*) dlsym(RTLD_NEXT, #name)
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr,
+               socklen_t addrlen) {
+    REAL(sendto);
+    count(SENDS);
+    return real(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    REAL(sendmsg);
+    count(SENDS);
+    return real(fd, msg, flags);
+}
+
+int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags) {
+    REAL(sendmmsg);
+    count(SENDS);
+    return real(fd, msgs, n, flags);
+}
+
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr,
+                 socklen_t *addrlen) {
+    REAL(recvfrom);
+    count(RECEIVES);
+    return real(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) {
+    REAL(recvmsg);
+    count(RECEIVES);
+    return real(fd, msg, flags);
+}
+
+int recvmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags, struct timespec *timeout) {
+    REAL(recvmmsg);
+    count(RECEIVES);
+    return real(fd, msgs, n, flags, timeout);
+}
+
+ssize_t read(int fd, void *buf, size_t len) {
+    REAL(read);
+    count(READS);
+    return real(fd, buf, len);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    REAL(readv);
+    count(READS);
+    return real(fd, iov, iovcnt);
+}
+
+ssize_t write(int fd, const void *buf, size_t len) {
+    REAL(write);
+    count(WRITES);
+    return real(fd, buf, len);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    REAL(writev);
+    count(WRITES);
+    return real(fd, iov, iovcnt);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int max, int timeout) {
+    REAL(epoll_wait);
+    count(WAITS);
+    return real(epfd, events, max, timeout);
+}
+
+int poll(struct pollfd *fds, nfds_t n, int timeout) {
+    REAL(poll);
+    count(WAITS);
+    return real(fds, n, timeout);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    REAL(epoll_ctl);
+    count(EPOLL_CTLS);
+    return real(epfd, op, fd, event);
+}
+
+int timerfd_settime(int fd, int flags, const struct itimerspec *value, struct itimerspec *old) {
+    REAL(timerfd_settime);
+    count(TIMER_SETS);
+    return real(fd, flags, value, old);
+}
+
+// io_uring has no libc wrappers, the endpoints make its syscalls by number
+long syscall(long number, ...) {
+    REAL(syscall);
+    va_list ap;
+    va_start(ap, number);
+    long a[6];
+    for (int i = 0; i < 6; i++)
+        a[i] = va_arg(ap, long);
+    va_end(ap);
+    if (number == __NR_io_uring_enter)
+        count(URING_ENTERS);
+    return real(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
@@ -0,0 +1,117 @@
+// Compares the timer wheel against scanning every deadline, which is how the
+// server found its next timeout before.
+// Usage: bench/timers [expiries per run]
+// Every timer is armed with a deadline between 50 ms and 3 s, like an RTO, and
+// armed again for a new one whenever it fires, so the count stays constant.
+// Time is simulated: the loop jumps to the next deadline the way the event loop
+// would sleep until it, and fires what is due.
+// arm:    ns to move an armed timer to a new deadline, as on every new ack
+// wheel:  ns per expiry, finding the next deadline and firing included
+// scan:   ns per expiry when every wakeup scans all the deadlines, waking on
+//         the same ticks as the wheel so that both fire the same timers together
+// late:   most a wheel timer fired after its deadline, in us
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "wheel.h"
+
+#define MIN_TIMEOUT 50000
+#define MAX_TIMEOUT 3000000
+
+static const uint32_t counts[] = {1000, 10000, 100000};
+
+static uint64_t sim_now;        // simulated time in us
+static uint64_t fired;
+static uint64_t latest;         // most a timer fired after its deadline
+static uint64_t early;          // timers that fired before their deadline
+static timer_wheel wheel;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t timeout() {
+    return MIN_TIMEOUT + (uint64_t) rand() % (MAX_TIMEOUT - MIN_TIMEOUT);
+}
+
+static void on_fire(timer *t) {
+    if (sim_now < t->expires)
+        early++;
+    else if (sim_now - t->expires > latest)
+        latest = sim_now - t->expires;
+    fired++;
+    wheel_arm(&wheel, t, sim_now + timeout());
+}
+
+static double bench_arm(timer *timers, uint32_t n, uint32_t rounds) {
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < rounds; i++)
+        wheel_arm(&wheel, &timers[i % n], sim_now + timeout());
+    return (double) (now_ns() - start) / rounds;
+}
+
+static double bench_wheel(uint32_t expiries) {
+    fired = 0;
+    uint64_t start = now_ns();
+    while (fired < expiries) {
+        sim_now = wheel_next(&wheel);
+        wheel_advance(&wheel, sim_now);
+    }
+    return (double) (now_ns() - start) / fired;
+}
+
+static double bench_scan(uint64_t *deadlines, uint32_t n, uint32_t expiries) {
+    uint64_t now = 0;
+    uint64_t done = 0;
+    uint64_t start = now_ns();
+    while (done < expiries) {
+        uint64_t next = UINT64_MAX;
+        for (uint32_t i = 0; i < n; i++) {
+            if (deadlines[i] <= now) {
+                deadlines[i] = now + timeout();
+                done++;
+            }
+            if (deadlines[i] < next)
+                next = deadlines[i];
+        }
+        now = (next + WHEEL_TICK_US - 1) / WHEEL_TICK_US * WHEEL_TICK_US;
+    }
+    return (double) (now_ns() - start) / done;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t expiries = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (expiries == 0) {
+        fprintf(stderr, "usage: %s [expiries per run]\n", argv[0]);
+        return 1;
+    }
+    printf("%8s %10s %10s %10s %10s\n", "timers", "arm", "wheel", "scan", "late us");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        uint32_t n = counts[c];
+        timer *timers = malloc(n * sizeof(timer));
+        uint64_t *deadlines = malloc(n * sizeof(uint64_t));
+        srand(1);
+        sim_now = 0;
+        latest = 0;
+        early = 0;
+        wheel_init(&wheel, sim_now);
+        for (uint32_t i = 0; i < n; i++) {
+            timer_init(&timers[i], on_fire);
+            wheel_arm(&wheel, &timers[i], timeout());
+            deadlines[i] = timeout();
+        }
+        double arm = bench_arm(timers, n, expiries);
+        double wheel_ns = bench_wheel(expiries);
+        // the scan costs the number of timers per wakeup, a few thousand wakeups are enough
+        uint32_t scan_expiries = expiries < 2 * n ? expiries : 2 * n;
+        double scan_ns = bench_scan(deadlines, n, scan_expiries);
+        printf("%8u %10.1f %10.1f %10.1f %10lu%s\n", n, arm, wheel_ns, scan_ns,
+               (unsigned long) latest, early ? "  FIRED EARLY" : "");
+        fflush(stdout);
+        free(timers);
+        free(deadlines);
+    }
+    return 0;
+}
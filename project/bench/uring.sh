@@ -0,0 +1,83 @@
+#!/bin/sh
+# Transfers a random file from client to server over loopback, once with the usual socket
+# calls and once with both endpoints on io_uring (-u), and reports throughput, the packets
+# each endpoint handled per second of CPU it used, and the syscalls it made per packet.
+# Usage: [ARGS="options"] bench/uring.sh [megabytes] [port]
+# ARGS is passed to both endpoints, for example ARGS="-w 256 -c cubic -s".
+# Run from the project directory after `make build bench/syscount.so`.
+
+MB=${1:-50}
+PORT=${2:-9611}
+TMP=$(mktemp -d)
+HZ=$(getconf CLK_TCK)
+TIMEOUT=120
+
+cpu_ticks() {  # utime + stime of a pid
+    awk '{print $14 + $15}' /proc/$1/stat
+}
+
+now_ms() {
+    date +%s%3N
+}
+
+syscalls() {  # all the counters bench/syscount.so keeps
+    od -An -t u8 -v $1 | awk '{ for (i = 1; i <= NF; i++) total += $i } END { print total + 0 }'
+}
+
+cleanup() {
+    kill $SERVER $CLIENT $HOLDER 2>/dev/null
+    rm -rf $TMP
+}
+trap cleanup EXIT
+
+if [ ! -f bench/syscount.so ]; then
+    echo "make bench/syscount.so first"
+    exit 1
+fi
+head -c $((MB * 1024 * 1024)) /dev/urandom > $TMP/in.bin
+SIZE=$(stat -c %s $TMP/in.bin)
+mkfifo $TMP/idle
+sleep 100000 > $TMP/idle &  # keeps the server's stdin open, so neither side closes before USR1
+HOLDER=$!
+
+# run <name> <endpoint options>
+run() {
+    PORT=$((PORT + 1))
+    SYSCOUNT=$TMP/server.sc LD_PRELOAD=bench/syscount.so \
+        ./server $ARGS $2 $PORT < $TMP/idle > $TMP/out.bin 2>$TMP/server.err &
+    SERVER=$!
+    sleep 0.2
+    START=$(now_ms)
+    SYSCOUNT=$TMP/client.sc LD_PRELOAD=bench/syscount.so \
+        ./client $ARGS $2 localhost $PORT < $TMP/in.bin > /dev/null 2>$TMP/client.err &
+    CLIENT=$!
+    while [ "$(stat -c %s $TMP/out.bin)" -lt "$SIZE" ]; do
+        if [ $(($(now_ms) - START)) -gt $((TIMEOUT * 1000)) ]; then
+            break
+        fi
+        sleep 0.01
+    done
+    END=$(now_ms)
+    S_CPU=$(cpu_ticks $SERVER)
+    C_CPU=$(cpu_ticks $CLIENT)
+    kill -USR1 $SERVER $CLIENT  # their stats lines have the packets they sent
+    sleep 0.1
+    kill $SERVER $CLIENT 2>/dev/null
+    wait $SERVER $CLIENT 2>/dev/null
+    cmp -s $TMP/in.bin $TMP/out.bin && RESULT=ok || RESULT=CORRUPT
+    DATA=$(grep -o '"pkts_sent":[0-9]*' $TMP/client.err | tail -1 | cut -d: -f2)
+    ACKS=$(grep -o '"pkts_sent":[0-9]*' $TMP/server.err | tail -1 | cut -d: -f2)
+    # each endpoint handles every data packet and every ack, one way or the other
+    awk -v name="$1" -v mb=$MB -v ms=$((END - START)) -v hz=$HZ -v r=$RESULT \
+        -v sc=$S_CPU -v cc=$C_CPU -v pkts=$((${DATA:-0} + ${ACKS:-0})) \
+        -v ss=$(syscalls $TMP/server.sc) -v cs=$(syscalls $TMP/client.sc) 'BEGIN {
+        printf "%-8s%9.2f%14.0f%14.0f%14.2f%14.2f%10s\n", name, mb * 1000 / ms,
+               pkts / (sc / hz) / 1000, pkts / (cc / hz) / 1000, ss / pkts, cs / pkts, r
+    }'
+}
+
+printf "%-8s%9s%14s%14s%14s%14s%10s\n" "" "" "server kpps" "client kpps" "server" "client" ""
+printf "%-8s%9s%14s%14s%14s%14s%10s\n" "io" "MB/s" "per cpu s" "per cpu s" "calls/pkt" "calls/pkt" "data"
+run "socket" ""
+run "uring" "-u"
+echo "$MB MB, packets are data and acks, syscalls as counted by bench/syscount.so"
@@ -0,0 +1,188 @@
+#include <math.h>
+#include <string.h>
+#include "cc.h"
+
+#define CC_INIT_CWND 10     // initial window, as in RFC 6928
+#define CC_MIN_CWND 2       // window after a loss is never reduced below this
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+static const cc_ops *algorithms[] = {&cc_fixed, &cc_newreno, &cc_cubic};
+
+static double max_d(double a, double b) {
+    return a > b ? a : b;
+}
+
+/* Looks up an algorithm by name, returns NULL if there is none. */
+const cc_ops* cc_find(const char *name) {
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++)
+        if (strcmp(algorithms[i]->name, name) == 0)
+            return algorithms[i];
+    return NULL;
+}
+
+void cc_init(cc_state *cc, const cc_ops *ops, uint32_t max_cwnd) {
+    cc->ops = ops;
+    cc->max_cwnd = max_cwnd;
+    cc->cwnd = CC_INIT_CWND;
+    cc->ssthresh = max_cwnd;
+    cc->sack = false;
+    cc->phase = CC_OPEN;
+    cc->recover = 0;
+    cc->w_max = 0;
+    cc->origin = 0;
+    cc->k = 0;
+    cc->w_est = 0;
+    cc->epoch_start = 0;
+    ops->init(cc);
+}
+
+/* Returns the number of packets allowed in flight. */
+uint32_t cc_window(const cc_state *cc) {
+    if (cc->cwnd < 1)
+        return 1;
+    if (cc->cwnd > cc->max_cwnd)
+        return cc->max_cwnd;
+    return (uint32_t) cc->cwnd;
+}
+
+/* Called when an ack removes packets from the send buffer.
+In fast recovery, an ack below the recovery point is partial: the window is deflated
+by the acked packets, and the ack that covers it ends recovery at ssthresh (RFC 6582).
+After a timeout, the window keeps growing while the send buffer is repaired.
+Returns true on a partial ack, meaning the front of the send buffer was lost as well. */
+bool cc_on_ack(cc_state *cc, uint32_t acked, uint64_t ack, uint64_t now, const rtt_estimator *rtt) {
+    if (cc->phase == CC_RECOVERY) {
+        if (ack < cc->recover) {
+            if (!cc->sack)
+                cc->cwnd = max_d(cc->cwnd - acked + 1, 1);
+            return true;
+        }
+        cc->phase = CC_OPEN;
+        cc->cwnd = cc->ssthresh;
+        return false;
+    }
+    if (cc->phase == CC_LOSS && ack >= cc->recover)
+        cc->phase = CC_OPEN;
+    cc->ops->on_ack(cc, acked, now, rtt);
+    if (cc->cwnd > cc->max_cwnd)  // don't grow past what the buffer can use
+        cc->cwnd = cc->max_cwnd;
+    return cc->phase == CC_LOSS;
+}
+
+/* Each duplicate ack in fast recovery means a packet has left the network,
+so the window is inflated to let a new one in and keep the ack clock running. */
+void cc_on_dup_ack(cc_state *cc) {
+    if (cc->phase == CC_RECOVERY && !cc->sack)
+        cc->cwnd += 1;
+}
+
+/* Called on a fast retransmit. Only the first loss in a window reduces it,
+recovery lasts until everything sent before the loss (up to recover) is acked. */
+void cc_on_loss(cc_state *cc, uint32_t in_flight, uint64_t recover, uint64_t now) {
+    if (cc->phase != CC_OPEN)
+        return;
+    cc->phase = CC_RECOVERY;
+    cc->recover = recover;
+    cc->ops->on_loss(cc, in_flight, now);
+    if (!cc->sack)
+        cc->cwnd = cc->ssthresh + 3;  // the three duplicates have left the network
+}
+
+/* Called when the retransmission timer expires, everything sent so far may need repair. */
+void cc_on_timeout(cc_state *cc, uint32_t in_flight, uint64_t recover, uint64_t now) {
+    cc->phase = CC_LOSS;
+    cc->recover = recover;
+    cc->ops->on_timeout(cc, in_flight, now);
+}
+
+/* Fixed window, the whole send buffer may always be in flight. */
+static void fixed_init(cc_state *cc) {
+    cc->cwnd = cc->max_cwnd;
+}
+
+static void fixed_on_ack(cc_state *cc, uint32_t acked, uint64_t now, const rtt_estimator *rtt) {
+    (void) cc, (void) acked, (void) now, (void) rtt;
+}
+
+static void fixed_on_loss(cc_state *cc, uint32_t in_flight, uint64_t now) {
+    (void) cc, (void) in_flight, (void) now;
+}
+
+const cc_ops cc_fixed = {"fixed", fixed_init, fixed_on_ack, fixed_on_loss, fixed_on_loss};
+
+/* NewReno (RFC 6582), slow start then one packet per round trip, halved on loss. */
+static void reno_init(cc_state *cc) {
+    (void) cc;
+}
+
+static void reno_on_ack(cc_state *cc, uint32_t acked, uint64_t now, const rtt_estimator *rtt) {
+    (void) now, (void) rtt;
+    if (cc->cwnd < cc->ssthresh)
+        cc->cwnd += acked;  // slow start
+    else
+        cc->cwnd += acked / cc->cwnd;  // congestion avoidance
+}
+
+static void reno_on_loss(cc_state *cc, uint32_t in_flight, uint64_t now) {
+    (void) now;
+    cc->ssthresh = max_d(in_flight / 2.0, CC_MIN_CWND);
+    cc->cwnd = cc->ssthresh;
+}
+
+static void reno_on_timeout(cc_state *cc, uint32_t in_flight, uint64_t now) {
+    reno_on_loss(cc, in_flight, now);
+    cc->cwnd = 1;
+}
+
+const cc_ops cc_newreno = {"newreno", reno_init, reno_on_ack, reno_on_loss, reno_on_timeout};
+
+/* CUBIC (RFC 9438), the window follows a cubic curve in the time since the last loss,
+so it recovers quickly on paths with a large bandwidth-delay product. */
+static void cubic_on_ack(cc_state *cc, uint32_t acked, uint64_t now, const rtt_estimator *rtt) {
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;  // slow start
+        return;
+    }
+    if (cc->epoch_start == 0) {  // first ack of congestion avoidance
+        cc->epoch_start = now;
+        if (cc->cwnd < cc->w_max) {
+            cc->k = cbrt((cc->w_max - cc->cwnd) / CUBIC_C);
+            cc->origin = cc->w_max;
+        } else {
+            cc->k = 0;
+            cc->origin = cc->cwnd;
+        }
+        cc->w_est = cc->cwnd;
+    }
+    double t = (now - cc->epoch_start + rtt->srtt) / 1e6 - cc->k;
+    double target = cc->origin + CUBIC_C * t * t * t;
+    // never more than 1.5x per round trip
+    if (target > 1.5 * cc->cwnd)
+        target = 1.5 * cc->cwnd;
+
+    // a Reno flow with the same beta, the window never grows slower than this
+    cc->w_est += acked * 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) / cc->cwnd;
+    if (target < cc->w_est)
+        target = cc->w_est;
+    if (target > cc->cwnd)
+        cc->cwnd += acked * (target - cc->cwnd) / cc->cwnd;
+}
+
+static void cubic_on_loss(cc_state *cc, uint32_t in_flight, uint64_t now) {
+    (void) in_flight, (void) now;
+    cc->epoch_start = 0;
+    if (cc->cwnd < cc->w_max)  // fast convergence, release bandwidth to newer flows
+        cc->w_max = cc->cwnd * (1 + CUBIC_BETA) / 2;
+    else
+        cc->w_max = cc->cwnd;
+    cc->ssthresh = max_d(cc->cwnd * CUBIC_BETA, CC_MIN_CWND);
+    cc->cwnd = cc->ssthresh;
+}
+
+static void cubic_on_timeout(cc_state *cc, uint32_t in_flight, uint64_t now) {
+    cubic_on_loss(cc, in_flight, now);
+    cc->cwnd = 1;
+}
+
+const cc_ops cc_cubic = {"cubic", reno_init, cubic_on_ack, cubic_on_loss, cubic_on_timeout};
@@ -0,0 +1,57 @@
+#ifndef PROJECT_CC_H_
+#define PROJECT_CC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtt.h"
+
+typedef struct cc_state cc_state;
+
+typedef enum {
+    CC_OPEN,        // no loss outstanding
+    CC_RECOVERY,    // fast recovery after duplicate acks, the window is inflated by each duplicate
+    CC_LOSS,        // repairing the send buffer after a timeout, the window grows normally
+} cc_phase;
+
+/* A congestion control algorithm.
+The callbacks only adjust cwnd and ssthresh, loss recovery is shared by all of them. */
+typedef struct cc_ops {
+    const char *name;
+    void (*init)(cc_state *cc);
+    // new packets were acked outside of fast recovery
+    void (*on_ack)(cc_state *cc, uint32_t acked, uint64_t now, const rtt_estimator *rtt);
+    // a loss was detected from duplicate acks
+    void (*on_loss)(cc_state *cc, uint32_t in_flight, uint64_t now);
+    // the retransmission timer expired
+    void (*on_timeout)(cc_state *cc, uint32_t in_flight, uint64_t now);
+} cc_ops;
+
+struct cc_state {
+    const cc_ops *ops;
+    double cwnd;            // congestion window in packets
+    double ssthresh;        // slow start threshold in packets
+    uint32_t max_cwnd;      // send buffer capacity in packets
+    bool sack;              // in flight is counted from the sack scoreboard, so recovery doesn't inflate the window
+    cc_phase phase;
+    uint64_t recover;       // recovery ends once this seq number is acked
+    // CUBIC state
+    double w_max;           // window before the last reduction
+    double origin;          // plateau of the cubic curve in this epoch
+    double k;               // time to grow back to the origin in seconds
+    double w_est;           // Reno-friendly window estimate
+    uint64_t epoch_start;   // start of the current congestion avoidance epoch, 0 if none
+};
+
+extern const cc_ops cc_fixed;
+extern const cc_ops cc_newreno;
+extern const cc_ops cc_cubic;
+
+const cc_ops* cc_find(const char *name);
+void cc_init(cc_state *cc, const cc_ops *ops, uint32_t max_cwnd);
+uint32_t cc_window(const cc_state *cc);
+bool cc_on_ack(cc_state *cc, uint32_t acked, uint64_t ack, uint64_t now, const rtt_estimator *rtt);
+void cc_on_dup_ack(cc_state *cc);
+void cc_on_loss(cc_state *cc, uint32_t in_flight, uint64_t recover, uint64_t now);
+void cc_on_timeout(cc_state *cc, uint32_t in_flight, uint64_t recover, uint64_t now);
+
+#endif  // PROJECT_CC_H_
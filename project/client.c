@@ -7,9 +7,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <fcntl.h>
-#include <time.h>
 #include "utils.h"
-#include "deque.h"
 #include "common.h"
 
 
@@ -37,42 +35,82 @@ int main(int argc, char *argv[]) {
     // Seed the random number generator
     srand(0);
 
+    options opt;
+    opt_parse(&opt, &argc, &argv, "[host] [port]");
+
+    endpoint ep;
+    ep_init(&ep, &opt);
     params p;
-    p_init(&p, 20, argc, argv, construct_serveraddr);
+    p_init(&p, &ep, STDIN_FILENO, STDOUT_FILENO);
+    construct_serveraddr(&p.addr, argc, argv);
 
-    stdin_nonblock();
+    if (opt.pipeline) {
+        p_start_pipeline(&p);
+    } else {
+        stdin_nonblock();
+        stdout_nonblock();
+    }
 
-    // Create the SYN packet
-    p.pkt_send.seq = p.send_seq;
-    p.pkt_send.ack = p.recv_seq;
-    p.pkt_send.length = 0;
-    p.pkt_send.flags = PKT_SYN;
+    // with fast open, the syn asks for a cookie, or carries the first segment with the one kept,
+    // small enough with the segment size for any server
+    uint16_t length = 0;
+    if (opt.cookie_file != NULL) {
+        p.cookie = cookie_load(opt.cookie_file, &p.addr);
+        uint32_t max = opt.mss > MSS ? MSS - MSS_OPTION_SIZE : MSS;
+        int bytes = p.cookie != 0 ? p_read_input(&p, max) : 0;
+        length = bytes <= 0 ? 0 : (uint32_t) bytes < max ? (uint32_t) bytes : max;
+        if (p.cookie == 0)
+            p.cookie = COOKIE_REQUEST;
+    }
 
-    // Push the syn packet onto the queue and send it
-    p_send_and_enqueue_pkt_send(&p);
+    // Push the syn packet onto the queue and send it, offering selective acks, compact acks,
+    // 64 bit seq numbers, parity packets, larger segments and flow control
+    p_send_and_enqueue(&p, length, PKT_SYN | PKT_WINDOW | (opt.sack ? PKT_SACK : 0) |
+                                   (opt.compact ? PKT_COMPACT : 0) | (opt.seq64 ? PKT_SEQ64 : 0) |
+                                   (opt.fec ? PKT_FEC : 0) | (opt.mss > MSS ? PKT_MSS : 0));
     p.send_seq++;
 
     for (;;) {  // wait for syn ack
-        p_retransmit_on_timeout(&p);
-        if (recv_packet(p.sockfd, &p.addr, &p.pkt_recv) <= 0)
+        if (!p_recv(&p)) {
+            p_wait(&p, false);  // sleep until a packet arrives or the timer expires
             continue;
-        if (p.pkt_recv.flags & PKT_ACK && p.pkt_recv.flags & PKT_SYN) {  // syn ack packet
+        }
+        if (p.pkt_recv->flags & PKT_ACK && p.pkt_recv->flags & PKT_SYN) {  // syn ack packet
+            // a server that didn't take the data of the syn only acks the syn,
+            // then the data goes again as the syn ack ack, right after the syn
+            sb_entry *syn = sb_front(p.send_q);
+            bool refused = syn != NULL && syn->flags & PKT_SYN && syn->length > 0 &&
+                           p.pkt_recv->ack == syn->seq + 1;
+            if (refused) {
+                syn->seq++;
+                syn->flags = PKT_ACK;
+                syn->tx_count = 0;
+            }
             if (p_clear_acked_packets_from_sbuf(&p))  // reset the clock if new ack received
-                p.before = clock();
-            p.recv_seq = p.pkt_recv.seq + 1;
-            if (!p_send_payload_ack(&p)) {
+                p_restart_timer(&p);
+            p.recv_seq = p.pkt_recv->seq + 1;
+            p_negotiate(&p);
+            uint32_t cookie = wire_cookie(p.pkt_recv);
+            if (opt.cookie_file != NULL && cookie > COOKIE_REQUEST && cookie != p.cookie)
+                cookie_save(opt.cookie_file, &p.addr, cookie);
+            if (refused) {
+                p_retransmit_front(&p, TR_SEND);
+            } else if (!p_send_payload_ack(&p)) {
                 p.pkt_send.flags = PKT_ACK;
                 p.pkt_send.ack = p.recv_seq;
                 p.pkt_send.seq = p.send_seq;
                 p.pkt_send.length = 0;
-                send_packet(p.sockfd, &p.addr, &p.pkt_send, "SEND");
+                p_send(&p, &p.pkt_send, TR_SEND);
                 p.send_seq++;
             }
             break;
         } else {
-            send_packet(p.sockfd, &p.addr, q_front(p.send_q), "SEND");
+            p_retransmit_front(&p, TR_SEND);
         }
     }
+    p_established(&p);
 
     p_listen(&p);
+    p_finish(&p, NULL, -1);
+    return 0;
 }
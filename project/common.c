@@ -1,134 +1,887 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 #include "utils.h"
-#include "deque.h"
 #include "common.h"
 
-/* Initializes the parameters needed by the client or server. */
-void p_init(params *p,
-            int q_capacity,
-            int argc,
-            char *argv[],
-            void (*construct_addr)(struct sockaddr_in*, int, char*[])) {
-    p->sockfd = make_nonblock_socket();
+/* Opens the socket, and sets up the event loop, the batches, the timers and the stats emitter.
+With -u the socket is driven through io_uring, and the event loop watches the ring instead,
+unless the kernel can't, then the socket is used directly as without it. */
+void ep_init(endpoint *ep, const options *opt) {
+    trace_init(opt->verbosity, opt->trace_file);
+    stats_emitter_init(&ep->emitter, opt->stats_target, opt->stats_interval);
+    ep->sockfd = make_nonblock_socket();
+    if (opt->mss > MSS) {  // segments past MSS are probed for, and must not be fragmented
+        pmtu_enable(ep->sockfd);
+        // the default buffers take fewer large datagrams than a window's worth
+        grow_socket_buffers(ep->sockfd, opt->window * (opt->mss + HEADER_SIZE));
+    }
+    ep->opt = opt;
+    memset(&ep->pkt_recv, 0, sizeof(packet));
+    memset(&ep->from, 0, sizeof(ep->from));
+    ep->ring = NULL;
+    if (opt->uring) {
+        ep->ring = malloc(sizeof(uring));
+        if (ep->ring == NULL)
+            die("io_uring malloc failed");
+        if (!ur_init(ep->ring, ep->sockfd, opt->batch)) {
+            free(ep->ring);
+            ep->ring = NULL;
+        }
+    }
+    ev_init(&ep->ev, ep->ring != NULL ? ep->ring->fd : ep->sockfd);
+    // offload works on batches, and falls back to plain batching if the kernel lacks it.
+    // the ring receives single datagrams, GRO would coalesce them past its buffers
+    bool offload = opt->offload && opt->batch > 1 && ep->ring == NULL && batch_enable_offload(ep->sockfd);
+    batch_init(&ep->rx, opt->batch, offload ? GRO_MAX_SIZE : WIRE_MAX_SIZE, offload);
+    batch_init(&ep->tx, opt->batch, WIRE_MAX_SIZE, offload);
+    ep->tx.ring = ep->ring;
+    ep->tx.txtime = opt->pace != 0 && batch_enable_txtime(ep->sockfd);
+    wheel_init(&ep->wheel, now_us());
+}
+
+/* Receives the next packet into pkt_recv, and its sender into from.
+Compact acks are accepted if this side offers them, since the peer can't be known before decoding.
+A peer only sends them once they were negotiated on its connection.
+Returns false if no packet is waiting. */
+bool ep_recv(endpoint *ep) {
+    if (ep->ring != NULL)
+        return ur_recv(ep->ring, &ep->from, &ep->pkt_recv, ep->opt->compact);
+    return ep->opt->batch > 1 ?
+           batch_recv(&ep->rx, ep->sockfd, &ep->from, &ep->pkt_recv, ep->opt->compact) :
+           recv_packet(ep->sockfd, &ep->from, &ep->pkt_recv, ep->opt->compact) > 0;
+}
+
+/* Returns true if received packets are waiting to be handed out, which epoll can't see anymore. */
+bool ep_pending(endpoint *ep) {
+    return ep->ring != NULL ? ur_pending(ep->ring) : batch_pending(&ep->rx);
+}
+
+/* Sends the packets queued by every connection. */
+void ep_flush(endpoint *ep) {
+    batch_flush(&ep->tx, ep->sockfd);
+}
+
+static void p_on_rto(timer *t) {
+    p_retransmit_on_timeout(container_of(t, params, rto));
+}
+
+/* Sends an ack if nothing else was sent since the last keepalive, so that the peer and
+any NAT on the way keep the connection while no data flows. */
+static void p_on_keepalive(timer *t) {
+    params *p = container_of(t, params, keepalive);
+    if (p->stats.pkts_sent == p->keepalive_sent)
+        p_send_empty_ack(p);
+    p->keepalive_sent = p->stats.pkts_sent;
+    wheel_arm(&p->ep->wheel, &p->keepalive, now_us() + KEEPALIVE_US);
+}
+
+static void p_on_linger(timer *t) {
+    p_linger(container_of(t, params, linger));
+}
+
+static void p_on_delack(timer *t) {
+    p_send_empty_ack(container_of(t, params, delack));
+}
+
+static void p_probe_path(params *p);
+
+/* Counts the probe out as lost, or starts the search over once it is done. */
+static void p_on_pmtu(timer *t) {
+    params *p = container_of(t, params, pmtu_timer);
+    if (p->pmtu.probe != 0)
+        pmtu_lost(&p->pmtu);
+    else
+        pmtu_raise(&p->pmtu);
+    p_probe_path(p);
+}
+
+/* Sends what the pacer held back. */
+static void p_on_pace(timer *t) {
+    params *p = container_of(t, params, pace);
+    while (p_send_payload_ack(p))
+        continue;
+}
+
+/* Initializes a connection on the endpoint.
+Data to send is read from in_fd, and data received is written to out_fd. */
+void p_init(params *p, endpoint *ep, int in_fd, int out_fd) {
+    const options *opt = ep->opt;
+    stats_init(&p->stats);
+    p->ep = ep;
+    p->sockfd = ep->sockfd;
+    p->in_fd = in_fd;
+    p->out_fd = out_fd;
     memset(&p->pkt_send, 0, sizeof(packet));
-    memset(&p->pkt_recv, 0, sizeof(packet));
+    p->pkt_recv = &ep->pkt_recv;
     p->recv_seq = 0;
     p->send_seq = rand() & RANDMASK;
-    p->recv_q = q_init(q_capacity);
-    p->send_q = q_init(q_capacity);
-    if (p->recv_q == NULL || p->send_q == NULL)
-        die("queue initialization malloc failed");
+    // the buffers take a window of the largest segments this side offers
+    p->recv_q = rb_init(opt->window * opt->mss);
+    p->send_q = sb_init(opt->window, opt->window * opt->mss);
+    // a whole window drained from the receive buffer, plus a batch of new packets
+    p->out = ob_init((opt->window + opt->batch) * opt->mss);
+    if (p->recv_q == NULL || p->send_q == NULL || p->out == NULL)
+        die("buffer initialization malloc failed");
+    p->io = NULL;
     p->recv_ack = -1;
     p->ack_count = 0;
-    p->before = clock();
-    if (construct_addr != NULL)
-        construct_addr(&p->addr, argc, argv);
+    p->before = now_us();
+    rtt_init(&p->rtt);
+    cc_init(&p->cc, opt->cc, opt->window);
+    p->opt = opt;
+    p->sack = false;
+    p->compact = false;
+    p->seq64 = false;
+    p->fec = false;
+    fec_encoder_init(&p->fec_tx);
+    p->fec_rx.history = NULL;
+    pmtu_init(&p->pmtu, MSS, MSS);
+    p->stats.segment = MSS;
+    timer_init(&p->pmtu_timer, p_on_pmtu);
+    timer_init(&p->linger, p_on_linger);
+    p->flow = false;
+    p->scale = 0;
+    while ((opt->window >> p->scale) > UINT8_MAX)
+        p->scale++;
+    p->peer_scale = 0;
+    p->rwnd = UINT32_MAX;  // until the peer advertises one
+    p->advertised = opt->window;
+    p->probing = false;
+    p->sacked = 0;
+    p->pipe = 0;
+    p->recovery_start = 0;
+    timer_init(&p->rto, p_on_rto);
+    timer_init(&p->keepalive, p_on_keepalive);
+    p->keepalive_sent = 0;
+    p->established = false;
+    p->fin_sent = false;
+    p->peer_fin = 0;
+    p->peer_closed = false;
+    p->linger_acks = 0;
+    p->lingered = false;
+    p->cookie = 0;
+    timer_init(&p->delack, p_on_delack);
+    p->unacked = 0;
+    pace_init(&p->pacer, opt->pace);
+    timer_init(&p->pace, p_on_pace);
+}
+
+/* Frees the buffers of a connection. Its queued sends must have been flushed. */
+void p_destroy(params *p) {
+    p_detach(p);
+    sb_destroy(p->send_q);
+    rb_destroy(p->recv_q);
+    fec_decoder_destroy(&p->fec_rx);
+    if (p->out != NULL)
+        ob_destroy(p->out);
+}
+
+/* Moves reading in_fd and writing out_fd to threads of their own, for -l.
+Then the output queue of the pipeline takes the place of the output buffer, with the same size.
+The connection can't be destroyed afterwards, the threads run until p_finish. */
+void p_start_pipeline(params *p) {
+    ev_enable_wake(&p->ep->ev);
+    p->io = pl_start(p->in_fd, p->out_fd, &p->ep->ev, (p->opt->window + p->opt->batch) * p->opt->mss);
+    ob_destroy(p->out);
+    p->out = NULL;
+}
+
+/* Returns the bytes of output that can be queued without waiting for out_fd. */
+static uint32_t p_out_space(params *p) {
+    return p->io != NULL ? pl_space(p->io) : ob_space(p->out);
+}
+
+/* Queues the payload of a packet delivered in order for out_fd, from recv_seq on,
+in up to two pieces. With fec, a copy is kept for rebuilding the packets of its group. */
+static void p_deliver(params *p, const struct iovec *payload, int pieces) {
+    if (p->fec)
+        fec_remember(&p->fec_rx, p->recv_seq, payload, pieces);
+    for (int i = 0; i < pieces; i++) {
+        if (p->io != NULL)
+            pl_write(p->io, payload[i].iov_base, payload[i].iov_len);
+        else
+            ob_append(p->out, p->out_fd, payload[i].iov_base, payload[i].iov_len);
+    }
+}
+
+/* Returns true once the connection is done both ways: our fin was acked, or given up on,
+and the peer's fin was received in order. */
+static bool p_done(params *p) {
+    return p->fin_sent && sb_empty(p->send_q) && p->peer_closed;
+}
+
+/* Lingers once the connection is done both ways, or starts the linger over when the peer sent
+something meanwhile. Like TCP's TIME_WAIT: the peer may have missed our last ack and wait for it,
+retransmitting what we acked already, while we would be gone. */
+static void p_start_linger(params *p) {
+    if (p_done(p) && !p->lingered) {
+        p->linger_acks = 0;
+        wheel_arm(&p->ep->wheel, &p->linger, now_us() + rtt_timeout(&p->rtt));
+    }
+}
+
+/* Takes the timers of a connection off the wheel of its endpoint. */
+void p_detach(params *p) {
+    wheel_cancel(&p->ep->wheel, &p->rto);
+    wheel_cancel(&p->ep->wheel, &p->keepalive);
+    wheel_cancel(&p->ep->wheel, &p->delack);
+    wheel_cancel(&p->ep->wheel, &p->pace);
+    wheel_cancel(&p->ep->wheel, &p->pmtu_timer);
+    wheel_cancel(&p->ep->wheel, &p->linger);
+}
+
+/* Arms the retransmission timer for the front of the send buffer, or disarms it if empty.
+While the peer's window is closed, the same timer sends window probes. */
+static void p_arm_rto(params *p) {
+    if (sb_empty(p->send_q) && p->rwnd != 0)
+        wheel_cancel(&p->ep->wheel, &p->rto);
+    else
+        wheel_arm(&p->ep->wheel, &p->rto, p->before + rtt_timeout(&p->rtt));
+}
+
+/* Moves a detached connection to another endpoint, once its queued sends have been flushed,
+and arms its timers on the new wheel. */
+void p_move(params *p, endpoint *ep) {
+    p->ep = ep;
+    p->sockfd = ep->sockfd;
+    p->pkt_recv = &ep->pkt_recv;
+    p_arm_rto(p);
+    if (p->established)
+        wheel_arm(&ep->wheel, &p->keepalive, now_us() + KEEPALIVE_US);
+    if (p->unacked > 0)
+        wheel_arm(&ep->wheel, &p->delack, now_us() + DELACK_US);
+    if (p->pacer.rate != 0)
+        wheel_arm(&ep->wheel, &p->pace, now_us());
+    if (p->pmtu.probe != 0)  // the probe out gets a whole timeout again
+        wheel_arm(&ep->wheel, &p->pmtu_timer, now_us() + rtt_timeout(&p->rtt));
+    else if (p->established && p->pmtu.size < p->pmtu.limit)
+        wheel_arm(&ep->wheel, &p->pmtu_timer, now_us() + PMTU_RAISE_US);
+    if (p_done(p) && !p->lingered)
+        wheel_arm(&ep->wheel, &p->linger, now_us() + rtt_timeout(&p->rtt));
+}
+
+/* Every packet sent acks all the data received in order, so no delayed ack is due anymore. */
+static void p_acked(params *p) {
+    p->unacked = 0;
+    wheel_cancel(&p->ep->wheel, &p->delack);
+}
+
+/* Returns how many packets the receive window can allow now: as many as the receive buffer holds
+from recv_seq on, as long as the output buffer can take them once they are delivered in order,
+if they are as large as the peer may send. Rounded down to the scale it is advertised in. */
+static uint32_t p_receive_room(params *p) {
+    uint32_t room = p_out_space(p) / p->pmtu.limit;
+    if (room > p->opt->window)
+        room = p->opt->window;
+    if ((room >> p->scale) > UINT8_MAX)
+        room = UINT8_MAX << p->scale;
+    return room >> p->scale << p->scale;
+}
+
+/* Returns the receive window for the window byte of a packet, and remembers it. */
+static uint8_t p_advertise(params *p) {
+    p->advertised = p_receive_room(p);
+    return p->advertised >> p->scale;
+}
+
+/* Sends a packet to the peer.
+If negotiated, the out of order packets held in the receive buffer are reported as sack blocks.
+With batching, the packet is queued and goes out with the rest of the batch before the next wait. */
+void p_send(params *p, packet *pkt, trace_event op) {
+    if (p->sack && !(pkt->flags & PKT_SYN)) {
+        sack_block blocks[SACK_MAX_BLOCKS];
+        sack_encode(pkt, blocks, sack_build(p->recv_q, p->recv_seq, blocks));
+    }
+    if (p->flow && !(pkt->flags & PKT_SYN)) {
+        pkt->flags |= PKT_WINDOW;
+        pkt->window = p_advertise(p);
+    }
+    if (p->seq64)
+        pkt->flags |= PKT_SEQ64;
+    p->stats.pkts_sent++;
+    p_acked(p);
+    if (p->opt->batch > 1)
+        batch_send(&p->ep->tx, p->sockfd, &p->addr, pkt, p->compact, op);
+    else
+        send_packet(p->sockfd, &p->addr, pkt, p->compact, op);
+}
+
+/* Sends a packet that carries no data and isn't an ack of data in order, like a parity packet
+or a path mtu probe. It has no sack blocks or window, and leaves the delayed ack alone. */
+static void p_send_bare(params *p, packet *pkt) {
+    if (p->seq64)
+        pkt->flags |= PKT_SEQ64;
+    p->stats.pkts_sent++;
+    if (p->opt->batch > 1)
+        batch_send(&p->ep->tx, p->sockfd, &p->addr, pkt, p->compact, TR_SEND);
+    else
+        send_packet(p->sockfd, &p->addr, pkt, p->compact, TR_SEND);
+}
+
+/* Sends the parity packet of the new data packets sent since the last one.
+It neither acks nor is acked, and leaves the windows and the pacer alone. */
+static void p_send_parity(params *p) {
+    p->stats.fec_sent++;
+    p_send_bare(p, fec_parity(&p->fec_tx));
+}
+
+/* Sends a probe of the next size the path mtu search wants, padded with zeros, and arms the timer
+that counts it as lost if its ack doesn't come back in time. Once the search is done, the timer
+starts it over later, unless it reached the limit. */
+static void p_probe_path(params *p) {
+    uint32_t size = pmtu_next(&p->pmtu);
+    if (size == 0) {
+        if (p->pmtu.size < p->pmtu.limit)
+            wheel_arm(&p->ep->wheel, &p->pmtu_timer, now_us() + PMTU_RAISE_US);
+        return;
+    }
+    packet *probe = &p->pkt_send;
+    probe->seq = p->send_seq;
+    probe->ack = p->recv_seq;
+    probe->flags = PKT_MSS;
+    probe->window = 0;
+    probe->length = size;
+    memset(probe->payload, 0, size - MSS_OPTION_SIZE);
+    wire_put_mss(probe->payload + size - MSS_OPTION_SIZE, size);
+    p->stats.pmtu_probes++;
+    p_send_bare(p, probe);
+    wheel_arm(&p->ep->wheel, &p->pmtu_timer, now_us() + rtt_timeout(&p->rtt));
+}
+
+/* Handles a path mtu probe from the peer, or the ack of one of ours. A probe is acked at once
+with its size, whatever else is going on. An acked probe raises the segment size,
+then the search goes on with the next one. */
+static void p_handle_path_probe(params *p) {
+    uint32_t size = wire_mss(p->pkt_recv);
+    if (!(p->pkt_recv->flags & PKT_ACK)) {
+        packet *ack = &p->pkt_send;
+        ack->seq = p->send_seq;
+        ack->ack = p->recv_seq;
+        ack->flags = PKT_ACK | PKT_MSS;
+        ack->window = 0;
+        ack->length = wire_put_mss(ack->payload, size);
+        p_send_bare(p, ack);
+    } else if (pmtu_acked(&p->pmtu, size)) {
+        p->pacer.segment = HEADER_SIZE + p->pmtu.size;
+        p->stats.segment = p->pmtu.size;
+        wheel_cancel(&p->ep->wheel, &p->pmtu_timer);
+        p_probe_path(p);
+    }
+}
+
+/* Records the front and size of the send buffer in the trace. */
+static void p_trace_send_q(params *p) {
+    sb_entry *front = sb_front(p->send_q);
+    trace_buffer(TR_SBUF, front != NULL ? front->seq : p->send_seq, sb_size(p->send_q));
+}
+
+/* Sends a packet from the send buffer. The kernel gathers its payload from the buffer.
+Sack blocks are attached like in p_send.
+Always goes through the send batch, which holds one packet and is flushed right away without batching.
+A paced packet carries its departure time in ns, others 0. */
+static void p_send_entry(params *p, const sb_entry *e, trace_event op, uint64_t txtime) {
+    segment seg;
+    // a client's syn carries its fast open cookie in the ack field, it has nothing to ack yet
+    seg.ack = e->flags & PKT_SYN && !(e->flags & PKT_ACK) ? p->cookie : p->recv_seq;
+    seg.seq = e->seq;
+    seg.length = e->length;
+    seg.flags = e->flags;
+    seg.pieces = sb_payload(p->send_q, e, seg.payload);
+    seg.trailer_len = 0;
+    seg.txtime = txtime;
+    if (p->sack && !(e->flags & PKT_SYN)) {
+        sack_block blocks[SACK_MAX_BLOCKS];
+        int n = sack_build(p->recv_q, p->recv_seq, blocks);
+        seg.trailer_len = sack_trailer(seg.trailer, blocks, n, (int) p->pmtu.size - e->length);
+        seg.flags = seg.trailer_len > 0 ? e->flags | PKT_SACK : e->flags & ~PKT_SACK;
+    }
+    if (e->flags & PKT_SYN && e->flags & PKT_ACK && p->cookie != 0)  // the cookie the syn asked for
+        seg.trailer_len = wire_put_cookie(seg.trailer, p->cookie);
+    if (e->flags & PKT_MSS)  // a syn offering larger segments carries the largest it takes
+        seg.trailer_len += wire_put_mss(seg.trailer + seg.trailer_len, p->opt->mss);
+    // a syn offering flow control carries the scale of the windows that will follow
+    seg.window = e->flags & PKT_SYN && e->flags & PKT_WINDOW ? p->scale : 0;
+    if (p->flow && !(e->flags & PKT_SYN)) {
+        seg.flags |= PKT_WINDOW;
+        seg.window = p_advertise(p);
+    }
+    if (p->seq64)
+        seg.flags |= PKT_SEQ64;
+    p->stats.pkts_sent++;
+    p_acked(p);
+    batch_send_segment(&p->ep->tx, p->sockfd, &p->addr, &seg, op);
+}
+
+/* Extends the seq and ack of the received packet to 64 bits, around the next seq expected and
+the next seq to send, unless the peer sent them whole. A syn's seq is the peer's first seq, as is,
+and a parity packet's ack field is the span of its group, not an ack.
+Then checks that the packet fits where the connection is, like PAWS: it can't ack data that was
+never sent, and whole seq numbers must be those the 32 bit ones extend to, or the packet is
+a stale duplicate from another lap of them, which 32 bit seq numbers can't tell apart.
+Returns false, counting the packet as stale, if it has to be dropped. */
+bool p_unwrap(params *p) {
+    packet *pkt = p->pkt_recv;
+    uint64_t seq = pkt->flags & PKT_SYN ? pkt->seq : seq_unwrap(p->recv_seq, pkt->seq);
+    uint64_t ack = pkt->flags & PKT_FEC ? pkt->ack : seq_unwrap(p->send_seq, pkt->ack);
+    bool stale;
+    if (pkt->flags & PKT_SEQ64 && !(pkt->flags & PKT_SYN)) {
+        stale = (pkt->length > 0 && pkt->seq != seq) || (pkt->flags & PKT_ACK && pkt->ack != ack);
+    } else {
+        pkt->seq = seq;
+        pkt->ack = ack;
+        stale = false;
+    }
+    if (pkt->flags & PKT_ACK && pkt->ack > p->send_seq)
+        stale = true;
+    p->stats.stale_drops += stale;
+    return !stale;
+}
+
+/* Receives the next packet into pkt_recv, for a connection that has the endpoint to itself.
+Stale packets are dropped. Returns false if no packet is waiting. */
+bool p_recv(params *p) {
+    while (ep_recv(p->ep)) {
+        p->stats.pkts_recv++;
+        if (p_unwrap(p))
+            return true;
+    }
+    return false;
+}
+
+/* Resends a packet from the send buffer.
+Counts the transmission so that its ack isn't used as an RTT sample. */
+static void p_retransmit(params *p, sb_entry *send, trace_event op) {
+    if (p->fec && send->tx_count == 1)
+        fec_lost(&p->fec_tx);
+    send->sent_at = now_us();
+    send->tx_count++;
+    p_send_entry(p, send, op, 0);
+}
+
+/* Resends the packet with the lowest seq number in the send buffer, if any. */
+void p_retransmit_front(params *p, trace_event op) {
+    sb_entry* send = sb_front(p->send_q);
+    if (send != NULL)
+        p_retransmit(p, send, op);
+}
+
+/* Called on the received syn or syn ack.
+Selective acks, compact acks, 64 bit seq numbers and parity packets are each used if both sides
+offered them. Flow control is always offered, so it is used if the peer offered it too.
+Segments may grow up to the smaller of the largest ones both sides offered. */
+void p_negotiate(params *p) {
+    p->sack = p->opt->sack && p->pkt_recv->flags & PKT_SACK;
+    p->compact = p->opt->compact && p->pkt_recv->flags & PKT_COMPACT;
+    p->seq64 = p->opt->seq64 && p->pkt_recv->flags & PKT_SEQ64;
+    p->fec = p->opt->fec && p->pkt_recv->flags & PKT_FEC;
+    if (p->fec && p->fec_rx.history == NULL && !fec_decoder_init(&p->fec_rx))
+        die("fec malloc failed");
+    uint32_t limit = p->pkt_recv->flags & PKT_MSS ? wire_mss(p->pkt_recv) : MSS;
+    if (limit > p->opt->mss)
+        limit = p->opt->mss;
+    pmtu_init(&p->pmtu, MSS, limit > MSS ? limit : MSS);
+    p->cc.sack = p->sack;
+    p->flow = p->pkt_recv->flags & PKT_WINDOW && p->pkt_recv->window < 24;
+    p->peer_scale = p->flow ? p->pkt_recv->window : 0;
+}
+
+/* Returns how many packets have to arrive past a missing one before it counts as lost.
+With fec, the receiver may still rebuild it once the rest of its group and the parity are in,
+so it waits for a group more, as long as half the congestion window covers that many. */
+static uint32_t p_dupthresh(params *p) {
+    if (!p->fec)
+        return SACK_DUPTHRESH;
+    uint32_t thresh = SACK_DUPTHRESH + p->fec_tx.k;
+    uint32_t limit = cc_window(&p->cc) / 2;
+    if (thresh > limit)
+        thresh = limit > SACK_DUPTHRESH ? limit : SACK_DUPTHRESH;
+    return thresh;
+}
+
+/* Returns true if the packet counts as lost on the sack scoreboard:
+enough packets above it were sacked, or it was sent before a timeout. */
+static bool p_sack_lost(params *p, sb_entry *e, uint32_t sacked_above) {
+    return sacked_above >= p_dupthresh(p) ||
+           (p->cc.phase == CC_LOSS && e->sent_at < p->recovery_start);
+}
+
+/* Returns the number of packets in the send buffer that are still in the network:
+neither sacked, nor lost without having been retransmitted in this recovery. */
+static uint32_t p_sack_pipe(params *p) {
+    uint32_t pipe = 0;
+    uint32_t sacked = p->sacked;
+    for (sb_entry *e = sb_front(p->send_q); e != NULL; e = sb_next(p->send_q, e)) {
+        if (e->sacked) {
+            sacked--;
+            continue;
+        }
+        bool repaired = e->tx_count > 1 && e->sent_at >= p->recovery_start;
+        if (!p_sack_lost(p, e, sacked) || repaired)
+            pipe++;
+    }
+    return pipe;
+}
+
+/* Recovers from losses using the sack scoreboard (RFC 6675).
+The first lost packet starts fast recovery, then every lost packet is retransmitted
+once per recovery, in order, for as long as the packets in the network fit the window.
+A whole burst of losses is repaired in one round trip instead of one per round trip. */
+static void p_sack_recover(params *p) {
+    uint32_t sacked_above = p->sacked;
+    sb_entry *e = sb_front(p->send_q);
+    for (; e != NULL && e->sacked; e = sb_next(p->send_q, e))
+        sacked_above--;
+    if (e != NULL && p->cc.phase == CC_OPEN && p_sack_lost(p, e, sacked_above)) {
+        cc_on_loss(&p->cc, sb_size(p->send_q) - p->sacked, p->send_seq, now_us());
+        p->recovery_start = now_us();
+    }
+
+    p->pipe = p_sack_pipe(p);
+    sacked_above = p->sacked;
+    for (e = sb_front(p->send_q); e != NULL && p->pipe < cc_window(&p->cc);
+            e = sb_next(p->send_q, e)) {
+        if (e->sacked) {
+            sacked_above--;
+            continue;
+        }
+        bool repaired = e->tx_count > 1 && e->sent_at >= p->recovery_start;
+        if (p_sack_lost(p, e, sacked_above) && !repaired) {
+            p_retransmit(p, e, TR_DUPS);
+            p->stats.rtx_sack++;
+            p->pipe++;
+        }
+    }
+}
+
+/* Sends the next packet past the peer's closed window, or the one sent before again.
+The peer drops it while it has no room, but acks it with its window, so a lost window update
+doesn't stall the connection. Probes back off like retransmissions, but a closed window isn't
+congestion, so the congestion window stays. */
+static void p_probe_window(params *p) {
+    if (sb_empty(p->send_q)) {
+        if (p->rwnd != 0)
+            return;
+        p->probing = true;
+        if (!p_send_payload_ack(p))
+            p->probing = false;  // nothing to send, wait with backed off wakeups
+    } else {
+        p_retransmit_front(p, TR_RTOS);
+    }
+    p->stats.window_probes += p->probing;
+    rtt_backoff(&p->rtt);
 }
 
-/* Checks for a 1 second timeout since timer was last reset,
-and sends first packet in the send buffer, if any. */
+/* Checks for a retransmission timeout since timer was last reset,
+and sends first packet in the send buffer, if any.
+The timeout is doubled on every expiry until a fresh RTT sample arrives.
+A fin that is all that is left, after the peer closed, is only sent FIN_RETRIES times, and without
+doubling the timeout: the peer may have left once it had our fin and lingered a few timeouts,
+and every ack of it got lost.
+Called when the rto timer fires, and arms it again while packets wait for an ack. */
 void p_retransmit_on_timeout(params *p) {
-    clock_t now = clock();
+    uint64_t now = now_us();
+    sb_entry *front = sb_front(p->send_q);
+    bool last_fin = front != NULL && front->flags & PKT_FIN && p->peer_closed;
     // Packet retransmission
-    if (now - p->before > CLOCKS_PER_SEC) {  // 1 second timer
+    if (now - p->before >= rtt_timeout(&p->rtt)) {
         p->before = now;
-        // send the packet with lowest seq number in sending buffer
-        packet* send = q_front(p->send_q);
-        // fprintf(stderr, "q size: %ld\n", q_size(send_q));
-        if (send != NULL) {
-            send->ack = p->recv_seq;
-            send_packet(p->sockfd, &p->addr, send, "RTOS");
+        if (last_fin && front->tx_count >= FIN_RETRIES) {
+            sb_pop_front(p->send_q);
+            p_start_linger(p);
+        } else if (sb_empty(p->send_q) || p->probing) {
+            p_probe_window(p);
+        } else {
+            cc_on_timeout(&p->cc, sb_size(p->send_q), p->send_seq, now);
+            p->recovery_start = now;
+            p_retransmit_front(p, TR_RTOS);
+            p->stats.rtx_timeout++;
+            if (!last_fin)
+                rtt_backoff(&p->rtt);
+            if (p->sack)  // the rest of the buffer is repaired as acks open the window
+                p_sack_recover(p);
         }
     }
+    p_arm_rto(p);
+}
+
+/* Restarts the retransmission timer, after new data was acked or sent into an empty buffer. */
+void p_restart_timer(params *p) {
+    p->before = now_us();
+    p_arm_rto(p);
+}
+
+static bool p_send_fin(params *p);
+
+/* Marks the handshake as done, and starts sending keepalives,
+and probing the path for larger segments if both sides take them.
+A connection with nothing to send, or whose in_fd ended during the handshake, sends its fin. */
+void p_established(params *p) {
+    p->established = true;
+    p->keepalive_sent = p->stats.pkts_sent;
+    wheel_arm(&p->ep->wheel, &p->keepalive, now_us() + KEEPALIVE_US);
+    if (p->pmtu.limit > MSS)
+        p_probe_path(p);
+    p_send_fin(p);
 }
 
-/* Sends the pkt_send packet and enqueues it.
+/* Enqueues a new packet at send_seq and sends it.
+The last length bytes read into the send buffer are its payload.
 Only use this function to send a new packet over the network which needs to be acked.
-Like a syn packet, a syn ack packet, or a packet with data in it.
-Do not call this function if the queue is full, as you will have already consumed and lost the data from stdin. */
-void p_send_and_enqueue_pkt_send(params *p) {
-    send_packet(p->sockfd, &p->addr, &p->pkt_send, "SEND");
-    q_push_back(p->send_q, &p->pkt_send);
-    q_print(p->send_q, "SBUF");
-    p->send_seq += p->pkt_send.length; 
+Like a syn packet, a syn ack packet, or a packet with data in it. */
+void p_send_and_enqueue(params *p, uint16_t length, uint8_t flags) {
+    bool idle = sb_empty(p->send_q);
+    sb_entry* sent = sb_push_back(p->send_q, p->send_seq, length, flags);
+    sent->sent_at = now_us();
+    sent->tx_count = 1;
+    p_send_entry(p, sent, TR_SEND, pace_sent(&p->pacer, HEADER_SIZE + length, sent->sent_at));
+    p_trace_send_q(p);
+    p->send_seq += length;
+    p->stats.bytes_sent += length;
+    p->pipe++;
+    if (idle)  // start the timer when sending into an empty buffer
+        p_restart_timer(p);
+    if (p->fec && length > 0 && !(flags & PKT_SYN)) {
+        struct iovec payload[2];
+        int pieces = sb_payload(p->send_q, sent, payload);
+        if (fec_add(&p->fec_tx, sent->seq, payload, pieces, length))
+            p_send_parity(p);
+    }
+}
+
+/* Returns true if the send buffer, the congestion window and the peer's receive window have room
+for another packet, where data read ahead already has its room in the send buffer. With sacks,
+packets that have left the network don't count against the congestion window, but the receive
+window counts from the front of the send buffer.
+A closed receive window lets a probe through once nothing else is outstanding. */
+static bool p_window_room(params *p) {
+    uint32_t in_flight = p->sack ? p->pipe : sb_size(p->send_q);
+    uint32_t queued = sb_size(p->send_q);
+    bool data_room = sb_staged(p->send_q) > 0 || sb_space(p->send_q) >= p->pmtu.size;
+    return !sb_full(p->send_q) && data_room && in_flight < cc_window(&p->cc) &&
+           (queued < p->rwnd || (p->probing && queued == 0));
+}
+
+/* Returns true if another packet may be sent now: the window has room, and with pacing,
+the pacer has let enough time pass since the last one. */
+bool p_window_open(params *p) {
+    return p_window_room(p) && (p->pacer.rate == 0 || pace_next(&p->pacer, now_us()) == 0);
+}
+
+/* Returns true once everything from in_fd was read and sent, or if there is no in_fd. */
+static bool p_input_done(params *p) {
+    return p->in_fd < 0 || (!p->ep->ev.stdin_open && sb_staged(p->send_q) == 0);
 }
 
-/* Checks if send queue is full.
-If not full and there is data in stdin, send a packet with the data and return true.
+/* Sends the fin once the handshake is done and all of in_fd was sent, if it wasn't sent yet.
+It has no data, but takes a seq like a syn, after the last byte, so its ack says that the peer
+got everything. Returns true if it was sent now. */
+static bool p_send_fin(params *p) {
+    if (!p->established || p->fin_sent || !p_input_done(p) || sb_full(p->send_q))
+        return false;
+    p_send_and_enqueue(p, 0, PKT_ACK | PKT_FIN);
+    p->send_seq++;
+    p->fin_sent = true;
+    return true;
+}
+
+/* Reads the payload of the next packet into the send buffer, up to max bytes of it.
+Without -l, in_fd is read a batch of packets at a time, and the packets after the first one
+take what was read ahead, without another read.
+Returns the bytes there are, which may be more than max, 0 at end of file,
+or -1 if in_fd has nothing yet. */
+int p_read_input(params *p, uint32_t max) {
+    int bytes;
+    if (p->io != NULL) {
+        struct iovec iov[2];
+        bytes = pl_read(p->io, iov, sb_room(p->send_q, max, iov));
+    } else if (sb_staged(p->send_q) == 0) {
+        bytes = sb_read(p->send_q, p->in_fd, p->opt->batch * p->pmtu.size);
+    } else {
+        bytes = sb_staged(p->send_q);
+    }
+    if (bytes == 0)
+        ev_close_stdin(&p->ep->ev);
+    return bytes;
+}
+
+/* Checks if the send window is open.
+If open and there is data in in_fd, read it into the send buffer, send it and return true.
+Once in_fd is done, sends the fin instead, the first time, and returns true then.
 Else do nothing and return false. */
 bool p_send_payload_ack(params *p) {
-    if (q_full(p->send_q))
+    if (p_input_done(p))
+        return p_send_fin(p);
+    // acked data can be reused once the queued sends are out
+    if (sb_staged(p->send_q) == 0 && sb_space(p->send_q) < p->pmtu.size) {
+        ep_flush(p->ep);
+        sb_release(p->send_q);
+    }
+    if (!p_window_open(p)) {
+        // only the pacer holds it back, send it once the pacer allows
+        if (p->pacer.rate != 0 && !timer_armed(&p->pace) && p_window_room(p))
+            wheel_arm(&p->ep->wheel, &p->pace, pace_next(&p->pacer, now_us()));
         return false;
-    int bytes = read_stdin_to_pkt(&p->pkt_send);
-    if (bytes <= 0)
+    }
+    // leave room for sack blocks if there is out of order data to report
+    bool reserve = p->sack && !rb_empty(p->recv_q);
+    uint32_t max = reserve ? p->pmtu.size - SACK_MAX_LEN : p->pmtu.size;
+    int bytes = p_read_input(p, max);
+    if (bytes <= 0 && p->fec && fec_pending(&p->fec_tx))
+        p_send_parity(p);  // in_fd ran dry, the group so far can't wait for more
+    if (bytes == 0)
+        return p_send_fin(p);
+    if (bytes < 0)
         return false;
-    p->pkt_send.ack = p->recv_seq;
-    p->pkt_send.seq = p->send_seq;
-    p->pkt_send.flags = PKT_ACK;
-    p_send_and_enqueue_pkt_send(p);
+    p_send_and_enqueue(p, (uint32_t) bytes < max ? (uint32_t) bytes : max, PKT_ACK);
     return true;
 }
 
+/* Returns true if the received packet advertises a receive window other than the one known. */
+static bool p_window_update(params *p) {
+    const packet *pkt = p->pkt_recv;
+    return p->flow && pkt->flags & PKT_WINDOW && !(pkt->flags & PKT_SYN) &&
+           (uint32_t) pkt->window << p->peer_scale != p->rwnd;
+}
+
 /* Check if the received ack is a duplicate.
-If 3 in a row, retransmit the first packet in the send buffer. */
+Only acks without data count, since the peer repeats its ack on every data packet it sends,
+and only if they don't update the window, since a receiver that makes room sends those.
+If 3 in a row, or more with fec (see p_dupthresh), signal a loss to congestion control and
+retransmit the first packet in the send buffer.
+If another window's worth of duplicates arrives, the retransmission was lost too, so send it again. */
 void p_retransmit_on_duplicate_ack(params *p) {
-    // retransmit if 3 same acks in a row
-    if (p->pkt_recv.ack == p->recv_ack) {
+    uint32_t thresh = p_dupthresh(p);
+    if (p->pkt_recv->ack != p->recv_ack) {
+        p->ack_count = 1;
+        p->recv_ack = p->pkt_recv->ack;
+    } else if (p->pkt_recv->length == 0 && !(p->pkt_recv->flags & PKT_FIN) && !sb_empty(p->send_q) &&
+               !p_window_update(p)) {  // a fin repeats its ack too
+        // retransmit if thresh same acks in a row
         p->ack_count++;
-        if (p->ack_count == 3) {
-            p->ack_count = 0;
-            packet* send = q_front(p->send_q);
-            if (send != NULL) {
-                send->ack = p->recv_seq;
-                send_packet(p->sockfd, &p->addr, send, "DUPS");
-            }
+        if (p->ack_count == thresh) {
+            cc_on_loss(&p->cc, sb_size(p->send_q), p->send_seq, now_us());
+            p_retransmit_front(p, TR_DUPS);
+            p->stats.rtx_dupack++;
+        } else if (p->ack_count > thresh + sb_size(p->send_q)) {
+            p->ack_count = thresh;
+            p_retransmit_front(p, TR_DUPS);
+            p->stats.rtx_dupack++;
+        } else if (p->ack_count > thresh) {
+            cc_on_dup_ack(&p->cc);
         }
-    } else {
-        p->ack_count = 1;
-        p->recv_ack = p->pkt_recv.ack;
     }
 }
 
+/* Takes the peer's fin once everything before it was received, which acks it.
+Returns true if it was taken now. */
+static bool p_take_fin(params *p) {
+    if (p->peer_closed || p->peer_fin == 0 || p->recv_seq != p->peer_fin)
+        return false;
+    p->recv_seq++;
+    p->peer_closed = true;
+    return true;
+}
+
 /* Handles the incoming data packet.
-If the packet is expected, write to stdout, check the received queue for the next expected packets and does the same.
+If the packet is expected, queue it for out_fd, check the received queue for the next expected packets and does the same.
+Output is written once per wakeup, in p_sync.
 Else if packet has not been acked, try to buffer it (do nothing if buffer is full).
-If the packet has already been acked, do nothing. */
-void p_handle_data_packet(params *p) {
-    if (p->pkt_recv.seq == p->recv_seq) {  // write contents of packet if expected
-        write_pkt_to_stdout(&p->pkt_recv);
-        p->recv_seq += p->pkt_recv.length;  // next packet
+If the packet has already been acked, do nothing.
+Returns true if its ack may be delayed: it arrived in order, and didn't fill a hole. */
+bool p_handle_data_packet(params *p) {
+    if (p->pkt_recv->seq == p->recv_seq && p->flow && p_out_space(p) < p->pkt_recv->length) {
+        // a window probe while out_fd is behind, waiting for it would stall every connection
+        p->stats.full_drops++;
+        return false;
+    }
+    if (p->pkt_recv->seq == p->recv_seq) {  // write contents of packet if expected
+        struct iovec payload = {p->pkt_recv->payload, p->pkt_recv->length};
+        p_deliver(p, &payload, 1);
+        p->recv_seq += p->pkt_recv->length;  // next packet
+        uint32_t delivered = p->pkt_recv->length;
 
-        // loop through sorted packet buffer and pop off next packets
+        // pop off the buffered packets that follow on, each one is a single lookup
         bool removed = false;
-        for (packet *pkt = q_front(p->recv_q);
-                pkt != NULL && pkt->seq == p->recv_seq;
-                pkt = q_pop_front_get_next(p->recv_q)) {
+        for (rb_entry *e = rb_pop(p->recv_q, p->recv_seq);
+                e != NULL;
+                e = rb_pop(p->recv_q, p->recv_seq)) {
             removed = true;
-            write_pkt_to_stdout(pkt);
-            p->recv_seq += pkt->length;
+            struct iovec payload[2];
+            p_deliver(p, payload, rb_payload(p->recv_q, e, payload));
+            p->recv_seq += e->length;
+            delivered += e->length;
         }
+        stats_delivered(&p->stats, delivered, now_us());
         if (removed)
-            q_print(p->recv_q, "RBUF");
-    } else if (p->pkt_recv.seq > p->recv_seq) {  // future packet, try to buffer
-        q_try_insert_keep_sorted(p->recv_q, &p->pkt_recv);
-        q_print(p->recv_q, "RBUF");
+            trace_buffer(TR_RBUF, p->recv_seq, rb_size(p->recv_q));
+        if (p_take_fin(p))  // the fin waited for this data, its ack can't wait
+            return false;
+        return !removed && rb_empty(p->recv_q);
+    } else if (p->pkt_recv->seq > p->recv_seq) {  // future packet, try to buffer
+        rb_result result = rb_insert(p->recv_q, p->recv_seq, p->pkt_recv);
+        p->stats.dup_drops += result == RB_DUPLICATE;
+        p->stats.full_drops += result == RB_NO_ROOM;
+        trace_buffer(TR_RBUF, p->recv_seq, rb_size(p->recv_q));
+    } else {
+        p->stats.dup_drops++;
     }
+    return false;
 }
 
 /* Pops off all packets from send buffer that have a lower seq number than the incoming ack.
+The newest popped packet gives an RTT sample if it was only sent once (Karn's rule),
+and was sent after every retransmitted packet that the ack covers.
+Packets that waited behind a hole at the receiver are acked late, so they can't be timed.
+During loss recovery, an ack that doesn't cover everything sent before the loss
+means the next packet was lost too, so it is retransmitted right away (NewReno).
 Returns true if any packets were popped. */
 bool p_clear_acked_packets_from_sbuf(params *p) {
     bool flag = false;
-    packet *pkt = q_front(p->send_q);
-    while (pkt != NULL && pkt->seq < p->pkt_recv.ack) {
+    uint32_t acked = 0;
+    uint64_t retransmitted_at = 0;
+    uint64_t newest_sent_at = 0;
+    uint32_t newest_tx_count = 0;
+    sb_entry *e = sb_front(p->send_q);
+    if (p_window_update(p) && p->pkt_recv->ack >= (e != NULL ? e->seq : p->send_seq))
+        p->rwnd = (uint32_t) p->pkt_recv->window << p->peer_scale;  // older acks have older windows
+    while (e != NULL && e->seq < p->pkt_recv->ack) {
         flag = true;
-        pkt = q_pop_front_get_next(p->send_q);
+        acked++;
+        if (e->tx_count > 1 && e->sent_at > retransmitted_at)
+            retransmitted_at = e->sent_at;
+        newest_sent_at = e->sent_at;
+        newest_tx_count = e->tx_count;
+        if (p->fec && !e->sacked && e->tx_count == 1 && p->sacked > 0)
+            fec_lost(&p->fec_tx);  // it was a hole below sacked data, that parity filled in
+        p->sacked -= e->sacked;
+        sb_pop_front(p->send_q);
+        e = sb_front(p->send_q);
+    }
+    if (flag && newest_tx_count == 1 && newest_sent_at > retransmitted_at) {
+        rtt_sample(&p->rtt, now_us() - newest_sent_at);
+        hist_add(&p->stats.rtt, now_us() - newest_sent_at);
+    }
+    if (flag) {
+        rtt_reset_backoff(&p->rtt);
+        bool partial = cc_on_ack(&p->cc, acked, p->pkt_recv->ack, now_us(), &p->rtt);
+        hist_add(&p->stats.cwnd, cc_window(&p->cc));
+        pace_update(&p->pacer, &p->cc, &p->rtt);
+        if (partial && !p->sack) {  // the sack scoreboard finds the holes instead
+            p_retransmit_front(p, TR_DUPS);
+            p->stats.rtx_dupack++;
+            p->ack_count = p_dupthresh(p);  // duplicates of this ack must not retransmit it again
+        }
+    }
+    if (p->probing && (flag || p->rwnd > 0)) {
+        p->probing = false;
+        if (!flag)  // the window opened before the probe got in, send it again right away
+            p_retransmit_front(p, TR_RTOS);
     }
     if (flag)
-        q_print(p->send_q, "SBUF");
+        p_trace_send_q(p);
     return flag;
 }
 
@@ -139,45 +892,237 @@ void p_send_empty_ack(params *p) {
     p->pkt_send.ack = p->recv_seq;
     p->pkt_send.seq = 0;
     p->pkt_send.length = 0;
-    send_packet(p->sockfd, &p->addr, &p->pkt_send, "SEND");
+    p_send(p, &p->pkt_send, TR_SEND);
+}
+
+/* Acks data received, unless delay allows it to wait. Then only every opt->ack_every packets
+are acked, or the last ones once DELACK_US has passed without another ack.
+The sender's duplicate acks and sacks need an ack for each packet out of order, so those
+are never delayed. */
+void p_ack_data(params *p, bool delay) {
+    if (delay && ++p->unacked < p->opt->ack_every) {
+        if (!timer_armed(&p->delack))
+            wheel_arm(&p->ep->wheel, &p->delack, now_us() + DELACK_US);
+        return;
+    }
+    p_send_empty_ack(p);
+}
+
+/* Called once the queued sends are out. Then nothing points at the payloads of acked
+packets anymore, and their space is reused. Delivered data is written to out_fd in one go,
+or with -l handed to the writer thread, along with the room of the input taken.
+If that made room for a quarter of the receive buffer beyond what was last advertised,
+a window update is queued, since the peer may be waiting for it.
+Returns false if out_fd couldn't take it all. */
+bool p_sync(params *p) {
+    sb_release(p->send_q);
+    bool flushed = true;
+    if (p->io != NULL)
+        pl_flush(p->io);
+    else
+        flushed = ob_flush(p->out, p->out_fd);
+    uint32_t step = p->opt->window / 4 > 0 ? p->opt->window / 4 : 1;
+    if (p->flow && p->advertised < p->opt->window && p_receive_room(p) >= p->advertised + step)
+        p_send_empty_ack(p);
+    return flushed;
+}
+
+/* Watches stdin if asked for and the send window is open, and stdout if it couldn't take
+all the output. Data read ahead from stdin is ready already. With -l, the I/O threads are asked
+to wake the event loop instead: the reader once it has input, and the writer once it makes room
+while a window update is held back.
+Returns EV_STDIN or EV_STDOUT if that is the case already, then there is nothing to wait for. */
+int p_watch_io(params *p, bool want_stdin, bool flushed) {
+    event_loop *ev = &p->ep->ev;
+    want_stdin = want_stdin && p_window_open(p);
+    if (p->io == NULL) {
+        ev_watch_stdout(ev, !flushed);
+        ev_watch_stdin(ev, want_stdin);
+        return want_stdin && sb_staged(p->send_q) > 0 ? EV_STDIN : 0;
+    }
+    if (want_stdin && ev->stdin_open && pl_want_input(p->io))
+        return EV_STDIN;
+    if (p->flow && p->advertised < p->opt->window && pl_want_space(p->io))
+        return EV_STDOUT;
+    return 0;
+}
+
+/* Blocks until the socket, stdin or a timer needs attention,
+for a connection that has the endpoint to itself.
+Stdin is only watched if asked for and the send window is open.
+Queued packets are sent first, so everything sent while handling one wakeup goes out together,
+then p_sync catches up, and stdout is watched if it couldn't take all the output.
+Packets left over from the last receive batch are handled before sleeping,
+since epoll can't see them anymore.
+Timers that expired are fired before returning.
+Returns the mask of ready events from ev_wait, where a wake from the I/O threads of -l
+counts as stdin. */
+int p_wait(params *p, bool want_stdin) {
+    endpoint *ep = p->ep;
+    uint64_t now = now_us();
+    int due = stats_poll(&ep->emitter, now);
+    if (due)
+        stats_write(&ep->emitter, &p->stats, due, now, NULL, -1);
+    ep_flush(ep);
+    bool flushed = p_sync(p);
+    ep_flush(ep);  // window updates
+    if (ep_pending(ep))
+        return EV_SOCKET;
+    int ready = p_watch_io(p, want_stdin, flushed);
+    if (ready)
+        return ready;
+    uint64_t deadline = wheel_next(&ep->wheel);
+    uint64_t emit = stats_deadline(&ep->emitter);  // the timer also wakes the stats emitter
+    if (emit != 0 && (deadline == 0 || emit < deadline))
+        deadline = emit;
+    ev_set_deadline(&ep->ev, deadline);
+    int events = ev_wait(&ep->ev);
+    if (events & EV_TIMER)
+        wheel_advance(&ep->wheel, now_us());
+    if (events & EV_WAKE)
+        events = (events & ~EV_WAKE) | EV_STDIN;
+    return events;
+}
+
+/* Handles a received parity packet. If it rebuilds the one packet missing from its group,
+the rebuilt packet is handled like a data packet that arrived, and acked right away. */
+static void p_handle_parity(params *p) {
+    if (!p->fec || !fec_rebuild(&p->fec_rx, p->pkt_recv, p->recv_q, p->recv_seq))
+        return;
+    p->stats.fec_rebuilt++;
+    p_handle_data_packet(p);
+    if (!p_send_payload_ack(p))
+        p_ack_data(p, false);
+}
+
+/* Handles the peer's fin. It is taken once the data before it is in, and acked either way,
+by our own fin if this side is done sending too. A fin that came before some of the data
+gets a duplicate ack, like any packet out of order. */
+static void p_handle_fin(params *p) {
+    if (p->peer_fin == 0 && p->pkt_recv->seq >= p->recv_seq)
+        p->peer_fin = p->pkt_recv->seq;
+    p_take_fin(p);
+    if (!p_send_fin(p))
+        p_send_empty_ack(p);
+}
+
+/* Handles a packet received during data transmission. */
+static void p_handle(params *p) {
+    if ((p->pkt_recv->flags & (PKT_SYN | PKT_ACK)) == PKT_SYN)  // the peer's syn again, its ack field is a cookie
+        return;
+    if (p->pkt_recv->flags & PKT_FEC) {  // acks nothing, only data can be rebuilt from it
+        p_handle_parity(p);
+        return;
+    }
+    if (p->pkt_recv->flags & PKT_MSS && !(p->pkt_recv->flags & PKT_SYN)) {  // no data, and not a data ack
+        p_handle_path_probe(p);
+        return;
+    }
+    if (!p->sack)
+        p_retransmit_on_duplicate_ack(p);
+
+    hist_add(&p->stats.send_q, sb_size(p->send_q));
+    hist_add(&p->stats.recv_q, rb_size(p->recv_q));
+    if (p_clear_acked_packets_from_sbuf(p))  // reset the timer if new ack received
+        p_restart_timer(p);
+    else if (p->pkt_recv->length == 0 && !sb_empty(p->send_q))  // acked nothing new
+        p->stats.dup_acks++;
+
+    if (p->sack) {
+        sack_block blocks[SACK_MAX_BLOCKS];
+        int n = sack_decode(p->pkt_recv, blocks);
+        p->sacked += sack_mark(p->send_q, blocks, n);
+        p_sack_recover(p);
+    }
+
+    // a syn ack received at this point means the syn ack ack was lost, only the client gets one.
+    // The server takes the first ack at the seq after the syn for it, so the same one goes again:
+    // the first segment of data, still queued at that seq, or else the empty ack that took the seq
+    if (p->pkt_recv->flags & PKT_SYN) {
+        sb_entry *front = sb_front(p->send_q);
+        if (front != NULL && front->seq == p->pkt_recv->ack) {
+            p_retransmit(p, front, TR_SEND);
+            return;
+        }
+        p->pkt_send.seq = p->pkt_recv->ack;
+        p->pkt_send.ack = p->recv_seq;
+        p->pkt_send.flags = PKT_ACK;
+        p->pkt_send.length = 0;
+        p_send(p, &p->pkt_send, TR_SEND);
+        return;
+    }
+
+    if (p->pkt_recv->flags & PKT_FIN) {
+        p_handle_fin(p);
+        return;
+    }
+
+    if (p->pkt_recv->length == 0)  // no further handling for empty ack packets
+        return;
+
+    bool delay = p_handle_data_packet(p);
+
+    // If the send queue isn't full yet and we have data to send, read data into payload
+    // Or if we're responding to a syn packet
+    if (!p_send_payload_ack(p))
+        p_ack_data(p, delay);
+}
+
+/* Handles a packet received during data transmission, and lingers if it closed the connection.
+While lingering, a retransmission of data or of the fin starts the linger over, and other packets
+don't, or the acks both sides send again while lingering would keep each other going. */
+void p_handle_packet(params *p) {
+    bool lingering = timer_armed(&p->linger);
+    bool resent = p->pkt_recv->length > 0 || p->pkt_recv->flags & PKT_FIN;
+    p_handle(p);
+    if (!lingering || resent)
+        p_start_linger(p);
+}
+
+/* Called when the linger timer fires. Acks the peer again, in case our last ack was lost and
+its retransmissions too, and lingers another timeout, LINGER_ACKS times since it was last heard.
+Returns false once that ran out, and the connection closed. */
+bool p_linger(params *p) {
+    if (p->linger_acks == LINGER_ACKS) {
+        p->lingered = true;
+        return false;
+    }
+    p->linger_acks++;
+    p_send_empty_ack(p);
+    wheel_arm(&p->ep->wheel, &p->linger, now_us() + rtt_timeout(&p->rtt));
+    return true;
+}
+
+/* Returns true once the connection is done both ways and lingered. */
+bool p_closed(params *p) {
+    return p->lingered;
+}
+
+/* Called once the connection closed. Sends what is still queued, waits for out_fd to take
+all the output, and writes the last stats line of the connection if there is a target for them. */
+void p_finish(params *p, const char *peer, int worker) {
+    ep_flush(p->ep);
+    if (p->io != NULL)
+        pl_finish(p->io);
+    else
+        ob_drain(p->out, p->out_fd);
+    if (p->ep->emitter.fd >= 0)
+        stats_write(&p->ep->emitter, &p->stats, STATS_EMIT, now_us(), peer, worker);
 }
 
 /* Called in the main loop of client and server.
-Handles the data transmission between the sender and receiver. */
+Handles the data transmission between the sender and receiver, until the connection closed.
+Sleeps in the event loop until a packet arrives, stdin has data or the timer expires. */
 void p_listen(params *p) {
-    for (;;) {
-        p_retransmit_on_timeout(p);
-        if (recv_packet(p->sockfd, &p->addr, &p->pkt_recv) <= 0) {
-            p_send_payload_ack(p);
-        } else {  // packet received
-            p_retransmit_on_duplicate_ack(p);
-
-            if (p_clear_acked_packets_from_sbuf(p))  // reset the timer if new ack received
-                p->before = clock();
-
-            // if syn ack received at this point, the syn ack ack must have been dropped.
-            // the only case in which this could happen is if the syn ack was empty, since it wouldn't have been enqueued
-            // we need to ack this syn ack to complete the handshake.
-            // however, we cannot send data in this ack no matter what, since the original ack didn't have data. otherwise we corrupt our send_seq.
-            // technically, only the client needs to handle this, since the server does not send syn ack acks.
-            if (p->pkt_recv.flags & PKT_SYN) {
-                p->pkt_send.seq = p->pkt_recv.ack;
-                p->pkt_send.ack = p->recv_seq;
-                p->pkt_send.flags = PKT_ACK;
-                p->pkt_send.length = 0;
-                send_packet(p->sockfd, &p->addr, &p->pkt_send, "SEND");
-                continue;
-            }
-            
-            if (p->pkt_recv.length == 0)  // no further handling for empty ack packets
+    while (!p_closed(p)) {
+        int events = p_wait(p, true);
+        if (events & EV_SOCKET) {
+            while (p_recv(p))
+                p_handle_packet(p);
+        }
+        if (events & EV_STDIN) {
+            while (p_send_payload_ack(p))
                 continue;
-
-            p_handle_data_packet(p);
-
-            // If the send queue isn't full yet and we have data to send, read data into payload
-            // Or if we're responding to a syn packet
-            if (!p_send_payload_ack(p))
-                p_send_empty_ack(p);
         }
     }
 }
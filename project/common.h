@@ -1,37 +1,135 @@
 #ifndef PROJECT_COMMON_H_
 #define PROJECT_COMMON_H_
 
-#include <time.h>
 #include "utils.h"
-#include "deque.h"
+#include "sbuf.h"
+#include "rbuf.h"
+#include "obuf.h"
+#include "event.h"
+#include "rtt.h"
+#include "cc.h"
+#include "options.h"
+#include "sack.h"
+#include "batch.h"
+#include "stats.h"
+#include "wheel.h"
+#include "pace.h"
+#include "pipeline.h"
+#include "fec.h"
+#include "pmtu.h"
+#include "cookie.h"
 
-typedef struct socketparams {
+#define KEEPALIVE_US 10000000   // an established connection that sent nothing this long sends an ack
+#define DELACK_US 5000          // longest wait for more data in order before acking it
+#define FIN_RETRIES 8           // transmissions of a fin before giving up on its ack, once the peer closed
+#define LINGER_ACKS 3           // times a closed connection acks again, a timeout apart, before it is done
+
+/* The socket and what moves datagrams through it, shared by every connection on it.
+The client has one connection, the server one per peer. */
+typedef struct endpoint {
     int sockfd;
-    uint32_t recv_seq;
-    uint32_t send_seq;
-    uint32_t recv_ack;
+    event_loop ev;
+    const options *opt;
+    batch rx;                   // received datagrams not yet handled
+    batch tx;                   // packets to send before the next wait
+    packet pkt_recv;            // the packet being handled
+    struct sockaddr_in from;    // and who sent it
+    stats_emitter emitter;
+    timer_wheel wheel;          // the timers of every connection
+    uring *ring;                // with -u, drives the socket instead of recvmmsg and sendmmsg, NULL without
+} endpoint;
+
+/* The state of one connection. */
+typedef struct socketparams {
+    endpoint *ep;
+    int sockfd;                 // the endpoint's socket
+    int in_fd;                  // data to send is read from here, -1 if there is none
+    int out_fd;                 // data received is written here
+    uint64_t recv_seq;          // next seq expected in order
+    uint64_t send_seq;          // next seq to send
+    uint64_t recv_ack;
     uint32_t ack_count;
-    q_handle_t send_q;
-    q_handle_t recv_q;
-    packet pkt_recv;
+    sb_handle_t send_q;
+    rb_handle_t recv_q;
+    ob_handle_t out;            // data delivered in order, waiting to be written to out_fd, NULL with io
+    pipeline *io;               // with -l, the threads reading in_fd and writing out_fd, NULL without
+    packet *pkt_recv;           // the endpoint's packet being handled
     packet pkt_send;
-    clock_t before;
-    struct sockaddr_in addr;
+    uint64_t before;            // when the retransmission timer was last restarted
+    timer rto;                  // armed while the send buffer has packets waiting for an ack
+    timer keepalive;            // armed once established
+    uint64_t keepalive_sent;    // pkts_sent when the keepalive last fired
+    bool established;
+    bool fin_sent;              // everything from in_fd was sent, and the fin after it
+    uint64_t peer_fin;          // seq of the peer's fin, 0 until it arrives
+    bool peer_closed;           // the peer's fin was received in order, nothing more is coming
+    timer linger;               // armed once closed both ways, while the peer may miss our last ack
+    uint32_t linger_acks;       // acks sent again since the peer was last heard
+    bool lingered;              // and the linger ran out, the connection is done
+    uint32_t cookie;            // fast open, client: sent in the syn, server: issued in the syn ack, 0 without
+    timer delack;               // armed while data received in order waits for its ack
+    uint32_t unacked;           // data packets received in order since the last ack sent
+    pacer pacer;
+    timer pace;                 // armed while the pacer holds back data the window would allow
+    rtt_estimator rtt;
+    cc_state cc;
+    struct sockaddr_in addr;    // the peer
+    const options *opt;
+    bool sack;                  // selective acks were negotiated in the handshake
+    bool compact;               // compact acks were negotiated in the handshake
+    bool seq64;                 // 64 bit seq numbers go on the wire, negotiated in the handshake
+    bool fec;                   // parity packets are sent and used, negotiated in the handshake
+    fec_encoder fec_tx;         // the group of new data packets being sent
+    fec_decoder fec_rx;         // payloads delivered lately, with fec
+    pmtu pmtu;                  // segment size of new data, and the search for a larger one
+    timer pmtu_timer;           // armed while a probe waits for its ack, or until the search runs again
+    bool flow;                  // both sides advertise their receive window, negotiated in the handshake
+    uint8_t scale;              // our window is advertised in units of 2^scale packets
+    uint8_t peer_scale;
+    uint32_t rwnd;              // packets the peer can take from the front of the send buffer on
+    uint32_t advertised;        // packets our last advertised window allowed
+    bool probing;               // the front of the send buffer was sent past the peer's closed window
+    uint32_t sacked;            // packets in the send buffer that the peer has sacked
+    uint32_t pipe;              // packets still in the network, from the sack scoreboard
+    uint64_t recovery_start;    // when the current loss recovery started
+    stats stats;
 } params;
 
-void p_init(params *p,
-            int q_capacity,
-            int argc,
-            char *argv[],
-            void (*construct_addr)(struct sockaddr_in*, int, char*[]));
+void ep_init(endpoint *ep, const options *opt);
+bool ep_recv(endpoint *ep);
+bool ep_pending(endpoint *ep);
+void ep_flush(endpoint *ep);
+
+void p_init(params *p, endpoint *ep, int in_fd, int out_fd);
+void p_destroy(params *p);
+void p_detach(params *p);
+void p_move(params *p, endpoint *ep);
+void p_start_pipeline(params *p);
 
+void p_send(params *p, packet *pkt, trace_event op);
+bool p_unwrap(params *p);
+bool p_recv(params *p);
+void p_retransmit_front(params *p, trace_event op);
+void p_negotiate(params *p);
 void p_retransmit_on_timeout(params *p);
-void p_send_and_enqueue_pkt_send(params *p);
+void p_restart_timer(params *p);
+void p_established(params *p);
+void p_send_and_enqueue(params *p, uint16_t length, uint8_t flags);
+bool p_window_open(params *p);
+int p_read_input(params *p, uint32_t max);
 bool p_send_payload_ack(params *p);
 void p_retransmit_on_duplicate_ack(params *p);
-void p_handle_data_packet(params *p);
+bool p_handle_data_packet(params *p);
 bool p_clear_acked_packets_from_sbuf(params *p);
 void p_send_empty_ack(params *p);
+void p_ack_data(params *p, bool delay);
+void p_handle_packet(params *p);
+bool p_sync(params *p);
+int p_watch_io(params *p, bool want_stdin, bool flushed);
+int p_wait(params *p, bool want_stdin);
+bool p_linger(params *p);
+bool p_closed(params *p);
+void p_finish(params *p, const char *peer, int worker);
 
 void p_listen(params *p);
 
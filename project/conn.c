@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include "utils.h"
+#include "conn.h"
+
+/* Slot where the search for a peer starts: the address and port, mixed by a multiplicative hash. */
+static uint32_t ct_home(const conn_table *t, const struct sockaddr_in *addr) {
+    uint64_t key = (uint64_t) addr->sin_addr.s_addr << 16 | addr->sin_port;
+    return (key * 0x9E3779B97F4A7C15ull) >> 32 & t->mask;
+}
+
+static bool same_peer(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/* Allocates a table for up to capacity connections. Half of the slots stay empty,
+so a search probes about two of them. */
+void ct_init(conn_table *t, uint32_t capacity) {
+    t->mask = round_up_pow2(2 * capacity) - 1;
+    t->slots = calloc(t->mask + 1, sizeof(conn*));
+    t->list = malloc(capacity * sizeof(conn*));
+    if (t->slots == NULL || t->list == NULL)
+        die("connection table malloc failed");
+    t->size = 0;
+    t->capacity = capacity;
+}
+
+/* Returns the connection with the peer at addr, or NULL if there is none. */
+conn* ct_find(conn_table *t, const struct sockaddr_in *addr) {
+    for (uint32_t i = ct_home(t, addr); t->slots[i] != NULL; i = (i + 1) & t->mask) {
+        if (same_peer(&t->slots[i]->p.addr, addr))
+            return t->slots[i];
+    }
+    return NULL;
+}
+
+/* Adds a connection, keyed by its peer address p.addr.
+Returns false if the table is full. */
+bool ct_insert(conn_table *t, conn *c) {
+    if (t->size == t->capacity)
+        return false;
+    uint32_t i = ct_home(t, &c->p.addr);
+    while (t->slots[i] != NULL)
+        i = (i + 1) & t->mask;
+    t->slots[i] = c;
+    c->index = t->size;
+    t->list[t->size++] = c;
+    return true;
+}
+
+/* Removes a connection. The connections probed past its slot are shifted back
+over the hole, so that searches never need to skip deleted slots. */
+void ct_remove(conn_table *t, conn *c) {
+    uint32_t hole = ct_home(t, &c->p.addr);
+    while (t->slots[hole] != c)
+        hole = (hole + 1) & t->mask;
+    t->slots[hole] = NULL;
+    for (uint32_t i = (hole + 1) & t->mask; t->slots[i] != NULL; i = (i + 1) & t->mask) {
+        // it can fill the hole if the hole lies between its home slot and where it is now
+        uint32_t home = ct_home(t, &t->slots[i]->p.addr);
+        if (((i - home) & t->mask) >= ((i - hole) & t->mask)) {
+            t->slots[hole] = t->slots[i];
+            t->slots[i] = NULL;
+            hole = i;
+        }
+    }
+    conn *last = t->list[--t->size];
+    t->list[c->index] = last;
+    last->index = c->index;
+}
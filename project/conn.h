@@ -0,0 +1,43 @@
+#ifndef PROJECT_CONN_H_
+#define PROJECT_CONN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+
+typedef enum {
+    CONN_SYN_RECEIVED,  // the syn ack was sent, waiting for its ack
+    CONN_ESTABLISHED,
+} conn_state;
+
+/* A connection of the server, with all the state of a single connection in p. */
+typedef struct conn {
+    params p;
+    conn_state state;
+    uint64_t last_heard;    // when the peer last sent a packet, in us
+    timer idle;             // drops a peer that went quiet, with -m
+    struct server *server;  // the one holding it, for the idle timer
+    bool touched;           // handled since the last flush, so it needs a p_sync
+    uint32_t index;         // position in the list of the table
+    uint32_t bucket;        // steering bucket of the peer, with worker threads
+    struct conn *next;      // while handed over from one worker thread to another
+    char label[24];         // the peer as address:port
+} conn;
+
+/* Connections by peer address and port.
+A hash table with linear probing finds the connection of every received packet,
+and a list of them makes visiting all of them proportional to their number. */
+typedef struct conn_table {
+    conn **slots;
+    uint32_t mask;          // slots - 1, a power of two at least twice the capacity
+    conn **list;            // the connections held, in no particular order
+    uint32_t size;
+    uint32_t capacity;
+} conn_table;
+
+void ct_init(conn_table *t, uint32_t capacity);
+conn* ct_find(conn_table *t, const struct sockaddr_in *addr);
+bool ct_insert(conn_table *t, conn *c);
+void ct_remove(conn_table *t, conn *c);
+
+#endif  // PROJECT_CONN_H_
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "cookie.h"
+
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static void sip_round(uint64_t v[4]) {
+    v[0] += v[1]; v[1] = ROTL(v[1], 13); v[1] ^= v[0]; v[0] = ROTL(v[0], 32);
+    v[2] += v[3]; v[3] = ROTL(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = ROTL(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = ROTL(v[1], 17); v[1] ^= v[2]; v[2] = ROTL(v[2], 32);
+}
+
+/* SipHash-2-4 of a single 8 byte block. */
+static uint64_t siphash8(const cookie_key *key, uint64_t m) {
+    uint64_t v[4] = {
+        key->k0 ^ 0x736f6d6570736575ull, key->k1 ^ 0x646f72616e646f6dull,
+        key->k0 ^ 0x6c7967656e657261ull, key->k1 ^ 0x7465646279746573ull,
+    };
+    uint64_t last = (uint64_t) 8 << 56;  // the final block holds the length
+    v[3] ^= m;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= m;
+    v[3] ^= last;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= last;
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; i++)
+        sip_round(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/* Makes a key at random. */
+void cookie_key_init(cookie_key *key) {
+    if (getrandom(key, sizeof(*key), 0) != sizeof(*key))
+        die("getrandom");
+}
+
+/* Creates the file at path for writing, for its owner only: anyone who reads the key can forge
+cookies for any address. Fails if the file exists. */
+static FILE* cookie_create(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (f == NULL)
+        die(path);
+    return f;
+}
+
+/* Reads the key from the file at path, or makes one at random and writes it there
+if there is no such file yet. A key that others can read or write is refused. */
+void cookie_key_load(cookie_key *key, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        struct stat st;
+        if (fstat(fileno(f), &st) < 0)
+            die(path);
+        if (st.st_mode & (S_IRWXG | S_IRWXO)) {
+            fprintf(stderr, "%s: cookie key open to group or others, chmod 600 it\n", path);
+            exit(1);
+        }
+        unsigned long long k0, k1;
+        int n = fscanf(f, "%16llx%16llx", &k0, &k1);
+        fclose(f);
+        if (n != 2) {
+            fprintf(stderr, "%s: not a cookie key\n", path);
+            exit(1);
+        }
+        key->k0 = k0;
+        key->k1 = k1;
+        return;
+    }
+    if (errno != ENOENT)
+        die(path);
+    cookie_key_init(key);
+    f = cookie_create(path);
+    fprintf(f, "%016llx%016llx\n", (unsigned long long) key->k0, (unsigned long long) key->k1);
+    fclose(f);
+}
+
+/* Returns the cookie of a client address, never 0 or COOKIE_REQUEST. The port is left out,
+a client picks a new one for every connection. */
+uint32_t cookie_make(const cookie_key *key, const struct sockaddr_in *addr) {
+    uint8_t block[4];
+    memcpy(block, &addr->sin_addr.s_addr, 4);
+    uint64_t m = 0;
+    for (int i = 3; i >= 0; i--)  // little endian, like SipHash reads its input
+        m = m << 8 | block[i];
+    uint32_t cookie = siphash8(key, m);
+    return cookie > COOKIE_REQUEST ? cookie : cookie + 2;
+}
+
+/* Writes the server as the cookie file names it, address:port. */
+static void cookie_label(const struct sockaddr_in *server, char *out, size_t size) {
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &server->sin_addr, address, sizeof(address));
+    snprintf(out, size, "%s:%u", address, ntohs(server->sin_port));
+}
+
+/* Returns the cookie kept in the file at path for the server, or 0 if there is none. */
+uint32_t cookie_load(const char *path, const struct sockaddr_in *server) {
+    char label[COOKIE_LINE];
+    cookie_label(server, label, sizeof(label));
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+    char line[COOKIE_LINE];
+    uint32_t cookie = 0;
+    while (cookie == 0 && fgets(line, sizeof(line), f) != NULL) {
+        char name[COOKIE_LINE];
+        unsigned int value;
+        if (sscanf(line, "%63s %x", name, &value) == 2 && strcmp(name, label) == 0)
+            cookie = value;
+    }
+    fclose(f);
+    return cookie;
+}
+
+/* Keeps the cookie for the server in the file at path, in place of the one it had.
+The file is written anew and renamed over the old one, so a client that fails halfway
+leaves the old one whole, and like the key it is for its owner only. */
+void cookie_save(const char *path, const struct sockaddr_in *server, uint32_t cookie) {
+    char label[COOKIE_LINE], tmp[512];
+    cookie_label(server, label, sizeof(label));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    unlink(tmp);  // left by a client that failed, maybe with other permissions
+    FILE *out = cookie_create(tmp);
+    FILE *in = fopen(path, "r");
+    char line[COOKIE_LINE];
+    while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+        char name[COOKIE_LINE];
+        if (sscanf(line, "%63s", name) == 1 && strcmp(name, label) != 0)
+            fputs(line, out);
+    }
+    if (in != NULL)
+        fclose(in);
+    fprintf(out, "%s %08x\n", label, cookie);
+    if (fclose(out) != 0 || rename(tmp, path) != 0)
+        die(path);
+}
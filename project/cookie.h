@@ -0,0 +1,31 @@
+#ifndef PROJECT_COOKIE_H_
+#define PROJECT_COOKIE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+
+#define COOKIE_REQUEST 1        // sent by a client with -k that has no cookie for the server yet
+#define COOKIE_LINE 64          // longest line of the cookie file
+
+/* Fast open (like TCP's, RFC 7413). A client with -k sends a cookie in the ack field of its syn,
+which carries nothing else there: the one the server issued it last time, or COOKIE_REQUEST.
+With a cookie, the syn also carries the first segment of data, and a server that finds the cookie
+valid takes the data at once, half a round trip after the client started instead of one and a half.
+Otherwise the syn ack only acks the syn, and the client sends the data again after it.
+A cookie is a keyed hash of the client's address, so the server keeps no state for it,
+and a client can't get one for an address it doesn't receive at. The server issues one at the
+start of the payload of a syn ack whenever the syn asked for it, and the client keeps it in a file,
+a line of address:port and cookie per server. The server's key lives in a file too with -k,
+so cookies outlast a restart, else it is made at random when the server starts. */
+typedef struct cookie_key {
+    uint64_t k0, k1;
+} cookie_key;
+
+void cookie_key_init(cookie_key *key);
+void cookie_key_load(cookie_key *key, const char *path);
+uint32_t cookie_make(const cookie_key *key, const struct sockaddr_in *addr);
+uint32_t cookie_load(const char *path, const struct sockaddr_in *server);
+void cookie_save(const char *path, const struct sockaddr_in *server, uint32_t cookie);
+
+#endif  // PROJECT_COOKIE_H_
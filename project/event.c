@@ -0,0 +1,123 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "utils.h"
+#include "event.h"
+
+/* Creates the epoll instance and registers the socket and the retransmission timer.
+Stdin is registered later, only while there is room to send its data. */
+void ev_init(event_loop *ev, int sockfd) {
+    ev->epfd = epoll_create1(0);
+    if (ev->epfd < 0) die("epoll create");
+    ev->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (ev->timerfd < 0) die("timerfd create");
+    ev->deadline = 0;
+    ev->stdin_open = true;
+    ev->stdin_pollable = true;
+    ev->stdin_watched = false;
+    ev->stdin_wanted = false;
+    ev->stdout_watched = false;
+    ev->wakefd = -1;
+
+    struct epoll_event e = {.events = EPOLLIN, .data.u32 = EV_SOCKET};
+    if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, sockfd, &e) < 0) die("epoll socket");
+    e.data.u32 = EV_TIMER;
+    if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->timerfd, &e) < 0) die("epoll timer");
+}
+
+/* Registers or unregisters stdin with epoll.
+Stdin is level triggered, so it must not stay registered while the send buffer is full. */
+void ev_watch_stdin(event_loop *ev, bool want) {
+    ev->stdin_wanted = want && ev->stdin_open;
+    if (!ev->stdin_pollable || ev->stdin_wanted == ev->stdin_watched)
+        return;
+    struct epoll_event e = {.events = EPOLLIN, .data.u32 = EV_STDIN};
+    if (ev->stdin_wanted) {
+        if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, STDIN_FILENO, &e) < 0) {
+            if (errno != EPERM) die("epoll stdin");
+            // regular files and /dev/null can't be polled, they are always readable
+            ev->stdin_pollable = false;
+            return;
+        }
+    } else {
+        epoll_ctl(ev->epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+    }
+    ev->stdin_watched = ev->stdin_wanted;
+}
+
+/* Stops watching stdin for good once it has reached end of file. */
+void ev_close_stdin(event_loop *ev) {
+    ev_watch_stdin(ev, false);
+    ev->stdin_open = false;
+}
+
+/* Registers or unregisters stdout with epoll, for output it wasn't ready to take.
+Regular files can't be polled, but they never make a write wait either. */
+void ev_watch_stdout(event_loop *ev, bool want) {
+    if (want == ev->stdout_watched)
+        return;
+    struct epoll_event e = {.events = EPOLLOUT, .data.u32 = EV_STDOUT};
+    if (want) {
+        if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, STDOUT_FILENO, &e) < 0) {
+            if (errno != EPERM) die("epoll stdout");
+            return;
+        }
+    } else {
+        epoll_ctl(ev->epfd, EPOLL_CTL_DEL, STDOUT_FILENO, NULL);
+    }
+    ev->stdout_watched = want;
+}
+
+/* Arms the timer to fire at the given monotonic time in us, or disarms it if 0. */
+void ev_set_deadline(event_loop *ev, uint64_t deadline) {
+    if (deadline == ev->deadline)
+        return;
+    struct itimerspec its = {0};
+    if (deadline != 0) {
+        its.it_value.tv_sec = deadline / 1000000;
+        its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+    }
+    if (timerfd_settime(ev->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        die("timerfd set");
+    ev->deadline = deadline;
+}
+
+/* Lets other threads interrupt ev_wait with ev_wake. */
+void ev_enable_wake(event_loop *ev) {
+    ev->wakefd = eventfd(0, EFD_NONBLOCK);
+    if (ev->wakefd < 0) die("eventfd create");
+    struct epoll_event e = {.events = EPOLLIN, .data.u32 = EV_WAKE};
+    if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->wakefd, &e) < 0) die("epoll eventfd");
+}
+
+/* Makes ev_wait return EV_WAKE. Called from another thread than the one waiting. */
+void ev_wake(event_loop *ev) {
+    uint64_t one = 1;
+    write(ev->wakefd, &one, sizeof(one));
+}
+
+/* Blocks until the socket, stdin, stdout or the timer is ready, or another thread wakes it.
+Returns a mask of EV_SOCKET, EV_STDIN, EV_STDOUT, EV_TIMER and EV_WAKE. */
+int ev_wait(event_loop *ev) {
+    struct epoll_event events[5];
+    // an unpollable stdin is always ready, so only check the other fds
+    bool stdin_ready = ev->stdin_wanted && !ev->stdin_pollable;
+    int n = epoll_wait(ev->epfd, events, 5, stdin_ready ? 0 : -1);
+    if (n < 0 && errno != EINTR) die("epoll wait");
+
+    int mask = stdin_ready ? EV_STDIN : 0;
+    for (int i = 0; i < n; i++)
+        mask |= events[i].data.u32;
+    if (mask & EV_TIMER) {
+        uint64_t expirations;
+        read(ev->timerfd, &expirations, sizeof(expirations));
+        ev->deadline = 0;  // one shot, must be rearmed
+    }
+    if (mask & EV_WAKE) {
+        uint64_t wakes;
+        read(ev->wakefd, &wakes, sizeof(wakes));
+    }
+    return mask;
+}
@@ -0,0 +1,34 @@
+#ifndef PROJECT_EVENT_H_
+#define PROJECT_EVENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EV_SOCKET 1
+#define EV_STDIN 2
+#define EV_TIMER 4
+#define EV_STDOUT 8
+#define EV_WAKE 16
+
+typedef struct event_loop {
+    int epfd;
+    int timerfd;
+    uint64_t deadline;     // armed timerfd deadline in us, 0 if disarmed
+    bool stdin_open;       // false once stdin has reached end of file
+    bool stdin_pollable;   // false if epoll rejects stdin (regular files)
+    bool stdin_watched;    // stdin is currently registered with epoll
+    bool stdin_wanted;     // there is room to send data read from stdin
+    bool stdout_watched;   // stdout is registered with epoll, output is waiting for it
+    int wakefd;            // eventfd other threads write to with ev_wake, -1 if not enabled
+} event_loop;
+
+void ev_init(event_loop *ev, int sockfd);
+void ev_watch_stdin(event_loop *ev, bool want);
+void ev_close_stdin(event_loop *ev);
+void ev_watch_stdout(event_loop *ev, bool want);
+void ev_set_deadline(event_loop *ev, uint64_t deadline);
+void ev_enable_wake(event_loop *ev);
+void ev_wake(event_loop *ev);
+int ev_wait(event_loop *ev);
+
+#endif  // PROJECT_EVENT_H_
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fec.h"
+
+/* Xors len bytes of src into dst, a word at a time. */
+static void fec_xor(uint8_t *dst, const uint8_t *src, uint32_t len) {
+    uint32_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        a ^= b;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < len; i++)
+        dst[i] ^= src[i];
+}
+
+void fec_encoder_init(fec_encoder *f) {
+    memset(&f->parity, 0, sizeof(f->parity));
+    f->k = FEC_MAX_K;
+    f->count = 0;
+    f->end = 0;
+    f->sample_sent = 0;
+    f->sample_lost = 0;
+    f->loss = 0;
+}
+
+/* Returns the group size that expects FEC_GROUP_LOSS losses at the smoothed loss rate. */
+static uint32_t fec_group_size(double loss) {
+    if (loss * FEC_MAX_K <= FEC_GROUP_LOSS)
+        return FEC_MAX_K;
+    uint32_t k = FEC_GROUP_LOSS / loss;
+    return k < FEC_MIN_K ? FEC_MIN_K : k;
+}
+
+/* Adds a new data packet to the group being built, with its payload in up to two pieces.
+Returns true once the group is complete, then fec_parity has its parity packet. */
+bool fec_add(fec_encoder *f, uint64_t seq, const struct iovec *payload, int pieces, uint16_t length) {
+    packet *parity = &f->parity;
+    if (f->count == 0) {
+        f->k = fec_group_size(f->loss);
+        parity->seq = seq;
+        parity->length = 0;
+    }
+    if (length > parity->length) {  // the shorter payloads before it are padded with zeros
+        memset(parity->payload + parity->length, 0, length - parity->length);
+        parity->length = length;
+    }
+    uint32_t offset = 0;
+    for (int i = 0; i < pieces; i++) {
+        fec_xor(parity->payload + offset, payload[i].iov_base, payload[i].iov_len);
+        offset += payload[i].iov_len;
+    }
+    f->count++;
+    f->end = seq + length;
+
+    if (++f->sample_sent == FEC_SAMPLE) {
+        f->loss = 0.75 * f->loss + 0.25 * f->sample_lost / f->sample_sent;
+        f->sample_sent = 0;
+        f->sample_lost = 0;
+    }
+    return f->count == f->k;
+}
+
+/* Returns true if packets were added since the last parity packet. */
+bool fec_pending(const fec_encoder *f) {
+    return f->count > 0;
+}
+
+/* Finishes the group, complete or not, and returns its parity packet in host byte order,
+valid until the next fec_add. */
+packet* fec_parity(fec_encoder *f) {
+    packet *parity = &f->parity;
+    parity->flags = PKT_FEC;
+    parity->ack = f->end - parity->seq;
+    parity->window = f->count;
+    f->count = 0;
+    return parity;
+}
+
+/* Counts a loss towards the loss rate: a packet retransmitted, or one the receiver got only after
+the packets behind it, which is how a packet rebuilt from parity looks to the sender. */
+void fec_lost(fec_encoder *f) {
+    f->sample_lost++;
+}
+
+bool fec_decoder_init(fec_decoder *d) {
+    d->history = malloc(FEC_HISTORY * sizeof(packet));
+    d->head = 0;
+    d->size = 0;
+    return d->history != NULL;
+}
+
+void fec_decoder_destroy(fec_decoder *d) {
+    free(d->history);
+    d->history = NULL;
+}
+
+/* Keeps a copy of a packet delivered in order, with its payload in up to two pieces,
+dropping the oldest one kept if there is no room. */
+void fec_remember(fec_decoder *d, uint64_t seq, const struct iovec *payload, int pieces) {
+    packet *pkt = &d->history[(d->head + d->size) % FEC_HISTORY];
+    if (d->size == FEC_HISTORY)
+        d->head = (d->head + 1) % FEC_HISTORY;
+    else
+        d->size++;
+    pkt->seq = seq;
+    pkt->length = 0;
+    for (int i = 0; i < pieces; i++) {
+        memcpy(pkt->payload + pkt->length, payload[i].iov_base, payload[i].iov_len);
+        pkt->length += payload[i].iov_len;
+    }
+}
+
+/* Returns the delivered packet starting at seq, or NULL if it isn't kept anymore.
+The group being rebuilt is among the newest, so they are searched first. */
+static const packet* fec_history_find(const fec_decoder *d, uint64_t seq) {
+    for (uint32_t i = d->size; i > 0; i--) {
+        const packet *pkt = &d->history[(d->head + i - 1) % FEC_HISTORY];
+        if (pkt->seq == seq)
+            return pkt;
+        if (pkt->seq < seq)
+            break;
+    }
+    return NULL;
+}
+
+/* Points piece at the payload of the packet of a group starting at seq, delivered or held in the
+receive buffer. Returns the number of pieces, 0 if the packet isn't there. */
+static int fec_payload(const fec_decoder *d, rb_handle_t recv_q, uint64_t recv_seq, uint64_t seq,
+                       struct iovec *piece) {
+    if (seq < recv_seq) {
+        const packet *pkt = fec_history_find(d, seq);
+        if (pkt == NULL)
+            return 0;
+        piece[0].iov_base = (void*) pkt->payload;
+        piece[0].iov_len = pkt->length;
+        return 1;
+    }
+    const rb_entry *e = rb_find(recv_q, seq, seq + 1);
+    return e != NULL ? rb_payload(recv_q, e, piece) : 0;
+}
+
+/* Rebuilds the missing packet of the group of a received parity packet, in place, from the
+packets of the group delivered or held in the receive buffer. Returns false if nothing is missing,
+or more than one packet is, or a packet of the group was delivered too long ago to be kept. */
+bool fec_rebuild(fec_decoder *d, packet *pkt, rb_handle_t recv_q, uint64_t recv_seq) {
+    uint32_t span = (uint32_t) pkt->ack;
+    uint64_t end = pkt->seq + span;
+    uint32_t count = pkt->window;
+    if (count == 0 || count > FEC_MAX_K || span > count * MSS_MAX || end <= recv_seq)
+        return false;
+    uint64_t hole = 0, hole_end = 0;
+    bool missing = false;
+    uint32_t found = 0;
+    for (uint64_t seq = pkt->seq; seq < end;) {
+        struct iovec piece[2];
+        int pieces = fec_payload(d, recv_q, recv_seq, seq, piece);
+        if (pieces == 0) {
+            if (seq < recv_seq || missing)  // only one packet can be rebuilt
+                return false;
+            // the next packet held starts within a packet of the hole, or the hole ends the group
+            uint64_t limit = end < seq + MSS_MAX + 1 ? end : seq + MSS_MAX + 1;
+            const rb_entry *next = rb_find(recv_q, seq + 1, limit);
+            missing = true;
+            hole = seq;
+            hole_end = next != NULL ? next->seq : end;
+            seq = hole_end;
+            continue;
+        }
+        uint32_t length = 0;
+        for (int i = 0; i < pieces; i++) {
+            if (length + piece[i].iov_len > pkt->length)
+                return false;
+            fec_xor(pkt->payload + length, piece[i].iov_base, piece[i].iov_len);
+            length += piece[i].iov_len;
+        }
+        if (seq + length > end)
+            return false;  // not a packet of this group, the peer must have sent something else
+        found++;
+        seq += length;
+    }
+    uint32_t length = hole_end - hole;
+    if (!missing || found + 1 != count || length > pkt->length)
+        return false;
+    for (uint32_t i = length; i < pkt->length; i++) {
+        if (pkt->payload[i] != 0)  // the padding of the rebuilt packet must come out as zeros
+            return false;
+    }
+    pkt->seq = hole;
+    pkt->length = length;
+    pkt->flags = 0;
+    return true;
+}
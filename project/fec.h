@@ -0,0 +1,53 @@
+#ifndef PROJECT_FEC_H_
+#define PROJECT_FEC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include "utils.h"
+#include "rbuf.h"
+
+#define FEC_MIN_K 2             // data packets per parity packet at the highest loss rates
+#define FEC_MAX_K 32            // and with no loss seen
+#define FEC_GROUP_LOSS 0.2      // losses expected per group, one parity packet repairs one
+#define FEC_SAMPLE 64           // data packets sent per sample of the loss rate
+#define FEC_HISTORY (2 * FEC_MAX_K)  // packets delivered in order kept for rebuilding
+
+/* With -f, the sender follows every k new data packets with a parity packet, the xor of their
+payloads, each padded with zeros to the longest. A receiver missing exactly one packet of the group
+rebuilds it from the parity and the others, without waiting a round trip for the retransmission.
+On the wire, a parity packet carries PKT_FEC, the seq of the first packet of its group, the bytes
+the group spans in the ack field, and the number of packets in the window byte. It acks nothing
+and isn't acked or retransmitted itself.
+k follows the loss rate the sender sees, so that a group expects FEC_GROUP_LOSS losses:
+from FEC_MAX_K when nothing is lost down to FEC_MIN_K at 10% loss. */
+typedef struct fec_encoder {
+    uint32_t k;                 // data packets in the group being built
+    uint32_t count;             // of which were sent so far
+    packet parity;              // their parity, from the seq of the first one
+    uint64_t end;               // seq after the last one
+    uint32_t sample_sent;       // new data packets sent in the loss sample being taken
+    uint32_t sample_lost;       // and losses seen meanwhile
+    double loss;                // smoothed loss rate, from the samples
+} fec_encoder;
+
+/* Payloads delivered in order are gone from the receive buffer, so the last few are kept here,
+in a ring, for rebuilding a packet of a group that was partly delivered. */
+typedef struct fec_decoder {
+    packet *history;
+    uint32_t head;              // oldest packet kept
+    uint32_t size;
+} fec_decoder;
+
+void fec_encoder_init(fec_encoder *f);
+bool fec_add(fec_encoder *f, uint64_t seq, const struct iovec *payload, int pieces, uint16_t length);
+packet* fec_parity(fec_encoder *f);
+bool fec_pending(const fec_encoder *f);
+void fec_lost(fec_encoder *f);
+
+bool fec_decoder_init(fec_decoder *d);
+void fec_decoder_destroy(fec_decoder *d);
+void fec_remember(fec_decoder *d, uint64_t seq, const struct iovec *payload, int pieces);
+bool fec_rebuild(fec_decoder *d, packet *pkt, rb_handle_t recv_q, uint64_t recv_seq);
+
+#endif  // PROJECT_FEC_H_
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "utils.h"
+#include "obuf.h"
+
+/* The output buffer is a ring of bytes delivered in order but not yet written out.
+Payloads are appended as they are delivered, and everything collected while handling
+one wakeup goes out with a single writev, in two pieces if the ring wraps.
+Whatever the fd doesn't take stays in the ring for the next flush, so nothing is dropped. */
+struct obuf_t {
+    uint8_t *data;
+    uint32_t mask;      // ring size - 1, the size is a power of two
+    uint32_t head;      // first byte not written yet, counted from the start, wraps around
+    uint32_t tail;      // byte after the last one appended
+};
+
+/* Allocates a ring of at least size bytes. Returns NULL if it is too large or malloc fails. */
+ob_handle_t ob_init(uint32_t size) {
+    if (size > (1u << 30))
+        return NULL;
+    ob_handle_t self = malloc(sizeof(struct obuf_t));
+    if (self == NULL)
+        return NULL;
+    size = round_up_pow2(size);
+    self->data = malloc(size);
+    if (self->data == NULL) {
+        free(self);
+        return NULL;
+    }
+    self->mask = size - 1;
+    self->head = 0;
+    self->tail = 0;
+    return self;
+}
+
+void ob_destroy(ob_handle_t self) {
+    free(self->data);
+    free(self);
+}
+
+/* Returns the bytes that can be appended without waiting for fd. */
+uint32_t ob_space(ob_handle_t self) {
+    return self->mask + 1 - (self->tail - self->head);
+}
+
+/* Waits until fd can take more. */
+static void ob_poll(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR) die("poll stdout");
+}
+
+/* Copies len bytes to the back of the buffer.
+If they don't fit, waits for fd to take enough of the buffer first. */
+void ob_append(ob_handle_t self, int fd, const uint8_t *data, uint32_t len) {
+    while (ob_space(self) < len) {
+        if (!ob_flush(self, fd))
+            ob_poll(fd);
+    }
+    uint32_t start = self->tail & self->mask;
+    uint32_t first = self->mask + 1 - start;
+    if (first > len)
+        first = len;
+    memcpy(self->data + start, data, first);
+    memcpy(self->data, data + first, len - first);
+    self->tail += len;
+}
+
+/* Writes out as much of the buffer as fd takes without blocking, or all of it if fd blocks.
+Partial writes are retried. Returns true once the buffer is empty. */
+bool ob_flush(ob_handle_t self, int fd) {
+    while (!ob_empty(self)) {
+        uint32_t len = self->tail - self->head;
+        uint32_t start = self->head & self->mask;
+        uint32_t first = self->mask + 1 - start;
+        struct iovec iov[2] = {
+            {self->data + start, first < len ? first : len},
+            {self->data, first < len ? len - first : 0},
+        };
+        ssize_t written = writev(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0 && errno == EAGAIN)
+            return false;
+        if (written < 0) die("write stdout");
+        self->head += written;
+    }
+    return true;
+}
+
+/* Writes out all of the buffer, waiting for fd to take it, once nothing more is coming. */
+void ob_drain(ob_handle_t self, int fd) {
+    while (!ob_flush(self, fd))
+        ob_poll(fd);
+}
+
+bool ob_empty(ob_handle_t self) {
+    return self->head == self->tail;
+}
@@ -0,0 +1,17 @@
+#ifndef PROJECT_OBUF_H_
+#define PROJECT_OBUF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct obuf_t* ob_handle_t;
+
+ob_handle_t ob_init(uint32_t size);
+void ob_destroy(ob_handle_t self);
+void ob_append(ob_handle_t self, int fd, const uint8_t *data, uint32_t len);
+bool ob_flush(ob_handle_t self, int fd);
+void ob_drain(ob_handle_t self, int fd);
+bool ob_empty(ob_handle_t self);
+uint32_t ob_space(ob_handle_t self);
+
+#endif  // PROJECT_OBUF_H_
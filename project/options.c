@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "options.h"
+#include "batch.h"
+#include "trace.h"
+#include "stats.h"
+#include "pace.h"
+#include "utils.h"
+
+static char default_trace_file[256];
+
+static void print_usage(const char *prog, const char *usage) {
+    fprintf(stderr,
+            "usage: %s [options] %s\n"
+            "  -c <algorithm>  congestion control: fixed, newreno, cubic (default fixed)\n"
+            "  -w <packets>    send and receive buffer size (default %d)\n"
+            "  -s              negotiate selective acknowledgements\n"
+            "  -a              negotiate compact headers for acks without data\n"
+            "  -e              negotiate 64 bit seq numbers on the wire, so that stale packets from an\n"
+            "                  earlier lap of the 32 bit seq numbers are dropped\n"
+            "  -f              negotiate forward error correction: a parity packet after every 2 to 32\n"
+            "                  data packets, more often as more are lost, rebuilds one lost packet\n"
+            "  -x <bytes>      negotiate segments up to this size, %d to %d (default %d), and probe\n"
+            "                  the path for the largest one it carries (DPLPMTUD)\n"
+            "  -b <datagrams>  socket reads and writes per syscall, 1 to %d (default %d)\n"
+            "  -g              segment and coalesce batches in the kernel (UDP GSO/GRO)\n"
+            "  -v <level>      trace 1: packets, 2: packets and buffers (default 0: off)\n"
+            "  -t <file>       dump the trace there on SIGUSR2, SIGINT, SIGTERM or exit\n"
+            "                  (default <program>.trace), decode it with tracedump\n"
+            "  -j <target>     write stats as JSON lines to a file, or to unix:<path> as datagrams\n"
+            "  -i <ms>         interval between JSON lines (default %d), SIGUSR1 prints one anytime\n"
+            "  -m <peers>      server: serve up to this many peers at once, without stdin and stdout\n"
+            "  -o <dir>        server: with -m, write the data of each peer to <dir>/<address>-<port>\n"
+            "                  (default: discard it)\n"
+            "  -n <threads>    server: with -m, spread the peers over this many threads, 1 to %d\n"
+            "                  (default 1), each pinned to a core with its own socket on the port\n"
+            "  -d <packets>    ack every this many data packets received in order, up to half the\n"
+            "                  window (default %d), or after 5 ms, out of order packets are acked at once\n"
+            "  -p <percent>    pace new data at this percent of the congestion window per RTT, at least\n"
+            "                  %d in slow start (default 0: send what the window allows at once)\n"
+            "  -l              read stdin and write stdout on threads of their own, which hand the data\n"
+            "                  over through lock free queues, so slow I/O doesn't delay acks and timers\n"
+            "  -u              receive and send through io_uring, with a multishot receive into\n"
+            "                  provided buffers, falling back to recvmmsg and sendmmsg without it\n"
+            "  -k <file>       fast open: the client keeps the cookies servers issue there, and sends\n"
+            "                  data in its syn with one, the server keeps the key it makes them with\n",
+            prog, usage, DEFAULT_WINDOW, MSS, MSS_MAX, MSS, BATCH_MAX, DEFAULT_BATCH, DEFAULT_STATS_INTERVAL, MAX_THREADS,
+            DEFAULT_ACK_EVERY, PACE_SLOW_START_GAIN);
+    exit(1);
+}
+
+/* Parses the command line options, and removes them from argc and argv
+so that the positional arguments keep their usual indices. */
+void opt_parse(options *opt, int *argc, char **argv[], const char *usage) {
+    opt->cc = &cc_fixed;
+    opt->window = DEFAULT_WINDOW;
+    opt->sack = false;
+    opt->compact = false;
+    opt->seq64 = false;
+    opt->fec = false;
+    opt->mss = MSS;
+    opt->batch = DEFAULT_BATCH;
+    opt->offload = false;
+    opt->verbosity = TRACE_OFF;
+    opt->stats_target = NULL;
+    opt->stats_interval = DEFAULT_STATS_INTERVAL;
+    opt->connections = 0;
+    opt->out_dir = NULL;
+    opt->threads = 1;
+    opt->ack_every = DEFAULT_ACK_EVERY;
+    opt->pace = 0;
+    opt->pipeline = false;
+    opt->uring = false;
+    opt->cookie_file = NULL;
+
+    char **args = *argv;
+    const char *prog = strrchr(args[0], '/') != NULL ? strrchr(args[0], '/') + 1 : args[0];
+    snprintf(default_trace_file, sizeof(default_trace_file), "%s.trace", prog);
+    opt->trace_file = default_trace_file;
+    int c;
+    while ((c = getopt(*argc, args, "c:w:saefx:b:gv:t:j:i:m:o:n:d:p:luk:")) != -1) {
+        switch (c) {
+            case 'c':
+                opt->cc = cc_find(optarg);
+                if (opt->cc == NULL)
+                    print_usage(args[0], usage);
+                break;
+            case 'w':
+                opt->window = atoi(optarg);
+                if (opt->window == 0)
+                    print_usage(args[0], usage);
+                break;
+            case 's':
+                opt->sack = true;
+                break;
+            case 'a':
+                opt->compact = true;
+                break;
+            case 'e':
+                opt->seq64 = true;
+                break;
+            case 'f':
+                opt->fec = true;
+                break;
+            case 'x':
+                opt->mss = atoi(optarg);
+                if (opt->mss < MSS || opt->mss > MSS_MAX)
+                    print_usage(args[0], usage);
+                break;
+            case 'b':
+                opt->batch = atoi(optarg);
+                if (opt->batch == 0 || opt->batch > BATCH_MAX)
+                    print_usage(args[0], usage);
+                break;
+            case 'g':
+                opt->offload = true;
+                break;
+            case 'v':
+                opt->verbosity = atoi(optarg);
+                if (opt->verbosity < TRACE_OFF || opt->verbosity > TRACE_BUFFERS)
+                    print_usage(args[0], usage);
+                break;
+            case 't':
+                opt->trace_file = optarg;
+                break;
+            case 'j':
+                opt->stats_target = optarg;
+                break;
+            case 'i':
+                opt->stats_interval = atoi(optarg);
+                if (opt->stats_interval == 0)
+                    print_usage(args[0], usage);
+                break;
+            case 'm':
+                opt->connections = atoi(optarg);
+                if (opt->connections == 0)
+                    print_usage(args[0], usage);
+                break;
+            case 'o':
+                opt->out_dir = optarg;
+                break;
+            case 'n':
+                opt->threads = atoi(optarg);
+                if (opt->threads == 0 || opt->threads > MAX_THREADS)
+                    print_usage(args[0], usage);
+                break;
+            case 'd':
+                opt->ack_every = atoi(optarg);
+                if (opt->ack_every == 0)
+                    print_usage(args[0], usage);
+                break;
+            case 'p':
+                opt->pace = atoi(optarg);
+                if (opt->pace == 0)
+                    print_usage(args[0], usage);
+                break;
+            case 'l':
+                opt->pipeline = true;
+                break;
+            case 'u':
+                opt->uring = true;
+                break;
+            case 'k':
+                opt->cookie_file = optarg;
+                break;
+            default:
+                print_usage(args[0], usage);
+        }
+    }
+    // a sender can have at most a window in flight, waiting for more would stall it on every round trip
+    if (opt->ack_every > opt->window / 2)
+        opt->ack_every = opt->window / 2 > 0 ? opt->window / 2 : 1;
+    args[optind - 1] = args[0];
+    *argv = args + optind - 1;
+    *argc -= optind - 1;
+}
@@ -0,0 +1,39 @@
+#ifndef PROJECT_OPTIONS_H_
+#define PROJECT_OPTIONS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cc.h"
+
+#define DEFAULT_WINDOW 20  // send and receive buffer size in packets
+#define DEFAULT_BATCH 64   // datagrams per recvmmsg and sendmmsg
+#define MAX_THREADS 64     // server worker threads
+#define DEFAULT_ACK_EVERY 1  // data packets received in order per ack
+
+typedef struct options {
+    const cc_ops *cc;       // congestion control algorithm
+    uint32_t window;        // send and receive buffer capacity in packets
+    bool sack;              // offer selective acknowledgements in the handshake
+    bool compact;           // offer compact headers for acks without data
+    bool seq64;             // offer 64 bit seq numbers on the wire
+    bool fec;               // offer parity packets that let the receiver rebuild a lost packet
+    uint32_t mss;           // largest segment offered, and probed for once negotiated, MSS to MSS_MAX
+    uint32_t batch;         // datagrams moved per syscall, 1 disables batching
+    bool offload;           // use UDP GSO and GRO if the kernel supports them
+    int verbosity;          // trace level, TRACE_OFF, TRACE_PACKETS or TRACE_BUFFERS
+    const char *trace_file; // where the trace is dumped
+    const char *stats_target;   // file or unix:<path> for the JSON lines emitter, NULL if none
+    uint32_t stats_interval;    // ms between JSON lines
+    uint32_t connections;   // server: most peers served at once, 0 for one peer on stdin and stdout
+    const char *out_dir;    // server: where each peer's data goes with connections set, NULL to discard it
+    uint32_t threads;       // server: worker threads, each with its own socket on the port
+    uint32_t ack_every;     // data packets received in order before an ack, others wait for a timer
+    uint32_t pace;          // percent of the congestion window sent per RTT, 0 to send it at once
+    bool pipeline;          // read stdin and write stdout on threads of their own
+    bool uring;             // drive the socket through io_uring, if the kernel allows it
+    const char *cookie_file;    // fast open, client: the cookies servers issued, server: its key, NULL without
+} options;
+
+void opt_parse(options *opt, int *argc, char **argv[], const char *usage);
+
+#endif  // PROJECT_OPTIONS_H_
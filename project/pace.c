@@ -0,0 +1,57 @@
+#include "utils.h"
+#include "wire.h"
+#include "pace.h"
+
+void pace_init(pacer *pc, uint32_t gain) {
+    pc->gain = gain;
+    pc->rate = 0;
+    pc->tokens = 0;
+    pc->refilled = 0;
+    pc->departure = 0;
+    pc->segment = HEADER_SIZE + MSS;
+}
+
+/* Sets the rate from the window and the smoothed RTT, after an ack changed either.
+In slow start the window doubles every RTT, so the rate is at least twice the window per RTT,
+or the pacer would hold the window back (as Linux does). */
+void pace_update(pacer *pc, const cc_state *cc, const rtt_estimator *rtt) {
+    if (pc->gain == 0 || !rtt->has_sample || rtt->srtt == 0) {
+        pc->rate = 0;
+        return;
+    }
+    uint32_t gain = pc->gain;
+    if (cc->cwnd < cc->ssthresh / 2 && gain < PACE_SLOW_START_GAIN)
+        gain = PACE_SLOW_START_GAIN;
+    pc->rate = (double) gain / 100 * cc_window(cc) * pc->segment / rtt->srtt;
+}
+
+/* Tops up the bucket. Returns 0 if a full packet may be sent now,
+or when the bucket will hold enough for one. */
+uint64_t pace_next(pacer *pc, uint64_t now) {
+    if (pc->rate == 0)
+        return 0;
+    double burst = pc->rate * PACE_BURST_US;
+    if (burst < PACE_MIN_BURST * pc->segment)
+        burst = PACE_MIN_BURST * pc->segment;
+    pc->tokens += pc->rate * (now - pc->refilled);
+    if (pc->tokens > burst)
+        pc->tokens = burst;
+    pc->refilled = now;
+    if (pc->tokens >= pc->segment)
+        return 0;
+    return now + (uint64_t) ((pc->segment - pc->tokens) / pc->rate) + 1;
+}
+
+/* Takes a packet of bytes on the wire out of the bucket.
+Returns its departure time in ns for SO_TXTIME, spaced at the rate after the packet before it,
+or 0 if it isn't paced. */
+uint64_t pace_sent(pacer *pc, uint32_t bytes, uint64_t now) {
+    if (pc->rate == 0)
+        return 0;
+    pc->tokens -= bytes;
+    if (pc->departure < now * 1000)
+        pc->departure = now * 1000;
+    uint64_t departure = pc->departure;
+    pc->departure += (uint64_t) (bytes * 1000 / pc->rate);
+    return departure;
+}
@@ -0,0 +1,32 @@
+#ifndef PROJECT_PACE_H_
+#define PROJECT_PACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtt.h"
+#include "cc.h"
+
+#define PACE_SLOW_START_GAIN 200    // percent of the window per RTT while it is far below ssthresh
+#define PACE_BURST_US 200           // the bucket holds this long at the rate, the timer fires per tick
+#define PACE_MIN_BURST 2            // and at least this many packets
+
+/* Spaces new packets out at gain percent of the congestion window per smoothed RTT,
+instead of sending whatever the window allows back to back.
+A token bucket holds the bytes that may go now. The timer that refills it only fires every
+tick, so the packets of a tick still leave together, unless they carry departure times
+for the kernel (SO_TXTIME), which the fq qdisc keeps to. */
+typedef struct pacer {
+    uint32_t gain;          // percent of the window per RTT in congestion avoidance, 0 for no pacing
+    double rate;            // bytes per us, 0 until there is an RTT sample
+    double tokens;          // bytes that may be sent now
+    uint64_t refilled;      // when the tokens were last topped up, in us
+    uint64_t departure;     // earliest departure of the next packet, in ns
+    uint32_t segment;       // bytes on the wire of a full packet, the header and the segment size
+} pacer;
+
+void pace_init(pacer *pc, uint32_t gain);
+void pace_update(pacer *pc, const cc_state *cc, const rtt_estimator *rtt);
+uint64_t pace_next(pacer *pc, uint64_t now);
+uint64_t pace_sent(pacer *pc, uint32_t bytes, uint64_t now);
+
+#endif  // PROJECT_PACE_H_
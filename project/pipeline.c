@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "utils.h"
+#include "pipeline.h"
+
+/* Sleeps until the other side of a queue writes the eventfd. */
+static void pl_sleep(int fd) {
+    uint64_t wakes;
+    if (read(fd, &wakes, sizeof(wakes)) < 0 && errno != EINTR)
+        die("eventfd read");
+}
+
+static void pl_wake(int fd) {
+    uint64_t one = 1;
+    write(fd, &one, sizeof(one));
+}
+
+/* Waits for fd to be ready, in case it was left nonblocking by whoever else shares it. */
+static void pl_poll(int fd, short events) {
+    struct pollfd pfd = {.fd = fd, .events = events};
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        die("poll");
+}
+
+/* Reads in_fd into the input queue until end of file. */
+static void* pl_reader(void *arg) {
+    pipeline *pl = arg;
+    for (;;) {
+        struct iovec iov[2];
+        int n = spsc_free(&pl->in, PIPELINE_CHUNK, iov);
+        if (n == 0) {
+            if (spsc_want_space(&pl->in, 1))
+                pl_sleep(pl->reader_wake);
+            continue;
+        }
+        ssize_t len = readv(pl->in_fd, iov, n);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0 && errno == EAGAIN) {
+            pl_poll(pl->in_fd, POLLIN);
+            continue;
+        }
+        if (len < 0) die("read stdin");
+        if (len == 0) {
+            atomic_store(&pl->eof, true);
+            ev_wake(pl->ev);
+            return NULL;
+        }
+        spsc_push(&pl->in, len);
+        if (spsc_publish(&pl->in))
+            ev_wake(pl->ev);
+    }
+}
+
+/* Writes the output queue to out_fd, until it is empty once the connection closed. */
+static void* pl_writer(void *arg) {
+    pipeline *pl = arg;
+    for (;;) {
+        struct iovec iov[2];
+        int n = spsc_peek(&pl->out, PIPELINE_CHUNK, iov);
+        if (n == 0 && atomic_load(&pl->closing))
+            return NULL;
+        if (n == 0) {
+            if (spsc_want_data(&pl->out))
+                pl_sleep(pl->writer_wake);
+            continue;
+        }
+        ssize_t len = writev(pl->out_fd, iov, n);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0 && errno == EAGAIN) {
+            pl_poll(pl->out_fd, POLLOUT);
+            continue;
+        }
+        if (len < 0) die("write stdout");
+        spsc_pop(&pl->out, len);
+        if (spsc_release(&pl->out))
+            ev_wake(pl->ev);
+    }
+    return NULL;  // not reached
+}
+
+/* Starts the I/O threads of a connection, with queues of at least size bytes each.
+They wake ev, whose wake must be enabled. */
+pipeline* pl_start(int in_fd, int out_fd, event_loop *ev, uint32_t size) {
+    pipeline *pl = malloc(sizeof(pipeline));
+    if (pl == NULL || !spsc_init(&pl->in, size) || !spsc_init(&pl->out, size))
+        die("pipeline malloc failed");
+    pl->in_fd = in_fd;
+    pl->out_fd = out_fd;
+    pl->ev = ev;
+    pl->reader_wake = eventfd(0, 0);
+    pl->writer_wake = eventfd(0, 0);
+    if (pl->reader_wake < 0 || pl->writer_wake < 0) die("eventfd create");
+    atomic_init(&pl->eof, false);
+    atomic_init(&pl->closing, false);
+    if (pthread_create(&pl->reader, NULL, pl_reader, pl) != 0 ||
+        pthread_create(&pl->writer, NULL, pl_writer, pl) != 0)
+        die("pipeline thread");
+    return pl;
+}
+
+/* Copies input into iov, like readv on in_fd. Returns the bytes copied, 0 at end of file,
+or -1 with errno EAGAIN if the reader has nothing yet. The room of the input taken only goes
+back to the reader at pl_flush. */
+int pl_read(pipeline *pl, const struct iovec *iov, int iovcnt) {
+    uint32_t copied = spsc_get(&pl->in, iov, iovcnt);
+    if (copied == 0 && atomic_load(&pl->eof))  // the last input may have come with it
+        copied = spsc_get(&pl->in, iov, iovcnt);
+    if (copied > 0 || atomic_load(&pl->eof))
+        return copied;
+    errno = EAGAIN;
+    return -1;
+}
+
+/* Appends output for the writer, which only sees it after pl_flush.
+If the queue can't take it, hands over what it holds and waits for the writer to make room. */
+void pl_write(pipeline *pl, const uint8_t *data, uint32_t len) {
+    while (spsc_space(&pl->out) < len) {
+        if (spsc_publish(&pl->out))
+            pl_wake(pl->writer_wake);
+        if (!spsc_want_space(&pl->out, len))
+            break;
+        pl_poll(pl->ev->wakefd, POLLIN);  // the writer wakes the event loop
+        uint64_t wakes;
+        read(pl->ev->wakefd, &wakes, sizeof(wakes));
+    }
+    spsc_put(&pl->out, data, len);
+}
+
+/* Returns the bytes of output that can be appended without waiting for the writer. */
+uint32_t pl_space(pipeline *pl) {
+    return spsc_space(&pl->out);
+}
+
+/* Hands the output appended since the last call to the writer, and gives the room of the
+input taken back to the reader, waking them if they wait for it. */
+void pl_flush(pipeline *pl) {
+    if (spsc_publish(&pl->out))
+        pl_wake(pl->writer_wake);
+    if (spsc_release(&pl->in))
+        pl_wake(pl->reader_wake);
+}
+
+/* Asks the reader to wake the event loop once it has input. Returns true if there is input,
+or end of file, already, then there is nothing to wait for. */
+bool pl_want_input(pipeline *pl) {
+    return !spsc_want_data(&pl->in) || atomic_load(&pl->eof);
+}
+
+/* Asks the writer to wake the event loop once it has made more room in the output queue than
+there was when it was last looked at. Returns true if it has already. */
+bool pl_want_space(pipeline *pl) {
+    spsc_queue *q = &pl->out;
+    return !spsc_want_space(q, q->mask + 1 - (q->produced - q->head_seen) + 1);
+}
+
+/* Hands the last output to the writer, and waits for it to write it all and stop.
+The reader stopped already, at the end of file that let the connection close. */
+void pl_finish(pipeline *pl) {
+    pl_flush(pl);
+    atomic_store(&pl->closing, true);
+    pl_wake(pl->writer_wake);
+    pthread_join(pl->writer, NULL);
+    pthread_join(pl->reader, NULL);
+}
@@ -0,0 +1,42 @@
+#ifndef PROJECT_PIPELINE_H_
+#define PROJECT_PIPELINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "spsc.h"
+#include "event.h"
+
+#define PIPELINE_CHUNK 65536    // most bytes moved by one read or write of the I/O threads
+
+/* With -l, the data of a connection is read from in_fd and written to out_fd by threads of their
+own, which hand it to the thread running the protocol through lock free queues. Then a slow
+reader of out_fd or a bursty writer of in_fd only fills or drains a queue, and acks and timers
+keep their pace. The protocol thread takes input and hands over output once per wakeup, and the
+I/O threads move up to PIPELINE_CHUNK per syscall, blocking on their fds and, while their queue
+is empty or full, on an eventfd. */
+typedef struct pipeline {
+    spsc_queue in;          // read from in_fd, to be sent
+    spsc_queue out;         // delivered in order, to be written to out_fd
+    int in_fd;
+    int out_fd;
+    event_loop *ev;         // of the protocol thread, woken when a queue has news for it
+    int reader_wake;        // eventfds the I/O threads sleep on
+    int writer_wake;
+    _Atomic bool eof;       // in_fd reached end of file, after everything before it was published
+    _Atomic bool closing;   // no more output is coming, the writer stops once it wrote it all
+    pthread_t reader;
+    pthread_t writer;
+} pipeline;
+
+pipeline* pl_start(int in_fd, int out_fd, event_loop *ev, uint32_t size);
+int pl_read(pipeline *pl, const struct iovec *iov, int iovcnt);
+void pl_write(pipeline *pl, const uint8_t *data, uint32_t len);
+uint32_t pl_space(pipeline *pl);
+void pl_flush(pipeline *pl);
+bool pl_want_input(pipeline *pl);
+bool pl_want_space(pipeline *pl);
+void pl_finish(pipeline *pl);
+
+#endif  // PROJECT_PIPELINE_H_
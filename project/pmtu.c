@@ -0,0 +1,59 @@
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "pmtu.h"
+
+/* Sets the don't fragment bit on every datagram, and keeps the kernel from fragmenting or
+refusing them by the path MTU it learned from ICMP, which may be filtered anyway, so a probe
+that is too big is lost on the path. Returns false if the kernel doesn't allow it, then probes
+may get through in fragments. */
+bool pmtu_enable(int sockfd) {
+    int mode = IP_PMTUDISC_PROBE;
+    return setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) == 0;
+}
+
+void pmtu_init(pmtu *m, uint32_t size, uint32_t limit) {
+    m->size = size;
+    m->limit = limit;
+    m->probe = 0;
+    m->too_big = limit + 1;
+    m->lost = 0;
+}
+
+/* Returns the size of the next probe to send, the same one again until it is acked or counted as
+too big, or 0 once the search is done. */
+uint32_t pmtu_next(pmtu *m) {
+    if (m->too_big - m->size <= PMTU_STEP) {
+        m->probe = 0;
+        return 0;
+    }
+    if (m->probe == 0)
+        m->probe = m->too_big > m->limit ? m->limit : m->size + (m->too_big - m->size) / 2;
+    return m->probe;
+}
+
+/* Takes the size of an acked probe. Returns true if it is the one being probed,
+then it is the segment size from now on. */
+bool pmtu_acked(pmtu *m, uint32_t size) {
+    if (m->probe == 0 || size != m->probe)
+        return false;
+    m->size = size;
+    m->probe = 0;
+    m->lost = 0;
+    return true;
+}
+
+/* Counts the probe out as lost. After PMTU_PROBES in a row its size counts as too big. */
+void pmtu_lost(pmtu *m) {
+    if (++m->lost < PMTU_PROBES)
+        return;
+    m->too_big = m->probe;
+    m->probe = 0;
+    m->lost = 0;
+}
+
+/* Starts the search over from the limit, since the path may have changed. */
+void pmtu_raise(pmtu *m) {
+    m->too_big = m->limit + 1;
+    m->probe = 0;
+    m->lost = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef PROJECT_PMTU_H_
+#define PROJECT_PMTU_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PMTU_PROBES 3               // probes of a size lost in a row before it counts as too big
+#define PMTU_STEP 32                // the search stops once the largest size carried is this close
+#define PMTU_RAISE_US 600000000     // a search that stopped short of the limit runs again after this long
+
+/* Packetization layer path MTU discovery (DPLPMTUD, RFC 8899) for the segment size.
+Both ends offer the largest segment they take in the syn, and the smaller one is the limit.
+New data always goes in segments of a size the path has carried, MSS to start with.
+A probe for a larger size is a packet of that size padded with zeros, which carries no data and
+is acked on its own, so a probe the path can't carry is lost without a retransmission or a cut
+of the congestion window. The search probes the limit first, which loopback and jumbo frame
+networks carry, then halves the gap between the largest size carried and the smallest one lost,
+until it is under PMTU_STEP. Segments sent already keep their size, so it only ever grows. */
+typedef struct pmtu {
+    uint32_t size;              // largest segment the path carried, new data goes in these
+    uint32_t limit;             // largest segment both ends take
+    uint32_t probe;             // size being probed, 0 if none
+    uint32_t too_big;           // smallest size lost, limit + 1 until one is
+    uint32_t lost;              // probes of this size lost in a row
+} pmtu;
+
+bool pmtu_enable(int sockfd);
+void pmtu_init(pmtu *m, uint32_t size, uint32_t limit);
+uint32_t pmtu_next(pmtu *m);
+bool pmtu_acked(pmtu *m, uint32_t size);
+void pmtu_lost(pmtu *m);
+void pmtu_raise(pmtu *m);
+
+#endif  // PROJECT_PMTU_H_
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rbuf.h"
+
+/* The receive buffer holds the packets that arrived ahead of the next seq expected, up to a number
+of bytes past it, allocated once. Each payload is copied into a ring of bytes at its own seq,
+so packets of any size fit side by side, and the ring never holds more than the window.
+The headers are kept in a ring of slots, one per MSS of the stream: a packet lives in slot
+seq / MSS, so finding, inserting and removing a packet takes one lookup no matter how many
+packets are held. Packets only share a slot if one is shorter than MSS, then the second one
+is dropped like on a full buffer, and the peer resends it later. */
+struct rbuf_t {
+    rb_entry *slots;
+    uint32_t mask;      // slot ring size - 1, the size is a power of two
+    uint32_t size;
+    uint8_t *data;
+    uint32_t data_mask; // data ring size - 1, also a power of two
+    uint32_t capacity;  // bytes past the next seq expected that may be held, at most the data ring size
+    uint64_t last;      // highest seq held, if any
+};
+
+static uint32_t rb_index(rb_handle_t self, uint64_t seq) {
+    return (seq / MSS) & self->mask;
+}
+
+rb_handle_t rb_init(uint32_t bytes) {
+    rb_handle_t self = malloc(sizeof(struct rbuf_t));
+    if (self == NULL)
+        return NULL;
+    uint32_t data_size = bytes > (1u << 31) ? 0 : round_up_pow2(bytes);
+    // the held bytes start anywhere in the slot of the next seq, so they touch one slot more
+    uint32_t size = round_up_pow2(data_size / MSS + 2);
+    self->slots = calloc(size, sizeof(rb_entry));
+    self->data = data_size == 0 ? NULL : malloc(data_size);
+    if (self->slots == NULL || self->data == NULL) {
+        free(self->slots);
+        free(self->data);
+        free(self);
+        return NULL;
+    }
+    self->mask = size - 1;
+    self->size = 0;
+    self->data_mask = data_size - 1;
+    self->capacity = bytes;
+    self->last = 0;
+    return self;
+}
+
+void rb_destroy(rb_handle_t self) {
+    free(self->slots);
+    free(self->data);
+    free(self);
+}
+
+/* Points iov at the payload of a held packet, in two pieces if it wraps around the data ring.
+Returns the number of pieces. The payload stays valid until the next insert. */
+int rb_payload(rb_handle_t self, const rb_entry *e, struct iovec *iov) {
+    uint32_t start = e->seq & self->data_mask;
+    uint32_t first = self->data_mask + 1 - start;
+    iov[0].iov_base = self->data + start;
+    iov[0].iov_len = first < e->length ? first : e->length;
+    iov[1].iov_base = self->data;
+    iov[1].iov_len = e->length - iov[0].iov_len;
+    return iov[1].iov_len > 0 ? 2 : 1;
+}
+
+/* Buffers a packet that arrived ahead of next_seq, copying its payload into the data ring.
+Returns RB_DUPLICATE if it is held already, or RB_NO_ROOM if it ends past the bytes
+the buffer takes, or a short packet holds its slot. */
+rb_result rb_insert(rb_handle_t self, uint64_t next_seq, const packet *pkt) {
+    rb_entry *s = &self->slots[rb_index(self, pkt->seq)];
+    if (s->used && s->seq == pkt->seq)
+        return RB_DUPLICATE;
+    if (pkt->seq + pkt->length - next_seq > self->capacity)
+        return RB_NO_ROOM;
+    if (s->used)  // a short packet shares the slot
+        return RB_NO_ROOM;
+    s->seq = pkt->seq;
+    s->length = pkt->length;
+    s->used = true;
+    struct iovec iov[2];
+    int pieces = rb_payload(self, s, iov);
+    memcpy(iov[0].iov_base, pkt->payload, iov[0].iov_len);
+    if (pieces > 1)
+        memcpy(iov[1].iov_base, pkt->payload + iov[0].iov_len, iov[1].iov_len);
+    if (self->size == 0 || pkt->seq > self->last)
+        self->last = pkt->seq;
+    self->size++;
+    return RB_INSERTED;
+}
+
+/* Removes the packet starting at seq from the buffer and returns it, or NULL if it isn't held.
+The packet and its payload stay valid until the next insert. */
+rb_entry* rb_pop(rb_handle_t self, uint64_t seq) {
+    rb_entry *s = &self->slots[rb_index(self, seq)];
+    if (!s->used || s->seq != seq)
+        return NULL;
+    s->used = false;
+    self->size--;
+    return s;
+}
+
+/* Returns the held packet with the lowest seq in [seq, end), or NULL if there is none.
+Looks at every slot the range covers, so it is meant for ranges of a packet or two. */
+rb_entry* rb_find(rb_handle_t self, uint64_t seq, uint64_t end) {
+    if (self->size == 0 || end <= seq)
+        return NULL;
+    for (uint64_t s = seq / MSS; s <= (end - 1) / MSS && s - seq / MSS <= self->mask; s++) {
+        rb_entry *e = &self->slots[s & self->mask];
+        if (e->used && e->seq >= seq && e->seq < end)
+            return e;
+    }
+    return NULL;
+}
+
+/* Returns the held packet with the lowest seq, or NULL if the buffer is empty. */
+rb_entry* rb_first(rb_handle_t self, uint64_t next_seq) {
+    if (self->size == 0)
+        return NULL;
+    for (uint32_t i = rb_index(self, next_seq);; i = (i + 1) & self->mask)
+        if (self->slots[i].used)
+            return &self->slots[i];
+}
+
+/* Returns the held packet after e in seq order, or NULL if e is the last one. */
+rb_entry* rb_next(rb_handle_t self, const rb_entry *e) {
+    if (e->seq == self->last)
+        return NULL;
+    uint32_t i = e - self->slots;
+    for (i = (i + 1) & self->mask; !self->slots[i].used; i = (i + 1) & self->mask)
+        continue;
+    return &self->slots[i];
+}
+
+uint32_t rb_size(rb_handle_t self) {
+    return self->size;
+}
+
+bool rb_empty(rb_handle_t self) {
+    return self->size == 0;
+}
@@ -0,0 +1,36 @@
+#ifndef PROJECT_RBUF_H_
+#define PROJECT_RBUF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include "utils.h"
+
+typedef struct rbuf_t* rb_handle_t;
+
+/* A packet held in the receive buffer. Only the header fields are kept,
+the payload is in the data ring of the buffer. */
+typedef struct {
+    uint64_t seq;
+    uint16_t length;
+    bool used;
+} rb_entry;
+
+typedef enum {
+    RB_INSERTED,
+    RB_DUPLICATE,   // the packet is held already
+    RB_NO_ROOM,     // the packet ends past the bytes the buffer takes, or a short packet took its slot
+} rb_result;
+
+rb_handle_t rb_init(uint32_t bytes);
+void rb_destroy(rb_handle_t self);
+rb_result rb_insert(rb_handle_t self, uint64_t next_seq, const packet *pkt);
+rb_entry* rb_pop(rb_handle_t self, uint64_t seq);
+rb_entry* rb_find(rb_handle_t self, uint64_t seq, uint64_t end);
+rb_entry* rb_first(rb_handle_t self, uint64_t next_seq);
+rb_entry* rb_next(rb_handle_t self, const rb_entry *e);
+int rb_payload(rb_handle_t self, const rb_entry *e, struct iovec *iov);
+uint32_t rb_size(rb_handle_t self);
+bool rb_empty(rb_handle_t self);
+
+#endif  // PROJECT_RBUF_H_
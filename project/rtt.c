@@ -0,0 +1,49 @@
+#include "rtt.h"
+
+void rtt_init(rtt_estimator *r) {
+    r->srtt = 0;
+    r->rttvar = 0;
+    r->rto = RTO_INIT_US;
+    r->backoff = 0;
+    r->has_sample = false;
+}
+
+/* Folds a round trip time measurement into the estimate (RFC 6298).
+Only pass samples from packets that were sent once (Karn's rule),
+since the ack of a retransmitted packet can't be matched to a transmission. */
+void rtt_sample(rtt_estimator *r, uint64_t rtt) {
+    if (!r->has_sample) {
+        r->srtt = rtt;
+        r->rttvar = rtt / 2;
+        r->has_sample = true;
+    } else {
+        uint64_t err = r->srtt > rtt ? r->srtt - rtt : rtt - r->srtt;
+        r->rttvar = (3 * r->rttvar + err) / 4;  // beta = 1/4
+        r->srtt = (7 * r->srtt + rtt) / 8;      // alpha = 1/8
+    }
+    uint64_t var = 4 * r->rttvar;
+    r->rto = r->srtt + (var > RTT_GRANULARITY_US ? var : RTT_GRANULARITY_US);
+    if (r->rto < RTO_MIN_US)
+        r->rto = RTO_MIN_US;
+    if (r->rto > RTO_MAX_US)
+        r->rto = RTO_MAX_US;
+}
+
+/* Doubles the timeout after it expires. */
+void rtt_backoff(rtt_estimator *r) {
+    if (rtt_timeout(r) < RTO_MAX_US)
+        r->backoff++;
+}
+
+/* Drops the backoff once new data is acked, since the path is delivering again.
+Waiting for a clean sample instead stalls lossy transfers, where almost every ack
+covers a retransmitted packet and Karn's rule discards it. */
+void rtt_reset_backoff(rtt_estimator *r) {
+    r->backoff = 0;
+}
+
+/* Returns the current retransmission timeout in us, including backoff. */
+uint64_t rtt_timeout(const rtt_estimator *r) {
+    uint64_t rto = r->rto << r->backoff;
+    return rto < RTO_MAX_US ? rto : RTO_MAX_US;
+}
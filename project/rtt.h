@@ -0,0 +1,26 @@
+#ifndef PROJECT_RTT_H_
+#define PROJECT_RTT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RTO_INIT_US 1000000    // timeout before the first sample, as in RFC 6298
+#define RTO_MIN_US 50000       // lower bound, keeps clock jitter from firing early
+#define RTO_MAX_US 60000000    // upper bound on the backed off timeout
+#define RTT_GRANULARITY_US 1000
+
+typedef struct rtt_estimator {
+    uint64_t srtt;      // smoothed round trip time in us
+    uint64_t rttvar;    // round trip time variation in us
+    uint64_t rto;       // retransmission timeout from the estimate in us, without backoff
+    uint32_t backoff;   // number of timeouts since data was last acked
+    bool has_sample;
+} rtt_estimator;
+
+void rtt_init(rtt_estimator *r);
+void rtt_sample(rtt_estimator *r, uint64_t rtt);
+void rtt_backoff(rtt_estimator *r);
+void rtt_reset_backoff(rtt_estimator *r);
+uint64_t rtt_timeout(const rtt_estimator *r);
+
+#endif  // PROJECT_RTT_H_
@@ -0,0 +1,84 @@
+#include <string.h>
+#include "sack.h"
+
+/* Collects the out of order packets held in the receive buffer into
+contiguous blocks, lowest first, since those are the holes the sender repairs next.
+Returns the number of blocks, at most SACK_MAX_BLOCKS. */
+int sack_build(rb_handle_t recv_q, uint64_t next_seq, sack_block *blocks) {
+    int n = 0;
+    for (rb_entry *pkt = rb_first(recv_q, next_seq); pkt != NULL; pkt = rb_next(recv_q, pkt)) {
+        if (n > 0 && blocks[n - 1].end == pkt->seq) {
+            blocks[n - 1].end += pkt->length;
+            continue;
+        }
+        if (n == SACK_MAX_BLOCKS)
+            break;
+        blocks[n].start = pkt->seq;
+        blocks[n].end = pkt->seq + pkt->length;
+        n++;
+    }
+    return n;
+}
+
+/* Writes a sack trailer with as many of the blocks as fit in room bytes:
+the count, then the start and end of each block, in 32 bits like the seq numbers on the wire.
+Returns its size, or 0 if there are no blocks or no room. */
+size_t sack_trailer(uint8_t *out, const sack_block *blocks, int n, int room) {
+    if (n > (room - 1) / 8)
+        n = (room - 1) / 8;
+    if (n <= 0)
+        return 0;
+    *out++ = n;
+    for (int i = 0; i < n; i++) {
+        uint32_t wire[2] = {htonl((uint32_t) blocks[i].start), htonl((uint32_t) blocks[i].end)};
+        memcpy(out, wire, sizeof(wire));
+        out += sizeof(wire);
+    }
+    return 1 + 8 * n;
+}
+
+/* Appends the blocks to the packet after its payload, as many as fit, and sets PKT_SACK.
+Clears PKT_SACK if there are no blocks or no room, so that stale blocks are never resent. */
+void sack_encode(packet *pkt, const sack_block *blocks, int n) {
+    if (sack_trailer(pkt->payload + pkt->length, blocks, n, MSS - pkt->length) > 0)
+        pkt->flags |= PKT_SACK;
+    else
+        pkt->flags &= ~PKT_SACK;
+}
+
+/* Reads the blocks appended to a received packet, extending them to 64 bits around its ack.
+Returns the number of blocks. */
+int sack_decode(const packet *pkt, sack_block *blocks) {
+    if (!(pkt->flags & PKT_SACK) || pkt->flags & PKT_SYN || pkt->length >= MSS_MAX)
+        return 0;
+    const uint8_t *in = pkt->payload + pkt->length;
+    int n = *in++;
+    if (n > SACK_MAX_BLOCKS || pkt->length + 1 + 8 * n > MSS_MAX)
+        return 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t wire[2];
+        memcpy(wire, in, sizeof(wire));
+        in += sizeof(wire);
+        blocks[i].start = seq_unwrap(pkt->ack, ntohl(wire[0]));
+        blocks[i].end = seq_unwrap(pkt->ack, ntohl(wire[1]));
+    }
+    return n;
+}
+
+/* Marks the packets in the send buffer that fall inside a block as sacked.
+Only the packets covered by the blocks are visited.
+Returns the number of packets that weren't sacked before. */
+uint32_t sack_mark(sb_handle_t send_q, const sack_block *blocks, int n) {
+    uint32_t sacked = 0;
+    for (int i = 0; i < n; i++) {
+        for (sb_entry *e = sb_find(send_q, blocks[i].start);
+                e != NULL && e->seq + e->length <= blocks[i].end;
+                e = sb_next(send_q, e)) {
+            if (e->seq >= blocks[i].start && !e->sacked) {
+                e->sacked = true;
+                sacked++;
+            }
+        }
+    }
+    return sacked;
+}
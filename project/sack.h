@@ -0,0 +1,25 @@
+#ifndef PROJECT_SACK_H_
+#define PROJECT_SACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "utils.h"
+#include "sbuf.h"
+#include "rbuf.h"
+
+#define SACK_MAX_BLOCKS 4
+#define SACK_MAX_LEN (1 + 8 * SACK_MAX_BLOCKS)  // count byte, then start and end of each block
+#define SACK_DUPTHRESH 3  // packets sacked above a hole before it counts as lost
+
+typedef struct {
+    uint64_t start;  // seq number of the first byte held
+    uint64_t end;    // seq number after the last byte held
+} sack_block;
+
+int sack_build(rb_handle_t recv_q, uint64_t next_seq, sack_block *blocks);
+size_t sack_trailer(uint8_t *out, const sack_block *blocks, int n, int room);
+void sack_encode(packet *pkt, const sack_block *blocks, int n);
+int sack_decode(const packet *pkt, sack_block *blocks);
+uint32_t sack_mark(sb_handle_t send_q, const sack_block *blocks, int n);
+
+#endif  // PROJECT_SACK_H_
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "sbuf.h"
+
+/* The send buffer is a ring of entries, allocated once for the whole window.
+Packets are sent in seq order and acked from the front, so the ring stays sorted by seq.
+Their payloads are read from stdin straight into a second ring of bytes, one after the other,
+and sent from there, so the data is never copied outside the kernel. A read may take in the data
+of several packets at once, which waits past the last payload until they are pushed.
+The bytes of acked packets are only reused after sb_release,
+since sends queued in a batch may still point at them. */
+struct sbuf_t {
+    sb_entry *entries;
+    uint32_t mask;      // ring size - 1, the size is a power of two
+    uint32_t head;      // index of the front entry
+    uint32_t size;
+    uint32_t capacity;  // window in packets, at most the ring size
+    uint8_t *data;
+    uint32_t data_mask; // data ring size - 1, also a power of two
+    uint32_t tail;      // first byte still in use, counted from the start, wraps around
+    uint32_t end;       // byte after the last payload
+    uint32_t read_end;  // byte after the data read ahead of the packets, where the next read goes
+};
+
+/* Makes room for capacity packets, whose payloads take up to bytes. */
+sb_handle_t sb_init(uint32_t capacity, uint32_t bytes) {
+    sb_handle_t self = malloc(sizeof(struct sbuf_t));
+    if (self == NULL)
+        return NULL;
+    uint32_t size = round_up_pow2(capacity);
+    // room for two windows of payloads, since the acked one may wait for a batch to go out
+    uint32_t data_size = bytes > (1u << 30) ? 0 : round_up_pow2(2 * bytes);
+    self->entries = malloc(size * sizeof(sb_entry));
+    self->data = data_size == 0 ? NULL : malloc(data_size);
+    if (self->entries == NULL || self->data == NULL) {
+        free(self->entries);
+        free(self->data);
+        free(self);
+        return NULL;
+    }
+    self->mask = size - 1;
+    self->head = 0;
+    self->size = 0;
+    self->capacity = capacity;
+    self->data_mask = data_size - 1;
+    self->tail = 0;
+    self->end = 0;
+    self->read_end = 0;
+    return self;
+}
+
+void sb_destroy(sb_handle_t self) {
+    free(self->entries);
+    free(self->data);
+    free(self);
+}
+
+/* Points iov at the free space of the data ring where the next read goes, up to max bytes,
+in two pieces if it wraps. Returns the number of pieces. */
+int sb_room(sb_handle_t self, uint32_t max, struct iovec *iov) {
+    if (max > sb_space(self))
+        max = sb_space(self);
+    uint32_t start = self->read_end & self->data_mask;
+    uint32_t first = self->data_mask + 1 - start;
+    iov[0].iov_base = self->data + start;
+    iov[0].iov_len = first < max ? first : max;
+    iov[1].iov_base = self->data;
+    iov[1].iov_len = first < max ? max - first : 0;
+    return iov[1].iov_len > 0 ? 2 : 1;
+}
+
+/* Reads up to max bytes from fd into the free space of the data ring.
+The bytes are the payloads of the next packets pushed. Returns the result of readv. */
+int sb_read(sb_handle_t self, int fd, uint32_t max) {
+    struct iovec iov[2];
+    int n = readv(fd, iov, sb_room(self, max, iov));
+    if (n > 0)
+        self->read_end += n;
+    return n;
+}
+
+/* Adds a packet to the back of the buffer, with the next length bytes read as its payload,
+or the length bytes copied into sb_room if nothing was read ahead.
+Returns its entry, or NULL if the buffer is full. */
+sb_entry* sb_push_back(sb_handle_t self, uint64_t seq, uint16_t length, uint8_t flags) {
+    if (sb_full(self) || length > sb_staged(self) + sb_space(self))
+        return NULL;
+    sb_entry *e = &self->entries[(self->head + self->size) & self->mask];
+    e->seq = seq;
+    e->length = length;
+    e->flags = flags;
+    e->offset = self->end;
+    self->end += length;
+    if ((int32_t) (self->end - self->read_end) > 0)
+        self->read_end = self->end;
+    e->sent_at = 0;
+    e->tx_count = 0;
+    e->sacked = false;
+    self->size++;
+    return e;
+}
+
+/* Points iov at the payload of the entry, in the data ring. Returns the number of pieces, up to 2. */
+int sb_payload(sb_handle_t self, const sb_entry *e, struct iovec *iov) {
+    if (e->length == 0)
+        return 0;
+    uint32_t start = e->offset & self->data_mask;
+    uint32_t first = self->data_mask + 1 - start;
+    iov[0].iov_base = self->data + start;
+    iov[0].iov_len = first < e->length ? first : e->length;
+    if (first >= e->length)
+        return 1;
+    iov[1].iov_base = self->data;
+    iov[1].iov_len = e->length - first;
+    return 2;
+}
+
+/* Removes the front entry. Its payload stays in the data ring until the next sb_release. */
+void sb_pop_front(sb_handle_t self) {
+    if (sb_empty(self))
+        return;
+    self->head = (self->head + 1) & self->mask;
+    self->size--;
+}
+
+/* Frees the payloads of the popped entries for reading new data into.
+Call it only once nothing queued to send points at them. */
+void sb_release(sb_handle_t self) {
+    self->tail = sb_empty(self) ? self->end : self->entries[self->head].offset;
+}
+
+/* Returns the number of bytes free in the data ring. */
+uint32_t sb_space(sb_handle_t self) {
+    return self->data_mask + 1 - (self->read_end - self->tail);
+}
+
+/* Returns the number of bytes read ahead, not pushed as a packet yet. */
+uint32_t sb_staged(sb_handle_t self) {
+    return self->read_end - self->end;
+}
+
+sb_entry* sb_front(sb_handle_t self) {
+    return sb_empty(self) ? NULL : &self->entries[self->head];
+}
+
+/* Returns the entry after e in the buffer, or NULL if e is the last one. */
+sb_entry* sb_next(sb_handle_t self, const sb_entry *e) {
+    uint32_t index = e - self->entries;
+    if (((index - self->head) & self->mask) + 1 >= self->size)
+        return NULL;
+    return &self->entries[(index + 1) & self->mask];
+}
+
+/* Returns the first entry that holds data at or after seq, or NULL if there is none.
+Binary search, since the entries are sorted by seq. */
+sb_entry* sb_find(sb_handle_t self, uint64_t seq) {
+    uint32_t lo = 0, hi = self->size;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        sb_entry *e = &self->entries[(self->head + mid) & self->mask];
+        if (e->seq + e->length <= seq)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo == self->size ? NULL : &self->entries[(self->head + lo) & self->mask];
+}
+
+uint32_t sb_size(sb_handle_t self) {
+    return self->size;
+}
+
+bool sb_full(sb_handle_t self) {
+    return self->size >= self->capacity;
+}
+
+bool sb_empty(sb_handle_t self) {
+    return self->size == 0;
+}
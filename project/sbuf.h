@@ -0,0 +1,40 @@
+#ifndef PROJECT_SBUF_H_
+#define PROJECT_SBUF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include "utils.h"
+
+typedef struct sbuf_t* sb_handle_t;
+
+/* A packet waiting for its ack. Only the header fields are kept,
+the payload stays in the data ring of the buffer. */
+typedef struct {
+    uint64_t seq;
+    uint16_t length;
+    uint8_t flags;
+    uint32_t offset;    // position of the payload in the data ring
+    uint64_t sent_at;   // monotonic time of the last transmission in us
+    uint32_t tx_count;  // number of times the packet has been sent
+    bool sacked;        // the receiver has reported holding the packet
+} sb_entry;
+
+sb_handle_t sb_init(uint32_t capacity, uint32_t bytes);
+void sb_destroy(sb_handle_t self);
+int sb_room(sb_handle_t self, uint32_t max, struct iovec *iov);
+int sb_read(sb_handle_t self, int fd, uint32_t max);
+sb_entry* sb_push_back(sb_handle_t self, uint64_t seq, uint16_t length, uint8_t flags);
+int sb_payload(sb_handle_t self, const sb_entry *e, struct iovec *iov);
+void sb_pop_front(sb_handle_t self);
+void sb_release(sb_handle_t self);
+uint32_t sb_space(sb_handle_t self);
+uint32_t sb_staged(sb_handle_t self);
+sb_entry* sb_front(sb_handle_t self);
+sb_entry* sb_next(sb_handle_t self, const sb_entry *e);
+sb_entry* sb_find(sb_handle_t self, uint64_t seq);
+uint32_t sb_size(sb_handle_t self);
+bool sb_full(sb_handle_t self);
+bool sb_empty(sb_handle_t self);
+
+#endif  // PROJECT_SBUF_H_
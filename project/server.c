@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <string.h>
@@ -7,10 +8,17 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdbool.h>
-#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
 #include "utils.h"
-#include "deque.h"
 #include "common.h"
+#include "conn.h"
+#include "steer.h"
+
+#define CONN_IDLE_TIMEOUT 30000000  // us without a packet before a peer is dropped, with -m
+
+static cookie_key key;  // makes the fast open cookies, shared by the worker threads
 
 
 static int construct_serveraddr(struct sockaddr_in *servaddr,
@@ -31,10 +39,13 @@ static int construct_serveraddr(struct sockaddr_in *servaddr,
 }
 
 
-static void bind_socket(int sockfd, int argc, char *argv[]) {
+static void bind_socket(int sockfd, int argc, char *argv[], bool reuseport) {
     // Construct the address
     struct sockaddr_in servaddr;
     construct_serveraddr(&servaddr, argc, argv);
+    int one = 1;  // worker threads each bind a socket to the port
+    if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+        die("reuseport");
     int did_bind = bind(sockfd, (struct sockaddr*) &servaddr,
                         sizeof(servaddr));
     // Error if did_bind < 0 :(
@@ -42,51 +53,434 @@ static void bind_socket(int sockfd, int argc, char *argv[]) {
 }
 
 
-int main(int argc, char *argv[]) {
-    // Seed the random number generator
-    srand(2);
+struct pool;
 
-    params p;
-    p_init(&p, 20, argc, argv, NULL);
+/* Every connection of the server, on one socket.
+Without -m there is a single one, which sends stdin and receives to stdout like before.
+With -m each peer gets its own, whose data goes to a file or is discarded,
+and peers that went quiet are dropped to make room for new ones.
+With -n there is one per worker thread, and its connections are only touched by that thread. */
+typedef struct server {
+    endpoint ep;
+    conn_table table;
+    conn **touched;         // connections handled since the last flush
+    uint32_t ntouched;
+    conn *stdio;            // the connection on stdin and stdout, without -m
+    int discard_fd;         // /dev/null, for peers whose data isn't kept
+    uint32_t id;            // worker thread, 0 without them
+    struct pool *pool;      // NULL without worker threads
+    pthread_t thread;
+    _Atomic uint64_t load[STEER_BUCKETS];  // packets received per bucket, read by the balancer
+    conn *inbox;            // connections handed over by other workers, guarded by the pool lock
+} server;
 
-    stdin_nonblock();  // Make stdin nonblocking
-    bind_socket(p.sockfd, argc, argv);  // Bind to 0.0.0.0
+/* Worker threads, and the steering of flows between them. */
+typedef struct pool {
+    server *workers;
+    uint32_t count;
+    pthread_mutex_t lock;           // guards owner and the inboxes
+    uint8_t owner[STEER_BUCKETS];   // the worker the program steers each bucket to
+    bool steered;                   // the program is attached, flows can be moved
+} pool;
 
-    for (;;) {  // listen for syn packet
-        if (recv_packet(p.sockfd, &p.addr, &p.pkt_recv) <= 0)
-            continue;
-        if (p.pkt_recv.flags & PKT_SYN) {
-            p.recv_seq = p.pkt_recv.seq + 1;
-            p.pkt_send.seq = p.send_seq;
-            p.pkt_send.ack = p.recv_seq;
-            p.pkt_send.flags = PKT_ACK | PKT_SYN;
-            p_send_and_enqueue_pkt_send(&p);
-            p.send_seq++;
-            p.before = clock();
-            break;
+/* Remembers that a connection was handled, so it catches up after the next flush. */
+static void s_touch(server *s, conn *c) {
+    if (!c->touched) {
+        c->touched = true;
+        s->touched[s->ntouched++] = c;
+    }
+}
+
+/* Opens where the data of a new peer goes. */
+static int s_open_output(server *s, const conn *c) {
+    const options *opt = s->ep.opt;
+    if (opt->connections == 0)
+        return STDOUT_FILENO;
+    if (opt->out_dir == NULL)
+        return s->discard_fd;
+    char path[512];
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &c->p.addr.sin_addr, address, sizeof(address));
+    snprintf(path, sizeof(path), "%s/%s-%u", opt->out_dir, address, ntohs(c->p.addr.sin_port));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) die(path);
+    return fd;
+}
+
+static void s_close(server *s, conn *c);
+
+/* Drops the peer if it sent nothing for CONN_IDLE_TIMEOUT, or waits for that to happen.
+The timer isn't moved on every packet, it finds out when it fires. */
+static void s_on_idle(timer *t) {
+    conn *c = container_of(t, conn, idle);
+    endpoint *ep = &c->server->ep;
+    if (now_us() - c->last_heard < CONN_IDLE_TIMEOUT) {
+        wheel_arm(&ep->wheel, &c->idle, c->last_heard + CONN_IDLE_TIMEOUT);
+        return;
+    }
+    ep_flush(ep);  // nothing may point into its buffers
+    s_close(c->server, c);
+}
+
+/* Lingers a connection of -m that closed, like p_linger, then writes out the rest of its data
+and drops it. */
+static void s_on_linger(timer *t) {
+    conn *c = container_of(t, conn, p.linger);
+    server *s = c->server;
+    if (p_linger(&c->p))
+        return;
+    p_finish(&c->p, c->label, s->pool != NULL ? (int) s->id : -1);  // flushes, nothing points into its buffers
+    s_close(s, c);
+}
+
+/* Starts a connection for the peer that sent the syn being handled, and sends the syn ack.
+A syn that asks for a fast open cookie gets one in the syn ack, and the data of a syn with
+a valid one is taken at once, so the syn ack acks it too.
+Returns NULL if there are as many connections as allowed already. */
+static conn* s_accept(server *s) {
+    endpoint *ep = &s->ep;
+    if (s->table.size == s->table.capacity)
+        return NULL;
+    conn *c = malloc(sizeof(conn));
+    if (c == NULL)
+        die("connection malloc failed");
+    bool stdio = ep->opt->connections == 0;
+    c->p.addr = ep->from;
+    c->bucket = steer_bucket(&ep->from);
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &ep->from.sin_addr, address, sizeof(address));
+    snprintf(c->label, sizeof(c->label), "%s:%u", address, ntohs(ep->from.sin_port));
+    p_init(&c->p, ep, stdio ? STDIN_FILENO : -1, s_open_output(s, c));
+    if (stdio && ep->opt->pipeline)
+        p_start_pipeline(&c->p);
+    c->state = CONN_SYN_RECEIVED;
+    c->touched = false;
+    c->server = s;
+    c->last_heard = now_us();
+    timer_init(&c->idle, s_on_idle);
+    if (!stdio) {
+        wheel_arm(&ep->wheel, &c->idle, c->last_heard + CONN_IDLE_TIMEOUT);
+        timer_init(&c->p.linger, s_on_linger);  // the server drops it once the linger ran out
+    }
+    ct_insert(&s->table, c);
+    if (stdio)
+        s->stdio = c;
+
+    params *p = &c->p;
+    packet *syn = p->pkt_recv;
+    p->recv_seq = syn->seq + 1;
+    p_negotiate(p);
+    if (syn->ack != 0) {  // the ack field of a syn is the client's cookie
+        p->cookie = cookie_make(&key, &ep->from);
+        uint16_t data = wire_syn_data(syn);
+        if (syn->ack == p->cookie && data > 0) {
+            syn->seq++;
+            syn->length = data;
+            p_handle_data_packet(p);
+            p->stats.syn_data += data;
         }
     }
+    p_send_and_enqueue(p, 0, PKT_ACK | PKT_SYN | (p->sack ? PKT_SACK : 0) | (p->compact ? PKT_COMPACT : 0) |
+                             (p->seq64 ? PKT_SEQ64 : 0) | (p->fec ? PKT_FEC : 0) |
+                             (p->pmtu.limit > MSS ? PKT_MSS : 0) | (p->flow ? PKT_WINDOW : 0));
+    p->send_seq++;
+    return c;
+}
+
+/* Drops a connection. Its queued sends must have been flushed. */
+static void s_close(server *s, conn *c) {
+    ct_remove(&s->table, c);
+    wheel_cancel(&s->ep.wheel, &c->idle);
+    if (c->p.out_fd != STDOUT_FILENO && c->p.out_fd != s->discard_fd)
+        close(c->p.out_fd);
+    p_destroy(&c->p);
+    free(c);
+}
+
+/* Handles a packet for a connection waiting for the ack of its syn ack, which may have payload. */
+static void s_handshake(conn *c) {
+    params *p = &c->p;
+    if (p->pkt_recv->flags & PKT_FEC)  // parity of data that overtook the syn ack ack, not needed
+        return;
+    // the syn ack ack is the first packet at the seq after the syn, empty or with the first data.
+    // Anything else, like data or a fin that overtook it, waits for the peer to send it again
+    if (p->pkt_recv->flags & PKT_ACK && !(p->pkt_recv->flags & PKT_FIN) && p->pkt_recv->seq == p->recv_seq) {
+        if (p_clear_acked_packets_from_sbuf(p))
+            p_restart_timer(p);
+        if (p->pkt_recv->length == 0) {  // incoming zero length syn ack ack
+            p->recv_seq++;
+        } else {
+            p_handle_data_packet(p);
+            p_send_payload_ack(p);
+        }
+        c->state = CONN_ESTABLISHED;
+        p_established(p);
+    } else {
+        p_retransmit_front(p, TR_SEND);
+    }
+}
+
+/* Hands the received packet to the connection of its sender.
+A syn from a new peer starts a connection, anything else from an unknown peer is dropped,
+and so are stale packets, which don't count as hearing from the peer. */
+static void s_dispatch(server *s) {
+    endpoint *ep = &s->ep;
+    conn *c = ct_find(&s->table, &ep->from);
+    if (c == NULL) {
+        if (!(ep->pkt_recv.flags & PKT_SYN) || (c = s_accept(s)) == NULL)
+            return;
+    } else if (!p_unwrap(&c->p)) {
+        c->p.stats.pkts_recv++;
+        return;
+    } else if (c->state == CONN_SYN_RECEIVED) {
+        s_handshake(c);
+    } else {
+        p_handle_packet(&c->p);
+    }
+    c->p.stats.pkts_recv++;
+    c->last_heard = now_us();
+    s_touch(s, c);
+    if (s->pool != NULL) {  // only this thread writes its counts
+        uint64_t count = atomic_load_explicit(&s->load[c->bucket], memory_order_relaxed);
+        atomic_store_explicit(&s->load[c->bucket], count + 1, memory_order_relaxed);
+    }
+}
 
-    for (;;) {  // listen for syn ack ack packet, may have payload
-        p_retransmit_on_timeout(&p);
-        if (recv_packet(p.sockfd, &p.addr, &p.pkt_recv) <= 0)
+/* Called when woken by another thread. Hands the connections whose bucket the balancer moved
+to their new worker, and takes the ones handed to this worker.
+Packets that arrive for a connection in between are dropped, and the peer sends them again. */
+static void s_handover(server *s) {
+    pool *pool = s->pool;
+    ep_flush(&s->ep);  // nothing may point into the buffers of a connection that leaves
+    pthread_mutex_lock(&pool->lock);
+    for (uint32_t i = 0; i < s->table.size;) {
+        conn *c = s->table.list[i];
+        server *owner = &pool->workers[pool->owner[c->bucket]];
+        if (owner == s) {
+            i++;
             continue;
-        if (p.pkt_recv.flags & PKT_ACK &&
-            (p.pkt_recv.seq == p.recv_seq || p.pkt_recv.length == 0)) {
-            // syn ack ack packet, may have payload
-            if (p_clear_acked_packets_from_sbuf(&p))
-                p.before = clock();
-            if (p.pkt_recv.length == 0) {  // incoming zero length syn ack ack
-                p.recv_seq++;
+        }
+        ct_remove(&s->table, c);  // the last connection of the list takes its place
+        p_detach(&c->p);
+        wheel_cancel(&s->ep.wheel, &c->idle);
+        c->next = owner->inbox;
+        owner->inbox = c;
+        ev_wake(&owner->ep.ev);
+    }
+    conn *inbox = s->inbox;
+    s->inbox = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (conn *c = inbox, *next; c != NULL; c = next) {
+        next = c->next;
+        p_move(&c->p, &s->ep);
+        c->server = s;
+        wheel_arm(&s->ep.wheel, &c->idle, c->last_heard + CONN_IDLE_TIMEOUT);
+        // a syn sent again while the connection moved opened a second one here
+        conn *dup = ct_find(&s->table, &c->p.addr);
+        if (dup != NULL)
+            s_close(s, dup);
+        if (!ct_insert(&s->table, c))
+            s_close(s, c);
+    }
+}
+
+static uint64_t earliest(uint64_t a, uint64_t b) {
+    return a == 0 || (b != 0 && b < a) ? b : a;
+}
+
+/* Blocks until the socket, stdin or a timer needs attention, like p_wait for every connection.
+The packets queued by all connections go out in one flush, then the connections handled since
+the last one catch up. The retransmission, keepalive, linger and idle timers of every connection
+are on the wheel of the endpoint, so the wait only asks it for the next one, and fires
+the ones that expired before returning. */
+static int s_wait(server *s) {
+    endpoint *ep = &s->ep;
+    uint64_t now = now_us();
+    int due = stats_poll(&ep->emitter, now);
+    for (uint32_t i = 0; due && i < s->table.size; i++)
+        stats_write(&ep->emitter, &s->table.list[i]->p.stats, due, now, s->table.list[i]->label,
+                    s->pool != NULL ? (int) s->id : -1);
+    ep_flush(ep);
+    for (uint32_t i = 0; i < s->ntouched; i++) {
+        conn *c = s->touched[i];
+        c->touched = false;
+        p_sync(&c->p);  // files and /dev/null take everything
+    }
+    s->ntouched = 0;
+    bool flushed = s->stdio == NULL || p_sync(&s->stdio->p);
+    ep_flush(ep);  // window updates
+    if (ep_pending(ep))
+        return EV_SOCKET;
+    if (s->stdio != NULL) {
+        int ready = p_watch_io(&s->stdio->p, s->stdio->state == CONN_ESTABLISHED, flushed);
+        if (ready)
+            return ready;
+    }
+
+    // the timer also wakes the stats emitter
+    ev_set_deadline(&ep->ev, earliest(stats_deadline(&ep->emitter), wheel_next(&ep->wheel)));
+    int events = ev_wait(&ep->ev);
+    if (events & EV_TIMER)
+        wheel_advance(&ep->wheel, now_us());
+    if (events & EV_WAKE && s->pool == NULL) {  // from the I/O threads of -l
+        events &= ~EV_WAKE;
+        if (s->stdio->state == CONN_ESTABLISHED)
+            events |= EV_STDIN;
+    }
+    return events;
+}
+
+/* Sets up a server on its own socket, worker id of the pool if there is one. */
+static void s_init(server *s, const options *opt, uint32_t id, pool *pool) {
+    ep_init(&s->ep, opt);
+    uint32_t capacity = opt->connections != 0 ? opt->connections : 1;
+    ct_init(&s->table, capacity);
+    s->touched = malloc(capacity * sizeof(conn*));
+    if (s->touched == NULL)
+        die("server initialization malloc failed");
+    s->ntouched = 0;
+    s->stdio = NULL;
+    s->discard_fd = open("/dev/null", O_WRONLY);
+    if (s->discard_fd < 0) die("/dev/null");
+    s->id = id;
+    s->pool = pool;
+    for (uint32_t b = 0; b < STEER_BUCKETS; b++)
+        atomic_init(&s->load[b], 0);
+    s->inbox = NULL;
+    if (pool != NULL)
+        ev_enable_wake(&s->ep.ev);
+}
+
+/* Serves the peers of a server, forever with -m, else until the connection on stdin and stdout
+closed. */
+static void* s_run(void *arg) {
+    server *s = arg;
+    while (s->stdio == NULL || !p_closed(&s->stdio->p)) {
+        int events = s_wait(s);
+        if (events & EV_WAKE)  // first, nothing was handled since the flush in s_wait
+            s_handover(s);
+        if (events & EV_SOCKET) {
+            while (ep_recv(&s->ep))
+                s_dispatch(s);
+        }
+        if (events & EV_STDIN) {
+            while (p_send_payload_ack(&s->stdio->p))
+                continue;
+        }
+    }
+    p_finish(&s->stdio->p, s->stdio->label, -1);
+    return NULL;
+}
+
+/* Every STEER_INTERVAL, moves buckets from busy workers to idle ones, using the packets
+each bucket received since the last time, and wakes the workers that lost buckets
+so that they hand the connections over. */
+static void s_balance(pool *pool) {
+    uint64_t seen[STEER_BUCKETS] = {0};
+    for (;;) {
+        usleep(STEER_INTERVAL);
+        uint64_t load[STEER_BUCKETS];
+        for (uint32_t b = 0; b < STEER_BUCKETS; b++) {
+            uint64_t count = 0;
+            for (uint32_t w = 0; w < pool->count; w++)
+                count += atomic_load_explicit(&pool->workers[w].load[b], memory_order_relaxed);
+            load[b] = count - seen[b];
+            seen[b] = count;
+        }
+        pthread_mutex_lock(&pool->lock);
+        uint8_t before[STEER_BUCKETS];
+        memcpy(before, pool->owner, sizeof(before));
+        if (steer_rebalance(pool->owner, load, pool->count) > 0) {
+            if (steer_attach(pool->workers[0].ep.sockfd, pool->owner)) {
+                for (uint32_t b = 0; b < STEER_BUCKETS; b++) {
+                    if (pool->owner[b] != before[b])
+                        ev_wake(&pool->workers[before[b]].ep.ev);
+                }
             } else {
-                p_handle_data_packet(&p);
-                p_send_payload_ack(&p);
+                memcpy(pool->owner, before, sizeof(before));
             }
-            break;
-        } else {
-            send_packet(p.sockfd, &p.addr, q_front(p.send_q), "SEND");
         }
+        pthread_mutex_unlock(&pool->lock);
     }
+}
 
-    p_listen(&p);
+/* Returns the nth cpu this process may run on, counting around if there are fewer. */
+static int nth_cpu(const cpu_set_t *allowed, uint32_t n) {
+    n %= CPU_COUNT(allowed);
+    for (int cpu = 0;; cpu++) {
+        if (CPU_ISSET(cpu, allowed) && n-- == 0)
+            return cpu;
+    }
+}
+
+/* Starts a worker thread per -n, each pinned to its own core while there are enough,
+with its own socket on the port. Then steers the flows between them from this thread,
+or leaves the spreading to the kernel if it can't. */
+static void s_run_pool(const options *opt, int argc, char *argv[]) {
+    pool pool;
+    pool.count = opt->threads;
+    pool.workers = calloc(pool.count, sizeof(server));
+    if (pool.workers == NULL)
+        die("worker malloc failed");
+    pthread_mutex_init(&pool.lock, NULL);
+    steer_spread(pool.owner, pool.count);
+    for (uint32_t w = 0; w < pool.count; w++) {
+        s_init(&pool.workers[w], opt, w, &pool);
+        bind_socket(pool.workers[w].ep.sockfd, argc, argv, true);
+    }
+    // the program returns the index of a socket in the order they were bound
+    pool.steered = steer_attach(pool.workers[0].ep.sockfd, pool.owner);
+
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (uint32_t w = 0; w < pool.count; w++) {
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(nth_cpu(&allowed, w), &pinned);
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(pinned), &pinned);
+        if (pthread_create(&pool.workers[w].thread, &attr, s_run, &pool.workers[w]) != 0)
+            die("worker thread");
+        pthread_attr_destroy(&attr);
+    }
+
+    if (pool.steered)
+        s_balance(&pool);
+    pthread_join(pool.workers[0].thread, NULL);
+}
+
+int main(int argc, char *argv[]) {
+    // Seed the random number generator
+    srand(2);
+
+    options opt;
+    opt_parse(&opt, &argc, &argv, "[port]");
+    if (opt.cookie_file != NULL)
+        cookie_key_load(&key, opt.cookie_file);
+    else
+        cookie_key_init(&key);
+    if (opt.threads > 1 && opt.connections == 0) {
+        fprintf(stderr, "%s: -n needs -m, stdin and stdout can't be shared between threads\n", argv[0]);
+        return 1;
+    }
+    if (opt.threads > 1) {
+        s_run_pool(&opt, argc, argv);
+        return 0;
+    }
+
+    server s;
+    s_init(&s, &opt, 0, NULL);
+    if (opt.pipeline && opt.connections != 0) {
+        fprintf(stderr, "%s: -l needs stdin and stdout, it can't be used with -m\n", argv[0]);
+        return 1;
+    }
+    if (opt.connections == 0 && !opt.pipeline) {
+        stdin_nonblock();  // Make stdin nonblocking
+        stdout_nonblock();
+    }
+    bind_socket(s.ep.sockfd, argc, argv, false);  // Bind to 0.0.0.0
+    s_run(&s);
+    return 0;
 }
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "spsc.h"
+
+/* Allocates a ring of at least size bytes. Returns false if it is too large or malloc fails. */
+bool spsc_init(spsc_queue *q, uint32_t size) {
+    if (size > (1u << 30))
+        return false;
+    size = round_up_pow2(size);
+    q->data = malloc(size);
+    if (q->data == NULL)
+        return false;
+    q->mask = size - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    q->produced = 0;
+    q->consumed = 0;
+    q->head_seen = 0;
+    q->tail_seen = 0;
+    atomic_init(&q->producer_waiting, false);
+    atomic_init(&q->consumer_waiting, false);
+    return true;
+}
+
+void spsc_destroy(spsc_queue *q) {
+    free(q->data);
+}
+
+/* Points iov at len bytes of the ring from position start, in up to 2 pieces.
+Returns the number of pieces. */
+static int spsc_iov(spsc_queue *q, uint32_t start, uint32_t len, struct iovec *iov) {
+    uint32_t offset = start & q->mask;
+    uint32_t first = q->mask + 1 - offset;
+    iov[0].iov_base = q->data + offset;
+    iov[0].iov_len = first < len ? first : len;
+    iov[1].iov_base = q->data;
+    iov[1].iov_len = first < len ? len - first : 0;
+    return iov[1].iov_len > 0 ? 2 : 1;
+}
+
+/* Producer: returns the bytes that can be appended, reading the consumer's head again. */
+uint32_t spsc_space(spsc_queue *q) {
+    q->head_seen = atomic_load_explicit(&q->head, memory_order_acquire);
+    return q->mask + 1 - (q->produced - q->head_seen);
+}
+
+/* Producer: points iov at the free bytes after the back of the ring, up to max,
+for a read to fill them before spsc_push. The consumer's head is only read again
+if the last one seen leaves less than max. Returns the number of pieces, 0 if the ring is full. */
+int spsc_free(spsc_queue *q, uint32_t max, struct iovec *iov) {
+    uint32_t space = q->mask + 1 - (q->produced - q->head_seen);
+    if (space < max)
+        space = spsc_space(q);
+    if (space == 0)
+        return 0;
+    return spsc_iov(q, q->produced, space < max ? space : max, iov);
+}
+
+/* Producer: appends the len bytes written where spsc_free pointed. They stay invisible to
+the consumer until spsc_publish. */
+void spsc_push(spsc_queue *q, uint32_t len) {
+    q->produced += len;
+}
+
+/* Producer: copies len bytes to the back of the ring, which must have room for them. */
+void spsc_put(spsc_queue *q, const uint8_t *data, uint32_t len) {
+    struct iovec iov[2];
+    spsc_iov(q, q->produced, len, iov);
+    memcpy(iov[0].iov_base, data, iov[0].iov_len);
+    memcpy(iov[1].iov_base, data + iov[0].iov_len, iov[1].iov_len);
+    q->produced += len;
+}
+
+/* Producer: makes everything appended so far visible to the consumer.
+Returns true if the consumer said it was waiting, then the caller must wake it. */
+bool spsc_publish(spsc_queue *q) {
+    if (atomic_load_explicit(&q->tail, memory_order_relaxed) == q->produced)
+        return false;
+    atomic_store(&q->tail, q->produced);
+    return atomic_exchange(&q->consumer_waiting, false);
+}
+
+/* Producer: says it waits for room for len bytes, so the consumer's next release returns true.
+Returns false if the room is there already, then it shouldn't wait. */
+bool spsc_want_space(spsc_queue *q, uint32_t len) {
+    atomic_store(&q->producer_waiting, true);
+    q->head_seen = atomic_load(&q->head);
+    return q->mask + 1 - (q->produced - q->head_seen) < len;
+}
+
+/* Consumer: returns the bytes published and not taken yet, reading the producer's tail again. */
+uint32_t spsc_avail(spsc_queue *q) {
+    q->tail_seen = atomic_load_explicit(&q->tail, memory_order_acquire);
+    return q->tail_seen - q->consumed;
+}
+
+/* Consumer: points iov at the bytes at the front of the ring, up to max, for spsc_pop once
+they are used. The producer's tail is only read again if the last one seen shows less than max.
+Returns the number of pieces, 0 if the ring is empty. */
+int spsc_peek(spsc_queue *q, uint32_t max, struct iovec *iov) {
+    uint32_t avail = q->tail_seen - q->consumed;
+    if (avail < max)
+        avail = spsc_avail(q);
+    if (avail == 0)
+        return 0;
+    return spsc_iov(q, q->consumed, avail < max ? avail : max, iov);
+}
+
+/* Consumer: takes len bytes off the front. Their room goes back to the producer at spsc_release. */
+void spsc_pop(spsc_queue *q, uint32_t len) {
+    q->consumed += len;
+}
+
+/* Consumer: copies as many bytes from the front as iov holds, and takes them off.
+Returns the number of bytes copied. */
+uint32_t spsc_get(spsc_queue *q, const struct iovec *iov, int iovcnt) {
+    uint32_t copied = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        struct iovec src[2];
+        uint32_t len = 0;
+        for (int j = 0, n = spsc_peek(q, iov[i].iov_len, src); j < n; j++) {
+            memcpy((uint8_t*) iov[i].iov_base + len, src[j].iov_base, src[j].iov_len);
+            len += src[j].iov_len;
+        }
+        spsc_pop(q, len);
+        copied += len;
+        if (len < iov[i].iov_len)
+            break;
+    }
+    return copied;
+}
+
+/* Consumer: gives the room of everything taken so far back to the producer.
+Returns true if the producer said it was waiting, then the caller must wake it. */
+bool spsc_release(spsc_queue *q) {
+    if (atomic_load_explicit(&q->head, memory_order_relaxed) == q->consumed)
+        return false;
+    atomic_store(&q->head, q->consumed);
+    return atomic_exchange(&q->producer_waiting, false);
+}
+
+/* Consumer: says it waits for data, so the producer's next publish returns true.
+Returns false if there is data already, then it shouldn't wait. */
+bool spsc_want_data(spsc_queue *q) {
+    atomic_store(&q->consumer_waiting, true);
+    q->tail_seen = atomic_load(&q->tail);
+    return q->tail_seen == q->consumed;
+}
@@ -0,0 +1,47 @@
+#ifndef PROJECT_SPSC_H_
+#define PROJECT_SPSC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#define CACHE_LINE 64
+
+/* A ring of bytes between two threads, one that appends and one that takes from the front,
+without locks. Each side works on its own copy of its index and publishes it in one store
+for a whole batch, and keeps the last index it saw of the other side, so the shared cache lines
+only move between cores once per batch. The fields of each side are on their own cache line.
+A side that finds nothing to do says it is waiting, and the other side's next publish tells
+its caller to wake it. */
+typedef struct spsc_queue {
+    _Alignas(CACHE_LINE) _Atomic uint32_t tail;    // published by the producer
+    uint32_t produced;          // the producer's tail, ahead of the published one
+    uint32_t head_seen;         // the last head the producer read
+    _Atomic bool producer_waiting;
+    _Alignas(CACHE_LINE) _Atomic uint32_t head;    // published by the consumer
+    uint32_t consumed;          // the consumer's head, ahead of the published one
+    uint32_t tail_seen;         // the last tail the consumer read
+    _Atomic bool consumer_waiting;
+    _Alignas(CACHE_LINE) uint8_t *data;
+    uint32_t mask;              // ring size - 1, the size is a power of two
+} spsc_queue;
+
+bool spsc_init(spsc_queue *q, uint32_t size);
+void spsc_destroy(spsc_queue *q);
+
+uint32_t spsc_space(spsc_queue *q);
+int spsc_free(spsc_queue *q, uint32_t max, struct iovec *iov);
+void spsc_push(spsc_queue *q, uint32_t len);
+void spsc_put(spsc_queue *q, const uint8_t *data, uint32_t len);
+bool spsc_publish(spsc_queue *q);
+bool spsc_want_space(spsc_queue *q, uint32_t len);
+
+uint32_t spsc_avail(spsc_queue *q);
+int spsc_peek(spsc_queue *q, uint32_t max, struct iovec *iov);
+void spsc_pop(spsc_queue *q, uint32_t len);
+uint32_t spsc_get(spsc_queue *q, const struct iovec *iov, int iovcnt);
+bool spsc_release(spsc_queue *q);
+bool spsc_want_data(spsc_queue *q);
+
+#endif  // PROJECT_SPSC_H_
@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "utils.h"
+#include "stats.h"
+
+#define UNIX_PREFIX "unix:"
+
+static _Atomic uint32_t dump_requests;  // SIGUSR1 received, every emitter answers each one
+
+static void on_dump_signal(int sig) {
+    (void) sig;
+    atomic_fetch_add_explicit(&dump_requests, 1, memory_order_relaxed);
+}
+
+/* Connects the emitter socket to the Unix datagram socket at path.
+Returns false if nobody is listening there yet. */
+static bool connect_unix(int fd, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    return connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+}
+
+/* Starts counting for a new connection. */
+void stats_init(stats *s) {
+    memset(s, 0, sizeof(*s));
+    s->start = now_us();
+}
+
+/* If target is set, a JSON line per connection goes there every interval_ms:
+appended to a file, or sent as a datagram to the Unix socket at unix:<path>.
+SIGUSR1 writes the same lines to stderr. The signal only sets a flag, the lines are
+written once the event loop wakes up and stats_poll says they are due. */
+void stats_emitter_init(stats_emitter *e, const char *target, uint32_t interval_ms) {
+    e->fd = -1;
+    e->dumps = atomic_load_explicit(&dump_requests, memory_order_relaxed);
+    e->target = target;
+    e->interval = (uint64_t) interval_ms * 1000;
+    e->next_emit = now_us() + e->interval;
+    if (target != NULL && strncmp(target, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+        e->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (e->fd < 0) die("stats socket");
+    } else if (target != NULL) {
+        e->fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK, 0644);
+        if (e->fd < 0) die(target);
+    }
+    struct sigaction sa = {0};
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = on_dump_signal;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* Counts bytes written out in order, and samples the goodput once a slice has passed. */
+void stats_delivered(stats *s, uint32_t bytes, uint64_t now) {
+    s->bytes_delivered += bytes;
+    if (s->slice_start == 0) {
+        s->slice_start = now;
+    } else if (now - s->slice_start >= STATS_SLICE) {
+        hist_add(&s->goodput, s->slice_bytes * 1000 / (now - s->slice_start));
+        s->slice_start = now;
+        s->slice_bytes = 0;
+    }
+    s->slice_bytes += bytes;
+}
+
+/* Returns when the next line is due, or 0 if there is no emitter. */
+uint64_t stats_deadline(const stats_emitter *e) {
+    return e->fd < 0 ? 0 : e->next_emit;
+}
+
+/* Appends the histogram as a JSON array of bucket counts, up to the last one in use. */
+static int format_hist(char *out, size_t size, const char *name, const histogram *h) {
+    int last = STATS_BUCKETS - 1;
+    while (last >= 0 && h->counts[last] == 0)
+        last--;
+    int n = snprintf(out, size, ",\"%s\":[", name);
+    for (int i = 0; i <= last && (size_t) n < size; i++)
+        n += snprintf(out + n, size - n, i == 0 ? "%lu" : ",%lu", (unsigned long) h->counts[i]);
+    if ((size_t) n < size)
+        n += snprintf(out + n, size - n, "]");
+    return n;
+}
+
+/* Writes the stats as one JSON object on one line, labelled with the peer and the server worker
+thread if given. Returns its length. */
+static size_t format_line(const stats *s, uint64_t now, const char *peer, int worker, char *out,
+                          size_t size) {
+    int n = snprintf(out, size, "{");
+    if (peer != NULL)
+        n += snprintf(out + n, size - n, "\"peer\":\"%s\",", peer);
+    if (worker >= 0)
+        n += snprintf(out + n, size - n, "\"worker\":%d,", worker);
+    n += snprintf(out + n, size - n,
+                  "\"elapsed_us\":%lu,\"pkts_sent\":%lu,\"pkts_recv\":%lu,"
+                  "\"bytes_sent\":%lu,\"bytes_delivered\":%lu,"
+                  "\"rtx_timeout\":%lu,\"rtx_dupack\":%lu,\"rtx_sack\":%lu,"
+                  "\"dup_acks\":%lu,\"dup_drops\":%lu,\"full_drops\":%lu,\"window_probes\":%lu,"
+                  "\"stale_drops\":%lu,\"fec_sent\":%lu,\"fec_rebuilt\":%lu,"
+                  "\"pmtu_probes\":%lu,\"syn_data\":%lu,\"segment\":%u",
+                  (unsigned long) (now - s->start), (unsigned long) s->pkts_sent,
+                  (unsigned long) s->pkts_recv, (unsigned long) s->bytes_sent,
+                  (unsigned long) s->bytes_delivered, (unsigned long) s->rtx_timeout,
+                  (unsigned long) s->rtx_dupack, (unsigned long) s->rtx_sack,
+                  (unsigned long) s->dup_acks, (unsigned long) s->dup_drops,
+                  (unsigned long) s->full_drops, (unsigned long) s->window_probes,
+                  (unsigned long) s->stale_drops, (unsigned long) s->fec_sent,
+                  (unsigned long) s->fec_rebuilt, (unsigned long) s->pmtu_probes,
+                  (unsigned long) s->syn_data, s->segment);
+    // histograms use log2 buckets: bucket i counts values in [2^(i-1), 2^i)
+    const struct { const char *name; const histogram *h; } hists[] = {
+        {"rtt_us", &s->rtt}, {"cwnd", &s->cwnd}, {"send_q", &s->send_q},
+        {"recv_q", &s->recv_q}, {"goodput_kBps", &s->goodput},
+    };
+    for (size_t i = 0; i < sizeof(hists) / sizeof(hists[0]) && (size_t) n < size; i++)
+        n += format_hist(out + n, size - n, hists[i].name, hists[i].h);
+    if ((size_t) n < size)
+        n += snprintf(out + n, size - n, "}\n");
+    return (size_t) n < size ? (size_t) n : size - 1;
+}
+
+/* Returns which lines are due now: STATS_DUMP if SIGUSR1 asked for them,
+STATS_EMIT if the emitter is due, or 0. Each is only reported once. */
+int stats_poll(stats_emitter *e, uint64_t now) {
+    int due = 0;
+    uint32_t dumps = atomic_load_explicit(&dump_requests, memory_order_relaxed);
+    if (dumps != e->dumps) {
+        e->dumps = dumps;
+        due |= STATS_DUMP;
+    }
+    if (e->fd >= 0 && now >= e->next_emit) {
+        e->next_emit = now + e->interval;
+        due |= STATS_EMIT;
+    }
+    return due;
+}
+
+/* Writes the line of one connection where stats_poll said lines are due.
+The emitter never blocks: if the file or the reader can't take the line, it is skipped. */
+void stats_write(stats_emitter *e, const stats *s, int due, uint64_t now, const char *peer, int worker) {
+    char line[8192];
+    size_t len = format_line(s, now, peer, worker, line, sizeof(line));
+    if (due & STATS_DUMP)
+        write(STDERR_FILENO, line, len);
+    if (!(due & STATS_EMIT))
+        return;
+    if (strncmp(e->target, UNIX_PREFIX, strlen(UNIX_PREFIX)) != 0) {
+        write(e->fd, line, len);
+    } else if (send(e->fd, line, len, MSG_DONTWAIT) < 0 && errno != EAGAIN) {
+        // not connected yet, or the reader went away: try again with the next line
+        if (connect_unix(e->fd, e->target + strlen(UNIX_PREFIX)))
+            send(e->fd, line, len, MSG_DONTWAIT);
+    }
+}
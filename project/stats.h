@@ -0,0 +1,70 @@
+#ifndef PROJECT_STATS_H_
+#define PROJECT_STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STATS_BUCKETS 33            // one per bit length of a 32 bit value, and 0
+#define STATS_SLICE 100000          // goodput is sampled over slices of this many us
+#define DEFAULT_STATS_INTERVAL 1000 // ms between lines of the JSON lines emitter
+#define STATS_DUMP 1                // SIGUSR1 asked for lines on stderr
+#define STATS_EMIT 2                // the emitter is due
+
+/* Counts of values by bit length: bucket i holds values in [2^(i-1), 2^i), bucket 0 holds 0. */
+typedef struct {
+    uint64_t counts[STATS_BUCKETS];
+} histogram;
+
+/* What a connection has done so far. Updating it costs a few increments per packet.
+It is only formatted when someone asks: on SIGUSR1, at the interval of the emitter,
+and for the emitter once more when the connection closes. */
+typedef struct stats {
+    uint64_t start;             // when the stats were started, in us
+    uint64_t pkts_sent;         // every packet, retransmissions and acks included
+    uint64_t pkts_recv;
+    uint64_t bytes_sent;        // new data, retransmissions not included
+    uint64_t bytes_delivered;   // data written out in order
+    uint64_t rtx_timeout;       // retransmissions after a timeout
+    uint64_t rtx_dupack;        // after duplicate acks, or a partial ack in recovery
+    uint64_t rtx_sack;          // from the sack scoreboard
+    uint64_t dup_acks;
+    uint64_t dup_drops;         // data packets received that were delivered or buffered already
+    uint64_t full_drops;        // data packets dropped for lack of room in the receive buffer
+    uint64_t window_probes;     // packets sent past the peer's closed receive window
+    uint64_t stale_drops;       // packets acking data never sent, or from another lap of the seq numbers
+    uint64_t fec_sent;          // parity packets
+    uint64_t fec_rebuilt;       // data packets rebuilt from parity instead of waiting for them
+    uint64_t pmtu_probes;       // padded packets sent to find a larger segment size
+    uint64_t syn_data;          // data taken from syns with a valid fast open cookie
+    uint32_t segment;           // bytes of payload new data is sent in now
+    histogram rtt;              // RTT samples in us
+    histogram cwnd;             // congestion window in packets, on every new ack
+    histogram send_q;           // send buffer depth in packets, on every packet received
+    histogram recv_q;           // receive buffer depth in packets, on every packet received
+    histogram goodput;          // KB/s delivered, per slice with data
+    uint64_t slice_start;       // goodput slice being measured
+    uint64_t slice_bytes;
+} stats;
+
+/* Where the lines go. One per socket, the server writes a line for each connection on it. */
+typedef struct stats_emitter {
+    int fd;                     // file or Unix datagram socket, -1 if none
+    const char *target;
+    uint64_t interval;          // us between lines
+    uint64_t next_emit;
+    uint32_t dumps;             // SIGUSR1 answered so far
+} stats_emitter;
+
+void stats_init(stats *s);
+void stats_delivered(stats *s, uint32_t bytes, uint64_t now);
+void stats_emitter_init(stats_emitter *e, const char *target, uint32_t interval_ms);
+uint64_t stats_deadline(const stats_emitter *e);
+int stats_poll(stats_emitter *e, uint64_t now);
+void stats_write(stats_emitter *e, const stats *s, int due, uint64_t now, const char *peer, int worker);
+
+/* Counts a value in the bucket for its bit length. */
+static inline void hist_add(histogram *h, uint32_t v) {
+    h->counts[v == 0 ? 0 : 32 - __builtin_clz(v)]++;
+}
+
+#endif  // PROJECT_STATS_H_
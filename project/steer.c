@@ -0,0 +1,109 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include "options.h"
+#include "steer.h"
+
+/* Worker threads each have a SO_REUSEPORT socket on the server port, and a classic BPF program
+attached to the group picks the socket for every datagram. It hashes the peer address and port
+into a bucket, and looks up the worker owning the bucket in a table compiled into the program.
+Rebalancing changes the table and attaches the program again, which replaces it for the group. */
+
+#define STEER_MULTIPLIER 0x9E3779B1u
+#define STEER_PROG_MAX (4 * STEER_BUCKETS)
+
+/* Returns the bucket of a peer, the same way the program computes it. */
+uint32_t steer_bucket(const struct sockaddr_in *addr) {
+    uint32_t key = ntohl(addr->sin_addr.s_addr) ^ ntohs(addr->sin_port);
+    return (key * STEER_MULTIPLIER) >> 24;
+}
+
+/* Hands out the buckets in turn, so that each worker gets the same share of flows. */
+void steer_spread(uint8_t *owner, uint32_t workers) {
+    for (uint32_t b = 0; b < STEER_BUCKETS; b++)
+        owner[b] = b % workers;
+}
+
+/* Appends the lookup of the owner of the bucket in the accumulator, for buckets in [lo, hi),
+as a binary search. A range owned by one worker is a single return.
+Conditional jumps only reach 255 instructions ahead, so branches use an unconditional jump. */
+static uint32_t build_lookup(struct sock_filter *prog, uint32_t n, const uint8_t *owner,
+                             uint32_t lo, uint32_t hi) {
+    uint32_t same = lo + 1;
+    while (same < hi && owner[same] == owner[lo])
+        same++;
+    if (same == hi) {
+        prog[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, owner[lo]);
+        return n;
+    }
+    uint32_t mid = (lo + hi) / 2;
+    prog[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, mid, 0, 1);
+    uint32_t jump = n++;  // to the upper half, once the lower half is known
+    n = build_lookup(prog, n, owner, lo, mid);
+    prog[jump] = (struct sock_filter) BPF_STMT(BPF_JMP | BPF_JA, n - jump - 1);
+    return build_lookup(prog, n, owner, mid, hi);
+}
+
+/* Attaches the program steering every bucket to its owner, given as the index of the socket
+in the order the sockets were bound. Returns false if the kernel doesn't support it,
+then the kernel's own hash spreads the flows and they can't be moved. */
+bool steer_attach(int sockfd, const uint8_t *owner) {
+    struct sock_filter prog[STEER_PROG_MAX];
+    uint32_t n = 0;
+    // the program sees the datagram from its payload on, headers are reached from the network header
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12);  // source address
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TAX, 0);
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_NET_OFF + 20);  // source port,
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0);                // no IP options
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, STEER_MULTIPLIER);
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 24);
+    n = build_lookup(prog, n, owner, 0, STEER_BUCKETS);
+    struct sock_fprog fprog = {.len = n, .filter = prog};
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) == 0;
+}
+
+/* Moves buckets from the busiest worker to the least busy one while that narrows the gap
+between them, picking the bucket closest to half the gap each time.
+load has the packets each bucket received since the last rebalance.
+Returns the number of buckets moved. */
+uint32_t steer_rebalance(uint8_t *owner, const uint64_t *load, uint32_t workers) {
+    uint64_t total[MAX_THREADS] = {0};
+    uint64_t sum = 0;
+    for (uint32_t b = 0; b < STEER_BUCKETS; b++) {
+        total[owner[b]] += load[b];
+        sum += load[b];
+    }
+    if (sum < STEER_MIN_LOAD * workers)
+        return 0;
+    uint32_t moved = 0;
+    while (moved < STEER_MAX_MOVES) {
+        uint32_t busiest = 0, idlest = 0;
+        for (uint32_t w = 1; w < workers; w++) {
+            if (total[w] > total[busiest])
+                busiest = w;
+            if (total[w] < total[idlest])
+                idlest = w;
+        }
+        uint64_t gap = total[busiest] - total[idlest];
+        if (gap * workers * 8 < sum)  // within an eighth of the mean
+            break;
+        int best = -1;
+        uint64_t best_miss = gap;
+        for (uint32_t b = 0; b < STEER_BUCKETS; b++) {
+            if (owner[b] != busiest || load[b] == 0 || load[b] >= gap)
+                continue;
+            uint64_t miss = load[b] * 2 > gap ? load[b] * 2 - gap : gap - load[b] * 2;
+            if (miss < best_miss) {
+                best = b;
+                best_miss = miss;
+            }
+        }
+        if (best < 0)  // one bucket carries most of the gap, moving it only moves the problem
+            break;
+        owner[best] = idlest;
+        total[busiest] -= load[best];
+        total[idlest] += load[best];
+        moved++;
+    }
+    return moved;
+}
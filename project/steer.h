@@ -0,0 +1,18 @@
+#ifndef PROJECT_STEER_H_
+#define PROJECT_STEER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define STEER_BUCKETS 256           // flows are steered in groups, by a hash of the peer address and port
+#define STEER_INTERVAL 500000       // us between rebalances
+#define STEER_MIN_LOAD 1000         // packets per interval below which the load isn't worth moving
+#define STEER_MAX_MOVES 16          // buckets moved per rebalance, so that flows don't all move at once
+
+uint32_t steer_bucket(const struct sockaddr_in *addr);
+void steer_spread(uint8_t *owner, uint32_t workers);
+bool steer_attach(int sockfd, const uint8_t *owner);
+uint32_t steer_rebalance(uint8_t *owner, const uint64_t *load, uint32_t workers);
+
+#endif  // PROJECT_STEER_H_
@@ -0,0 +1,103 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "utils.h"
+#include "trace.h"
+
+/* Events are kept in a fixed ring of binary records in memory, and only written out
+on SIGUSR2, on SIGINT or SIGTERM, or at exit. Recording one is a few stores, instead of
+the formatted writes to stderr that used to happen on every packet.
+The dump runs in a signal handler, so it takes no locks. Server worker threads share the ring:
+a slot is claimed first and counted as filled once written, and the dump leaves out the records
+still being written, along with the old records in the slots they are overwriting. */
+
+int trace_level = TRACE_OFF;
+
+static trace_record *ring;
+static _Atomic uint64_t claimed;    // slots ever handed out, the next one is claimed % TRACE_RECORDS
+static _Atomic uint64_t filled;     // records completely written
+static const char *dump_path;
+
+static void write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return;
+        p += n;
+        len -= n;
+    }
+}
+
+/* Writes the records held to the dump file, oldest first. Safe to call from a signal handler. */
+void trace_dump(void) {
+    if (ring == NULL)
+        return;
+    uint64_t end = atomic_load_explicit(&filled, memory_order_acquire);
+    uint64_t newest = atomic_load_explicit(&claimed, memory_order_acquire);
+    // records claimed but not filled, like the one the signal interrupted, are the newest ones
+    // unless a thread stalled in the middle of one, and their slots held the oldest
+    uint64_t start = newest >= TRACE_RECORDS ? newest - TRACE_RECORDS : 0;
+    if (start > end)
+        return;
+    int fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    trace_header header = {TRACE_MAGIC, end - start};
+    write_all(fd, &header, sizeof(header));
+    uint32_t first = start % TRACE_RECORDS;
+    uint32_t count = end - start;
+    uint32_t before_wrap = TRACE_RECORDS - first < count ? TRACE_RECORDS - first : count;
+    write_all(fd, ring + first, before_wrap * sizeof(trace_record));
+    write_all(fd, ring, (count - before_wrap) * sizeof(trace_record));
+    close(fd);
+}
+
+static void on_dump_signal(int sig) {
+    (void) sig;
+    trace_dump();
+}
+
+/* Dumps, then dies from the signal as if it wasn't caught. */
+static void on_exit_signal(int sig) {
+    trace_dump();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* Starts tracing at the given level, to be dumped to path.
+Does nothing if the level is TRACE_OFF, or if tracing was started already. */
+void trace_init(int level, const char *path) {
+    if (level == TRACE_OFF || ring != NULL)
+        return;
+    ring = calloc(TRACE_RECORDS, sizeof(trace_record));
+    if (ring == NULL)
+        die("trace initialization malloc failed");
+    dump_path = path;
+    trace_level = level;
+    atexit(trace_dump);
+    struct sigaction sa = {0};
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = on_dump_signal;
+    sigaction(SIGUSR2, &sa, NULL);
+    sa.sa_handler = on_exit_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+void trace_record_event(trace_event event, uint32_t seq, uint32_t ack, uint16_t length, uint8_t flags,
+                        uint32_t depth) {
+    uint64_t n = atomic_fetch_add_explicit(&claimed, 1, memory_order_relaxed);
+    trace_record *r = &ring[n % TRACE_RECORDS];
+    r->time = now_us();
+    r->seq = seq;
+    r->ack = ack;
+    r->depth = depth;
+    r->length = length;
+    r->event = event;
+    r->flags = flags;
+    atomic_fetch_add_explicit(&filled, 1, memory_order_release);
+}
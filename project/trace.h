@@ -0,0 +1,58 @@
+#ifndef PROJECT_TRACE_H_
+#define PROJECT_TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_OFF 0
+#define TRACE_PACKETS 1     // every packet sent or received
+#define TRACE_BUFFERS 2     // and the send and receive buffers after every change
+#define TRACE_MAGIC 0x52545254  // "TRTR", at the start of a dump
+#define TRACE_RECORDS (1 << 16)  // records kept, older ones are overwritten
+
+typedef enum {
+    TR_SEND,    // a packet sent for the first time, or during the handshake
+    TR_RECV,
+    TR_RTOS,    // retransmitted after a timeout
+    TR_DUPS,    // retransmitted after duplicate acks or sacks
+    TR_SBUF,    // seq is the front of the send buffer, or the next seq if it is empty
+    TR_RBUF,    // seq is the next seq expected in order
+} trace_event;
+
+/* One traced event, as dumped. The dump is in host byte order, for reading on the same machine. */
+typedef struct {
+    uint64_t time;      // monotonic time in us
+    uint32_t seq;       // low 32 bits of the seq number, as on the wire
+    uint32_t ack;
+    uint32_t depth;     // packets in the buffer, for buffer events
+    uint16_t length;
+    uint8_t event;
+    uint8_t flags;
+} trace_record;
+
+/* Start of a dump, followed by count records, oldest first. */
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+} trace_header;
+
+extern int trace_level;
+
+void trace_init(int level, const char *path);
+void trace_record_event(trace_event event, uint32_t seq, uint32_t ack, uint16_t length, uint8_t flags,
+                        uint32_t depth);
+void trace_dump(void);
+
+/* Records a packet sent or received. Costs a branch when tracing is off. */
+static inline void trace_packet(trace_event event, uint32_t seq, uint32_t ack, uint16_t length,
+                                uint8_t flags) {
+    if (trace_level >= TRACE_PACKETS)
+        trace_record_event(event, seq, ack, length, flags, 0);
+}
+
+/* Records the state of the send or receive buffer. */
+static inline void trace_buffer(trace_event event, uint32_t seq, uint32_t depth) {
+    if (trace_level >= TRACE_BUFFERS)
+        trace_record_event(event, seq, 0, 0, 0, depth);
+}
+
+#endif  // PROJECT_TRACE_H_
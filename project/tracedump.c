@@ -0,0 +1,140 @@
+// Prints a trace dumped by the client or server in the text log format:
+// SEND, RECV, RTOS and DUPS lines for packets, SBUF and RBUF lines for the buffers.
+// Usage: tracedump [-t] <trace file>
+// -t prefixes every line with its time in seconds since the first record.
+// The trace only has the size and front of each buffer, so their contents are
+// rebuilt from the packets sent and received. If the ring had wrapped, the
+// buffers miss the packets from before the oldest record.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "trace.h"
+
+static const char *names[] = {"SEND", "RECV", "RTOS", "DUPS", "SBUF", "RBUF"};
+
+// seq numbers in order, for rebuilding a buffer. The trace keeps their low 32 bits,
+// so they are compared as serial numbers, across the wrap
+typedef struct {
+    uint32_t *seqs;
+    size_t start, end, capacity;
+} seq_list;
+
+static void list_insert(seq_list *l, uint32_t seq) {
+    size_t i = l->end;
+    while (i > l->start && seq_lt(seq, l->seqs[i - 1]))
+        i--;
+    if (i > l->start && l->seqs[i - 1] == seq)
+        return;
+    if (l->end == l->capacity) {  // compact, or grow
+        memmove(l->seqs, l->seqs + l->start, (l->end - l->start) * sizeof(uint32_t));
+        i -= l->start;
+        l->end -= l->start;
+        l->start = 0;
+        if (l->end == l->capacity) {
+            l->capacity = l->capacity ? 2 * l->capacity : 1024;
+            l->seqs = realloc(l->seqs, l->capacity * sizeof(uint32_t));
+            if (l->seqs == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+    }
+    memmove(l->seqs + i + 1, l->seqs + i, (l->end - i) * sizeof(uint32_t));
+    l->seqs[i] = seq;
+    l->end++;
+}
+
+/* Drops the seq numbers below seq, then prints up to depth of the rest. */
+static void list_print(seq_list *l, const char *name, uint32_t seq, uint32_t depth) {
+    while (l->start < l->end && seq_lt(l->seqs[l->start], seq))
+        l->start++;
+    printf("%s", name);
+    for (size_t i = l->start; i < l->end && i - l->start < depth; i++)
+        printf(" %u", l->seqs[i]);
+    printf("\n");
+}
+
+/* Returns true if a packet carries data that goes through the buffers. */
+static bool carries_data(uint8_t flags, uint16_t length) {
+    return length > 0 && (flags & PKT_SYN || !(flags & (PKT_FEC | PKT_MSS)));
+}
+
+/* Returns true if a packet sent takes a seq number of its own, as data, a syn or a fin. */
+static bool takes_seq(uint8_t flags, uint16_t length) {
+    return carries_data(flags, length) || flags & (PKT_SYN | PKT_FIN);
+}
+
+static void print_flags(uint8_t flags) {
+    switch (flags & (PKT_SYN | PKT_ACK)) {
+        case PKT_SYN:
+            printf(" SYN");
+            break;
+        case PKT_ACK:
+            printf(" ACK");
+            break;
+        case PKT_ACK | PKT_SYN:
+            printf(" SYN ACK");
+            break;
+        default:
+            if (!(flags & (PKT_FEC | PKT_MSS)))
+                printf(" NONE");
+    }
+    if (flags & PKT_FIN && !(flags & PKT_SYN))  // the compact bit, which only a syn offers
+        printf(" FIN");
+    if (flags & PKT_FEC && !(flags & PKT_SYN))  // on a syn it offers parity
+        printf(" PARITY");
+    if (flags & PKT_MSS && !(flags & PKT_SYN))  // and a segment size, else it probes or acks a probe
+        printf(" PROBE");
+    printf(flags & PKT_SACK ? " SACK\n" : "\n");
+}
+
+int main(int argc, char *argv[]) {
+    bool times = argc > 1 && strcmp(argv[1], "-t") == 0;
+    if (argc != 2 + times) {
+        fprintf(stderr, "usage: %s [-t] <trace file>\n", argv[0]);
+        return 1;
+    }
+    FILE *f = fopen(argv[1 + times], "rb");
+    if (f == NULL) {
+        perror(argv[1 + times]);
+        return 1;
+    }
+    trace_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC) {
+        fprintf(stderr, "%s: not a trace\n", argv[1 + times]);
+        return 1;
+    }
+
+    seq_list sent = {0}, received = {0};
+    uint64_t first = 0;
+    trace_record r;
+    for (uint32_t i = 0; i < header.count && fread(&r, sizeof(r), 1, f) == 1; i++) {
+        if (r.event > TR_RBUF)
+            continue;
+        if (i == 0)
+            first = r.time;
+        if (times)
+            printf("%.6f ", (r.time - first) / 1e6);
+        switch (r.event) {
+            case TR_SBUF:
+                list_print(&sent, names[r.event], r.seq, r.depth);
+                break;
+            case TR_RBUF:
+                list_print(&received, names[r.event], r.seq, r.depth);
+                break;
+            default:
+                // new packets go to the back of the send buffer, syns and fins take a seq number too,
+                // parity packets and path mtu probes stay out of the buffers
+                if (r.event == TR_SEND && takes_seq(r.flags, r.length) &&
+                        (sent.start == sent.end || seq_lt(sent.seqs[sent.end - 1], r.seq)))
+                    list_insert(&sent, r.seq);
+                if (r.event == TR_RECV && carries_data(r.flags, r.length))
+                    list_insert(&received, r.seq);
+                printf("%s %u ACK %u SIZE %d FLAGS", names[r.event], r.seq, r.ack, r.length);
+                print_flags(r.flags);
+        }
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "wire.h"
+#include "uring.h"
+
+#define BACKLOG_SIZE (2 * UR_BUFFERS)  // a completion per buffer, and the ends of the receive
+
+static int ur_enter(int fd, uint32_t submit, uint32_t complete, uint32_t flags) {
+    return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+/* Takes the next free submission entry, cleared. The caller fills it and calls ur_queue. */
+static struct io_uring_sqe* ur_sqe(uring *r) {
+    uint32_t tail = *r->sq_tail;
+    struct io_uring_sqe *sqe = &r->sqes[tail & r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+    return sqe;
+}
+
+/* Makes the entry from ur_sqe visible to the kernel, for the next io_uring_enter. */
+static void ur_queue(uring *r) {
+    __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Hands a buffer the kernel received into back to it. */
+static void ur_recycle(uring *r, uint16_t id) {
+    struct io_uring_buf *b = &r->bufs->bufs[r->buf_tail & (UR_BUFFERS - 1)];
+    b->addr = (uint64_t) (uintptr_t) (r->buf_data + (size_t) id * r->buf_size);
+    b->len = r->buf_size;
+    b->bid = id;
+    r->buf_tail++;
+    __atomic_store_n(&r->bufs->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
+
+/* Posts the multishot receive, which keeps receiving until it runs out of buffers or fails. */
+static void ur_arm(uring *r) {
+    struct io_uring_sqe *sqe = ur_sqe(r);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = r->sockfd;
+    sqe->addr = (uint64_t) (uintptr_t) &r->recv_hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UR_GROUP;
+    sqe->user_data = UR_RECV;
+    ur_queue(r);
+    while (ur_enter(r->fd, 1, 0, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN) die("io_uring submit");
+    }
+    r->receiving = true;
+}
+
+/* Takes every completion posted: receives go to the backlog, sends to their result. */
+static void ur_reap(uring *r) {
+    uint32_t head = *r->cq_head;
+    uint32_t tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+        if (cqe->user_data == UR_RECV) {
+            if (r->backlog_tail - r->backlog_head == BACKLOG_SIZE) {
+                errno = EOVERFLOW;
+                die("io_uring backlog");
+            }
+            r->backlog[r->backlog_tail++ & (BACKLOG_SIZE - 1)] = *cqe;
+        } else {
+            r->results[cqe->user_data] = cqe->res;
+            r->completed++;
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void ur_destroy(uring *r) {
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);  // the kernel lets go of the provided buffers with the ring
+    free(r->bufs);
+    free(r->buf_data);
+    free(r->backlog);
+    free(r->results);
+}
+
+/* Sets up the rings for sends of up to batch datagrams, registers the provided buffers and posts
+the receive. Returns false if the kernel lacks io_uring, provided buffer rings or multishot
+receives, or doesn't let this process use them, then the socket should be used directly. */
+bool ur_init(uring *r, int sockfd, uint32_t batch) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // the completion ring has room for a completion per buffer besides those of a whole batch
+    uint32_t entries = round_up_pow2(batch + 1);
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = round_up_pow2(entries + BACKLOG_SIZE);
+    // completions are posted when the process next enters the kernel, without interrupting it
+    params.flags |= IORING_SETUP_COOP_TASKRUN;
+    r->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (r->fd < 0 && errno == EINVAL) {  // before 5.19
+        params.flags &= ~IORING_SETUP_COOP_TASKRUN;
+        r->fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (r->fd < 0)
+        return false;
+    r->sockfd = sockfd;
+    r->sq_entries = params.sq_entries;
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                      IORING_OFF_SQ_RING);
+    r->cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? r->sq_ring :
+                 mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                      IORING_OFF_CQ_RING);
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                   IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+        ur_destroy(r);
+        return false;
+    }
+    uint8_t *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (uint32_t*) (sq + params.sq_off.head);
+    r->sq_tail = (uint32_t*) (sq + params.sq_off.tail);
+    r->sq_mask = *(uint32_t*) (sq + params.sq_off.ring_mask);
+    r->sq_array = (uint32_t*) (sq + params.sq_off.array);
+    r->cq_head = (uint32_t*) (cq + params.cq_off.head);
+    r->cq_tail = (uint32_t*) (cq + params.cq_off.tail);
+    r->cq_mask = *(uint32_t*) (cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    r->recv_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    r->buf_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + WIRE_MAX_SIZE;
+    r->buf_data = malloc((size_t) UR_BUFFERS * r->buf_size);
+    r->backlog = malloc(BACKLOG_SIZE * sizeof(struct io_uring_cqe));
+    r->results = malloc(r->sq_entries * sizeof(int32_t));
+    if (posix_memalign((void**) &r->bufs, sysconf(_SC_PAGESIZE), UR_BUFFERS * sizeof(struct io_uring_buf)) != 0)
+        r->bufs = NULL;
+    if (r->buf_data == NULL || r->backlog == NULL || r->results == NULL || r->bufs == NULL)
+        die("io_uring malloc failed");
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) r->bufs;
+    reg.ring_entries = UR_BUFFERS;
+    reg.bgid = UR_GROUP;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        ur_destroy(r);
+        return false;
+    }
+    r->buf_tail = 0;
+    __atomic_store_n(&r->bufs->tail, 0, __ATOMIC_RELEASE);
+    for (uint16_t id = 0; id < UR_BUFFERS; id++)
+        ur_recycle(r, id);
+
+    // a kernel without multishot receives fails it at once
+    ur_arm(r);
+    ur_reap(r);
+    if (r->backlog_tail != r->backlog_head && r->backlog[r->backlog_head].res == -EINVAL) {
+        ur_destroy(r);
+        return false;
+    }
+    return true;
+}
+
+/* Returns true if received datagrams are waiting to be handed out. */
+bool ur_pending(uring *r) {
+    return r->backlog_head != r->backlog_tail ||
+           *r->cq_head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+}
+
+/* Hands out the next received packet in host byte order, along with its sender, like batch_recv.
+Its buffer goes back to the kernel at once. Once none are left, the receive is posted again if it
+ended, which happens when the kernel ran out of buffers. Returns false if there are none. */
+bool ur_recv(uring *r, struct sockaddr_in *addr, packet *pkt, bool compact) {
+    for (;;) {
+        if (r->backlog_head == r->backlog_tail)
+            ur_reap(r);
+        if (r->backlog_head == r->backlog_tail) {
+            if (!r->receiving)
+                ur_arm(r);
+            return false;
+        }
+        struct io_uring_cqe cqe = r->backlog[r->backlog_head++ & (BACKLOG_SIZE - 1)];
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+            r->receiving = false;
+        if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+            errno = -cqe.res;
+            die("receive");
+        }
+        if (!(cqe.flags & IORING_CQE_F_BUFFER))
+            continue;
+        uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t *buf = r->buf_data + (size_t) id * r->buf_size;
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out*) buf;
+        uint8_t *name = buf + sizeof(*out);
+        uint8_t *data = name + r->recv_hdr.msg_namelen + r->recv_hdr.msg_controllen;
+        bool ok = !(out->flags & MSG_TRUNC) && out->payloadlen > 0 &&
+                  wire_decode(pkt, data, out->payloadlen, compact);
+        if (ok)
+            memcpy(addr, name, sizeof(*addr));
+        ur_recycle(r, id);
+        if (!ok)
+            continue;
+        trace_packet(TR_RECV, pkt->seq, pkt->ack, pkt->length, pkt->flags);
+        return true;
+    }
+}
+
+/* Sends n messages like sendmmsg, as linked requests so that they go out in order and a failure
+cancels the rest, and waits for them. Returns the number sent, or -1 with errno set if the first
+one failed. */
+int ur_sendmmsg(uring *r, struct mmsghdr *msgs, uint32_t n) {
+    if (n > r->sq_entries)
+        n = r->sq_entries;
+    for (uint32_t i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = ur_sqe(r);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = r->sockfd;
+        sqe->addr = (uint64_t) (uintptr_t) &msgs[i].msg_hdr;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_DONTWAIT;  // a full socket buffer fails the send instead of waiting
+        sqe->flags = i + 1 < n ? IOSQE_IO_LINK : 0;
+        sqe->user_data = i;
+        ur_queue(r);
+    }
+    r->completed = 0;
+    uint32_t submit = n;
+    while (r->completed < n) {
+        int submitted = ur_enter(r->fd, submit, n - r->completed, IORING_ENTER_GETEVENTS);
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN) die("io_uring submit");
+        if (submitted > 0)
+            submit -= submitted;
+        ur_reap(r);
+    }
+    uint32_t sent = 0;
+    while (sent < n && r->results[sent] >= 0) {
+        msgs[sent].msg_len = r->results[sent];
+        sent++;
+    }
+    if (sent > 0)
+        return sent;
+    errno = -r->results[0];
+    return -1;
+}
@@ -0,0 +1,61 @@
+#ifndef PROJECT_URING_H_
+#define PROJECT_URING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include "utils.h"
+
+#define UR_BUFFERS 512          // datagrams the kernel can receive before they are handed out
+#define UR_GROUP 0              // id of the provided buffer ring
+#define UR_RECV UINT64_MAX      // user data of the receive, sends carry their index in the batch
+
+struct mmsghdr;                 // only defined with _GNU_SOURCE
+
+/* The socket of an endpoint driven through io_uring, with -u. A multishot recvmsg stays posted,
+and the kernel receives each datagram into a buffer it takes from a ring of provided buffers,
+then posts a completion, so receiving costs no syscalls at all. The event loop watches the
+ring's fd instead of the socket. A batch of sends is queued as linked sendmsg requests and
+submitted, and waited for, with one io_uring_enter. Receive completions reaped while waiting
+for sends are kept in a backlog until they are handed out.
+The rings are shared with the kernel through mmap, and set up with raw syscalls. */
+typedef struct uring {
+    int fd;
+    int sockfd;
+    uint32_t sq_entries;
+    uint32_t *sq_head;          // the kernel's side of the submission ring
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    uint32_t *cq_head;          // our side of the completion ring
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;              // the same mapping as sq_ring if the kernel allows it
+    size_t cq_ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *bufs;  // provided buffers, shared with the kernel
+    uint8_t *buf_data;
+    uint32_t buf_size;          // recvmsg header, sender address and the largest datagram
+    uint16_t buf_tail;
+    struct msghdr recv_hdr;     // the shape of what the receive puts in each buffer
+    bool receiving;             // the multishot receive is posted
+    struct io_uring_cqe *backlog;  // receive completions reaped while waiting for sends
+    uint32_t backlog_head;
+    uint32_t backlog_tail;
+    int32_t *results;           // of the sends being waited for, by index
+    uint32_t completed;
+} uring;
+
+bool ur_init(uring *r, int sockfd, uint32_t batch);
+bool ur_recv(uring *r, struct sockaddr_in *addr, packet *pkt, bool compact);
+bool ur_pending(uring *r);
+int ur_sendmmsg(uring *r, struct mmsghdr *msgs, uint32_t n);
+
+#endif  // PROJECT_URING_H_
@@ -6,31 +6,30 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <time.h>
 #include "utils.h"
-
-static void print_packet(packet *pkt, const char* op) {
-    fprintf(stderr, "%s %d ACK %d SIZE %d FLAGS",
-            op, pkt->seq, pkt->ack, pkt->length);
-    switch (pkt->flags) {
-        case PKT_SYN:
-            fprintf(stderr, " SYN\n");
-            break;
-        case PKT_ACK:
-            fprintf(stderr, " ACK\n");
-            break;
-        case PKT_ACK | PKT_SYN:
-            fprintf(stderr, " SYN ACK\n");
-            break;
-        default:
-            fprintf(stderr, " NONE\n");
-    }
-}
+#include "wire.h"
 
 void die(const char s[]) {
     perror(s);
     exit(errno);
 }
 
+/* Returns the monotonic wall clock time in microseconds. */
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Returns the smallest power of two that is at least n. */
+uint32_t round_up_pow2(uint32_t n) {
+    uint32_t size = 1;
+    while (size < n)
+        size <<= 1;
+    return size;
+}
+
 int make_nonblock_socket() {
     /* 1. Create socket */
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -42,57 +41,92 @@ int make_nonblock_socket() {
     return sockfd;
 }
 
+/* Asks for socket buffers of at least bytes each way, if they are smaller.
+The kernel caps them at net.core.rmem_max and wmem_max. */
+void grow_socket_buffers(int sockfd, int bytes) {
+    int opts[] = {SO_RCVBUF, SO_SNDBUF};
+    for (size_t i = 0; i < sizeof(opts) / sizeof(opts[0]); i++) {
+        int size;
+        socklen_t len = sizeof(size);
+        if (getsockopt(sockfd, SOL_SOCKET, opts[i], &size, &len) == 0 && size < bytes)
+            setsockopt(sockfd, SOL_SOCKET, opts[i], &bytes, sizeof(bytes));
+    }
+}
+
+static int std_flags[2] = {-1, -1};  // of stdin and stdout, before O_NONBLOCK was added
+
+static void std_restore(void) {
+    for (int fd = STDIN_FILENO; fd <= STDOUT_FILENO; fd++)
+        if (std_flags[fd] >= 0)
+            fcntl(fd, F_SETFL, std_flags[fd]);
+}
+
+/* Adds O_NONBLOCK to the status flags of stdin or stdout, keeping the others, like the O_APPEND
+of a >> redirect. The flags belong to the open file description, which the shell or a terminal
+shares, so the old ones are put back at exit. */
+static void std_nonblock(int fd, const char *what) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) die(what);
+    if (flags & O_NONBLOCK)
+        return;
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) die(what);
+    if (std_flags[STDIN_FILENO] < 0 && std_flags[STDOUT_FILENO] < 0)
+        atexit(std_restore);
+    std_flags[fd] = flags;
+}
+
 void stdin_nonblock() {
-    int stdin_nonblock = fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
-    if (stdin_nonblock < 0) die("non-block stdin");
+    std_nonblock(STDIN_FILENO, "non-block stdin");
+}
+
+/* Stdout doesn't block either, so a slow reader fills the output buffer and closes the
+advertised window, instead of stalling the whole connection in a write. */
+void stdout_nonblock() {
+    std_nonblock(STDOUT_FILENO, "non-block stdout");
 }
 
+/* Sends a packet as a single datagram, trimmed to its length.
+A datagram larger than the device takes is lost, like a path mtu probe the path can't carry. */
 int send_packet(int sockfd,
                 struct sockaddr_in *serveraddr,
                 packet *pkt,
-                const char* str) {
-    print_packet(pkt, str);
+                bool compact,
+                trace_event op) {
+    trace_packet(op, pkt->seq, pkt->ack, pkt->length, pkt->flags);
     socklen_t serversize = sizeof(*serveraddr);
-    packet pkt_send = *pkt;
-    pkt_send.seq = htonl(pkt_send.seq);
-    pkt_send.ack = htonl(pkt_send.ack);
-    pkt_send.length = htons(pkt_send.length);
-    int did_send = sendto(sockfd, &pkt_send, sizeof(pkt_send),
+    uint8_t buf[WIRE_MAX_SIZE];
+    size_t len = wire_encode(buf, pkt, compact);
+    int did_send = sendto(sockfd, buf, len,
                         // socket  send data   how much to send
                             0, (struct sockaddr*) serveraddr,
                         // flags   where to send
                             serversize);
-    if (did_send < 0) die("send");
+    if (did_send < 0 && errno != EMSGSIZE) die("send");
     return did_send;
 }
 
-int recv_packet(int sockfd, struct sockaddr_in *serveraddr, packet *pkt) {
-    socklen_t serversize = sizeof(*serveraddr);
-    /* 5. Listen for response from server */
-    int bytes_recvd = recvfrom(sockfd, pkt, sizeof(*pkt),
-                            // socket  store data  how much
-                                0, (struct sockaddr*) serveraddr,
-                                &serversize);
-    // Error if bytes_recvd < 0 :(
-    if (bytes_recvd < 0 && errno != EAGAIN) die("receive");
-    if (bytes_recvd > 0) {
-        pkt->seq = ntohl(pkt->seq);
-        pkt->ack = ntohl(pkt->ack);
-        pkt->length = ntohs(pkt->length);
-        print_packet(pkt, "RECV");
+/* Receives a single datagram into pkt, and its sender into serveraddr.
+Datagrams that are empty or malformed are skipped.
+Returns the size of the datagram, or -1 if none is waiting. */
+int recv_packet(int sockfd, struct sockaddr_in *serveraddr, packet *pkt, bool compact) {
+    uint8_t buf[WIRE_MAX_SIZE];
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t serversize = sizeof(from);
+        /* 5. Listen for response from server */
+        int bytes_recvd = recvfrom(sockfd, buf, sizeof(buf),
+                                // socket  store data  how much
+                                    MSG_TRUNC, (struct sockaddr*) &from,
+                                // flags, MSG_TRUNC returns the real size of longer datagrams
+                                    &serversize);
+        // Error if bytes_recvd < 0 :(
+        if (bytes_recvd < 0 && errno != EAGAIN) die("receive");
+        if (bytes_recvd < 0)
+            return bytes_recvd;
+        if (bytes_recvd > 0 && wire_decode(pkt, buf, bytes_recvd, compact)) {
+            *serveraddr = from;
+            trace_packet(TR_RECV, pkt->seq, pkt->ack, pkt->length, pkt->flags);
+            return bytes_recvd;
+        }
     }
-    return bytes_recvd;
-}
-
-int read_stdin_to_pkt(packet *pkt) {
-    int bytes_read = read(STDIN_FILENO, &pkt->payload, MSS);
-    if (bytes_read >= 0)
-        pkt->length = bytes_read;
-    else
-        pkt->length = 0;
-    return bytes_read;
-}
-
-void write_pkt_to_stdout(packet *pkt) {
-    write(STDOUT_FILENO, &pkt->payload, pkt->length);
 }
@@ -3,30 +3,62 @@
 
 #include <stdbool.h>
 #include <arpa/inet.h>
+#include "trace.h"
 
 #define PKT_SYN 1
 #define PKT_ACK 2
+#define PKT_SACK 4  // sack blocks follow the payload, or sack permitted on a syn
+#define PKT_COMPACT 8  // compact acks permitted, only on a syn
+#define PKT_FIN 8  // the same bit on any other packet: the sender has no more data, the fin takes a seq
+#define PKT_WINDOW 16  // the window byte is the receive window, or its scale on a syn offering flow control
+#define PKT_SEQ64 32  // the header carries the high halves of seq and ack, or extended seq numbers offered on a syn
+#define PKT_FEC 64  // a parity packet, see fec.h, or forward error correction offered on a syn
+#define PKT_MSS 128  // the payload ends with a segment size: the largest one taken, on a syn,
+                     // else the size of a path mtu probe, see pmtu.h, or of the probe acked
 #define RANDMASK ~(1 << 31)
 
-#define MSS 1012  // MSS = Maximum Segment Size (aka max length)
+#define MSS 1012  // MSS = Maximum Segment Size (aka max length), what every peer takes and every path carries
+#define MSS_MAX 8952  // largest segment that can be negotiated: a 9000 byte jumbo frame
+                      // less the IP, UDP and our headers, with 64 bit seq numbers
+
+/* Seq numbers are counted in 64 bits, so they never wrap during a connection.
+Only their low 32 bits go on the wire, unless both sides negotiated PKT_SEQ64,
+and a received one is extended to 64 bits by seq_unwrap. */
 typedef struct {
-    uint32_t ack;
-    uint32_t seq;
+    uint64_t ack;
+    uint64_t seq;
     uint16_t length;
     uint8_t flags;
-    uint8_t unused;
-    uint8_t payload[MSS];
+    uint8_t window;  // receive window in units of 2^scale packets, with PKT_WINDOW
+    uint8_t payload[MSS_MAX];
 } packet;
 
 void die(const char s[]);
+uint64_t now_us();
+uint32_t round_up_pow2(uint32_t n);
 
 int make_nonblock_socket();
+void grow_socket_buffers(int sockfd, int bytes);
 void stdin_nonblock();
+void stdout_nonblock();
+
+int send_packet(int sockfd, struct sockaddr_in *serveraddr, packet *pkt, bool compact, trace_event op);
+int recv_packet(int sockfd, struct sockaddr_in *serveraddr, packet *pkt, bool compact);
+
+/* Serial number arithmetic on 32 bit seq numbers (RFC 1982):
+a comes before b if b is less than 2^31 ahead of it, counting across the wrap. */
+static inline bool seq_lt(uint32_t a, uint32_t b) {
+    return (int32_t) (a - b) < 0;
+}
 
-int send_packet(int sockfd, struct sockaddr_in *serveraddr, packet *pkt, const char* str);
-int recv_packet(int sockfd, struct sockaddr_in *serveraddr, packet *pkt);
+static inline bool seq_le(uint32_t a, uint32_t b) {
+    return (int32_t) (a - b) <= 0;
+}
 
-int read_stdin_to_pkt(packet* pkt);
-void write_pkt_to_stdout(packet* pkt);
+/* Extends the low 32 bits of a seq number from the wire to the 64 bit seq number closest to near,
+which is where the peer has to be, as long as it is less than 2^31 bytes away. */
+static inline uint64_t seq_unwrap(uint64_t near, uint32_t seq) {
+    return near + (int32_t) (seq - (uint32_t) near);
+}
 
 #endif  // PROJECT_UTILS_H_
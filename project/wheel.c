@@ -0,0 +1,159 @@
+#include "wheel.h"
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+
+void wheel_init(timer_wheel *w, uint64_t now) {
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int i = 0; i < WHEEL_SLOTS; i++) {
+            w->slots[level][i].next = &w->slots[level][i];
+            w->slots[level][i].prev = &w->slots[level][i];
+        }
+        w->occupied[level] = 0;
+    }
+    w->tick = now / WHEEL_TICK_US;
+    w->armed = 0;
+}
+
+void timer_init(timer *t, void (*fire)(timer *t)) {
+    t->next = t->prev = NULL;
+    t->slot = -1;
+    t->fire = fire;
+}
+
+/* Links the timer into the slot for its deadline.
+Level L holds timers whose deadline, in slots of level L, is less than a lap ahead of the wheel
+but not in the current slot. Level 0 also takes the timers due now or in the past. */
+static void wheel_insert(timer_wheel *w, timer *t) {
+    // round up, so that a timer never fires before its deadline
+    uint64_t tick = (t->expires + WHEEL_TICK_US - 1) / WHEEL_TICK_US;
+    if (tick < w->tick)
+        tick = w->tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           (tick >> (level * WHEEL_BITS)) - (w->tick >> (level * WHEEL_BITS)) >= WHEEL_SLOTS)
+        level++;
+    uint64_t ahead = (tick >> (level * WHEEL_BITS)) - (w->tick >> (level * WHEEL_BITS));
+    if (ahead >= WHEEL_SLOTS)  // beyond the last level, wait in its farthest slot
+        tick = ((w->tick >> (level * WHEEL_BITS)) + WHEEL_SLOTS - 1) << (level * WHEEL_BITS);
+    int i = (tick >> (level * WHEEL_BITS)) & SLOT_MASK;
+    timer *head = &w->slots[level][i];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    t->slot = level * WHEEL_SLOTS + i;
+    w->occupied[level] |= 1ull << i;
+}
+
+/* Unlinks the timer from its slot. */
+static void wheel_unlink(timer_wheel *w, timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    int level = t->slot / WHEEL_SLOTS;
+    int i = t->slot % WHEEL_SLOTS;
+    if (w->slots[level][i].next == &w->slots[level][i])
+        w->occupied[level] &= ~(1ull << i);
+    t->slot = -1;
+}
+
+/* Sets the deadline of the timer to expires, in us, arming it if it wasn't. */
+void wheel_arm(timer_wheel *w, timer *t, uint64_t expires) {
+    if (timer_armed(t))
+        wheel_unlink(w, t);
+    else
+        w->armed++;
+    t->expires = expires;
+    wheel_insert(w, t);
+}
+
+/* Disarms the timer, if armed. */
+void wheel_cancel(timer_wheel *w, timer *t) {
+    if (!timer_armed(t))
+        return;
+    wheel_unlink(w, t);
+    w->armed--;
+}
+
+/* Returns the distance from slot i to the first occupied slot at or after it, going around,
+or WHEEL_SLOTS if there is none. */
+static uint64_t first_occupied(uint64_t occupied, int i) {
+    if (occupied == 0)
+        return WHEEL_SLOTS;
+    uint64_t rotated = occupied >> i | (i == 0 ? 0 : occupied << (WHEEL_SLOTS - i));
+    return __builtin_ctzll(rotated);
+}
+
+/* Returns when the wheel next needs to advance, in us, or 0 if no timer is armed.
+That is the first occupied tick of level 0, or the start of the first occupied slot of a
+higher level if that comes sooner, where its timers move down to find their tick. */
+uint64_t wheel_next(const timer_wheel *w) {
+    if (w->armed == 0)
+        return 0;
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = level * WHEEL_BITS;
+        uint64_t distance = first_occupied(w->occupied[level], (w->tick >> shift) & SLOT_MASK);
+        if (distance == WHEEL_SLOTS)
+            continue;
+        uint64_t tick = ((w->tick >> shift) + distance) << shift;
+        if (tick < w->tick)
+            tick = w->tick;
+        if (tick < next)
+            next = tick;
+    }
+    return next * WHEEL_TICK_US;
+}
+
+/* Moves the timers of slot i of a level down to where they belong now. */
+static void wheel_cascade(timer_wheel *w, int level, int i) {
+    timer *head = &w->slots[level][i];
+    while (head->next != head) {
+        timer *t = head->next;
+        wheel_unlink(w, t);
+        wheel_insert(w, t);
+    }
+}
+
+/* Fires the timers due by now, in deadline order to within a tick.
+Empty stretches of level 0 are skipped in one step. */
+void wheel_advance(timer_wheel *w, uint64_t now) {
+    uint64_t end = now / WHEEL_TICK_US;
+    while (w->tick <= end) {
+        uint64_t tick = w->tick;
+        int i = tick & SLOT_MASK;
+        if (i == 0) {
+            // higher levels first, their timers may move down into a slot cascading next
+            int top = 1;
+            while (top < WHEEL_LEVELS - 1 && ((tick >> (top * WHEEL_BITS)) & SLOT_MASK) == 0)
+                top++;
+            for (int level = top; level >= 1; level--)
+                wheel_cascade(w, level, (tick >> (level * WHEEL_BITS)) & SLOT_MASK);
+        }
+        // take the due timers out first, a callback may arm a timer a lap ahead into this slot
+        timer due = {.next = &due, .prev = &due};
+        timer *head = &w->slots[0][i];
+        if (head->next != head) {
+            due.next = head->next;
+            due.prev = head->prev;
+            due.next->prev = &due;
+            due.prev->next = &due;
+            head->next = head->prev = head;
+            w->occupied[0] &= ~(1ull << i);
+        }
+        // timers armed again by a callback go in the slots from the next tick on
+        w->tick = tick + 1;
+        while (due.next != &due) {
+            timer *t = due.next;
+            wheel_unlink(w, t);  // a callback may also cancel the timers still in the list
+            w->armed--;
+            t->fire(t);
+        }
+        // jump to the next occupied slot of this lap, or to the start of the next lap,
+        // the lower slots hold timers for the next lap
+        uint64_t next = (tick | SLOT_MASK) + 1;
+        uint64_t later = i + 1 < WHEEL_SLOTS ? w->occupied[0] >> (i + 1) : 0;
+        if (later != 0)
+            next = tick + 1 + __builtin_ctzll(later);
+        w->tick = next <= end + 1 ? next : end + 1;
+    }
+}
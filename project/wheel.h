@@ -0,0 +1,47 @@
+#ifndef PROJECT_WHEEL_H_
+#define PROJECT_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WHEEL_TICK_US 100       // timers fire on the first tick at or after their deadline
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4          // 64^4 ticks, 28 minutes, later deadlines wait in the last level
+
+/* The struct holding member, from a pointer to the member. For timer callbacks. */
+#define container_of(ptr, type, member) ((type*) ((char*) (ptr) - offsetof(type, member)))
+
+/* A deadline, kept in the struct it belongs to. */
+typedef struct timer {
+    struct timer *next;         // in the list of its slot
+    struct timer *prev;
+    uint64_t expires;           // monotonic time in us
+    int slot;                   // level * WHEEL_SLOTS + slot, -1 if not armed
+    void (*fire)(struct timer *t);  // called once expired, may arm timers again
+} timer;
+
+/* Hierarchical timing wheel. Level 0 has a slot per tick, and each level up has slots
+WHEEL_SLOTS times as long. A timer goes in the lowest level whose slots are short enough to
+tell it apart from now, and moves down a level each time the wheel reaches its slot.
+Arming and cancelling are a list insert and remove, firing costs at most one move per level. */
+typedef struct timer_wheel {
+    timer slots[WHEEL_LEVELS][WHEEL_SLOTS];     // list heads
+    uint64_t occupied[WHEEL_LEVELS];            // a bit per slot with timers
+    uint64_t tick;              // the next tick to fire
+    uint32_t armed;
+} timer_wheel;
+
+void wheel_init(timer_wheel *w, uint64_t now);
+void timer_init(timer *t, void (*fire)(timer *t));
+void wheel_arm(timer_wheel *w, timer *t, uint64_t expires);
+void wheel_cancel(timer_wheel *w, timer *t);
+uint64_t wheel_next(const timer_wheel *w);
+void wheel_advance(timer_wheel *w, uint64_t now);
+
+static inline bool timer_armed(const timer *t) {
+    return t->slot >= 0;
+}
+
+#endif  // PROJECT_WHEEL_H_
@@ -0,0 +1,240 @@
+#include <string.h>
+#include "wire.h"
+
+/* A datagram carries the header, then length bytes of payload, then the sack trailer if any.
+Acks without data can use a compact header once both sides agree:
+the flags byte and the ack, the window byte if flagged, then each sack block as two varints,
+its start relative to the ack and its length.
+The compact form is always shorter than a header, which is how the receiver tells them apart.
+With PKT_SEQ64, the high halves of the ack and seq follow the header, and the high half of the ack
+follows the ack of a compact header. A syn only offers them, its seq numbers fit in 32 bits.
+With PKT_MSS, the last 16 bits of the payload are a segment size. Before it, a syn may carry data
+sent with a fast open cookie, and a syn ack the cookie issued, see cookie.h.
+Peers that don't know them ignore the payload of a syn. */
+
+static size_t put_varint(uint8_t *out, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+}
+
+/* Reads a varint from in, no further than end. Returns the bytes read, or 0 if it is cut off or too long. */
+static size_t get_varint(const uint8_t *in, const uint8_t *end, uint32_t *v) {
+    *v = 0;
+    for (size_t n = 0; n < 5 && in + n < end; n++) {
+        *v |= (uint32_t) (in[n] & 0x7f) << (7 * n);
+        if (!(in[n] & 0x80))
+            return n + 1;
+    }
+    return 0;
+}
+
+static void put_u32(uint8_t *out, uint32_t v) {
+    v = htonl(v);
+    memcpy(out, &v, sizeof(v));
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    uint32_t v;
+    memcpy(&v, in, sizeof(v));
+    return ntohl(v);
+}
+
+/* Returns the size of the header of a packet with these flags. */
+static size_t header_size(uint8_t flags) {
+    return flags & PKT_SEQ64 && !(flags & PKT_SYN) ? HEADER_SIZE + SEQ64_SIZE : HEADER_SIZE;
+}
+
+/* Returns the bytes of payload and sack trailer that follow the header. */
+static size_t body_size(const packet *pkt) {
+    if (!(pkt->flags & PKT_SACK) || pkt->flags & PKT_SYN)
+        return pkt->length;
+    return pkt->length + 1 + 8 * pkt->payload[pkt->length];
+}
+
+/* Writes the compact form of an ack without data. Returns its size, or 0 if it wouldn't be shorter. */
+static size_t encode_compact(uint8_t *out, const packet *pkt) {
+    out[0] = pkt->flags;
+    put_u32(out + 1, pkt->ack);
+    size_t n = COMPACT_SIZE;
+    if (pkt->flags & PKT_SEQ64) {
+        put_u32(out + n, pkt->ack >> 32);
+        n += 4;
+    }
+    if (pkt->flags & PKT_WINDOW)
+        out[n++] = pkt->window;
+    if (pkt->flags & PKT_SACK) {
+        sack_block blocks[SACK_MAX_BLOCKS];
+        int count = sack_decode(pkt, blocks);
+        for (int i = 0; i < count; i++) {
+            uint8_t varints[10];
+            size_t len = put_varint(varints, blocks[i].start - pkt->ack);
+            len += put_varint(varints + len, blocks[i].end - blocks[i].start);
+            if (n + len >= HEADER_SIZE)
+                return 0;
+            memcpy(out + n, varints, len);
+            n += len;
+        }
+        if (count == 0)
+            out[0] &= ~PKT_SACK;
+    }
+    return n;
+}
+
+/* Writes the header. Returns its size. */
+static size_t put_header(uint8_t *out, uint64_t ack, uint64_t seq, uint16_t length, uint8_t flags,
+                         uint8_t window) {
+    put_u32(out, ack);
+    put_u32(out + 4, seq);
+    length = htons(length);
+    memcpy(out + 8, &length, sizeof(length));
+    out[10] = flags;
+    out[11] = window;
+    size_t size = header_size(flags);
+    if (size > HEADER_SIZE) {
+        put_u32(out + HEADER_SIZE, ack >> 32);
+        put_u32(out + HEADER_SIZE + 4, seq >> 32);
+    }
+    return size;
+}
+
+/* Writes the packet as it goes on the wire, at most WIRE_MAX_SIZE bytes. Returns the size. */
+size_t wire_encode(uint8_t *out, const packet *pkt, bool compact) {
+    if (compact && pkt->length == 0 && (pkt->flags & ~(PKT_SACK | PKT_WINDOW | PKT_SEQ64)) == PKT_ACK) {
+        size_t n = encode_compact(out, pkt);
+        if (n > 0)
+            return n;
+    }
+    size_t header = put_header(out, pkt->ack, pkt->seq, pkt->length, pkt->flags, pkt->window);
+    size_t body = body_size(pkt);
+    memcpy(out + header, pkt->payload, body);
+    return header + body;
+}
+
+/* Writes the header and trailer of the segment to out, at most HEADER_SIZE + SEQ64_SIZE + SACK_MAX_LEN
+bytes, and points iov at them and at the payload, in wire order, up to SEGMENT_IOVS.
+Sets iovcnt to the number of iovecs. Returns the size of the datagram.
+With PKT_MSS, and on a syn, the trailer is the segment size and the cookie, which the length counts
+as the end of the payload. */
+size_t wire_gather(uint8_t *out, const segment *seg, struct iovec *iov, int *iovcnt) {
+    bool counted = seg->flags & (PKT_MSS | PKT_SYN);
+    uint16_t length = counted ? seg->length + seg->trailer_len : seg->length;
+    size_t header = put_header(out, seg->ack, seg->seq, length, seg->flags, seg->window);
+    iov[0].iov_base = out;
+    iov[0].iov_len = header;
+    int n = 1;
+    for (int i = 0; i < seg->pieces; i++)
+        iov[n++] = seg->payload[i];
+    if (seg->trailer_len > 0) {
+        memcpy(out + header, seg->trailer, seg->trailer_len);
+        iov[n].iov_base = out + header;
+        iov[n++].iov_len = seg->trailer_len;
+    }
+    *iovcnt = n;
+    return header + seg->length + seg->trailer_len;
+}
+
+static bool decode_compact(packet *pkt, const uint8_t *in, size_t len) {
+    const uint8_t *end = in + len;
+    uint8_t flags = in[0];
+    size_t high = flags & PKT_SEQ64 ? COMPACT_SIZE + 4 : COMPACT_SIZE;  // where the high half ends
+    size_t header = flags & PKT_WINDOW ? high + 1 : high;
+    if ((flags & ~(PKT_SACK | PKT_WINDOW | PKT_SEQ64)) != PKT_ACK || len < header)
+        return false;
+    pkt->ack = get_u32(in + 1);
+    if (flags & PKT_SEQ64)
+        pkt->ack |= (uint64_t) get_u32(in + COMPACT_SIZE) << 32;
+    pkt->seq = 0;
+    pkt->length = 0;
+    pkt->flags = flags;
+    pkt->window = flags & PKT_WINDOW ? in[high] : 0;
+    if (!(flags & PKT_SACK))
+        return len == header;
+
+    sack_block blocks[SACK_MAX_BLOCKS];
+    int count = 0;
+    for (const uint8_t *p = in + header; p < end; count++) {
+        uint32_t offset, size;
+        size_t n = get_varint(p, end, &offset);
+        size_t m = n == 0 ? 0 : get_varint(p + n, end, &size);
+        if (m == 0 || count == SACK_MAX_BLOCKS)
+            return false;
+        blocks[count].start = pkt->ack + offset;
+        blocks[count].end = blocks[count].start + size;
+        p += n + m;
+    }
+    sack_encode(pkt, blocks, count);
+    return count > 0;
+}
+
+/* Reads a received datagram of len bytes into pkt, in host byte order.
+Returns false unless the size is exactly what the header says,
+or the full size of a packet, which peers that don't trim their datagrams send. */
+bool wire_decode(packet *pkt, const uint8_t *in, size_t len, bool compact) {
+    if (len < HEADER_SIZE)
+        return compact && decode_compact(pkt, in, len);
+    if (len > WIRE_MAX_SIZE)
+        return false;
+    pkt->ack = get_u32(in);
+    pkt->seq = get_u32(in + 4);
+    uint16_t length;
+    memcpy(&length, in + 8, sizeof(length));
+    pkt->length = ntohs(length);
+    pkt->flags = in[10];
+    pkt->window = in[11];
+    size_t header = header_size(pkt->flags);
+    size_t payload_end = header + pkt->length;
+    if (pkt->length > MSS_MAX || payload_end > len || len - header > MSS_MAX)
+        return false;
+    if (header > HEADER_SIZE) {
+        pkt->ack |= (uint64_t) get_u32(in + HEADER_SIZE) << 32;
+        pkt->seq |= (uint64_t) get_u32(in + HEADER_SIZE + 4) << 32;
+    }
+    memcpy(pkt->payload, in + header, len - header);
+    if (pkt->flags & PKT_SACK && !(pkt->flags & PKT_SYN) &&
+            (payload_end == len || pkt->payload[pkt->length] > SACK_MAX_BLOCKS))
+        return false;
+    size_t size = header + body_size(pkt);
+    return size == len || (len == LEGACY_SIZE && size <= len);
+}
+
+/* Writes a segment size as it ends the payload of a packet with PKT_MSS. Returns its size. */
+size_t wire_put_mss(uint8_t *out, uint16_t size) {
+    size = htons(size);
+    memcpy(out, &size, sizeof(size));
+    return MSS_OPTION_SIZE;
+}
+
+/* Returns the segment size that ends the payload of a received packet with PKT_MSS,
+or 0 if the payload is too short to have one. */
+uint16_t wire_mss(const packet *pkt) {
+    uint16_t size;
+    if (pkt->length < MSS_OPTION_SIZE)
+        return 0;
+    memcpy(&size, pkt->payload + pkt->length - MSS_OPTION_SIZE, sizeof(size));
+    return ntohs(size);
+}
+
+/* Writes a fast open cookie as it starts the payload of a syn ack. Returns its size. */
+size_t wire_put_cookie(uint8_t *out, uint32_t cookie) {
+    put_u32(out, cookie);
+    return COOKIE_SIZE;
+}
+
+/* Returns the fast open cookie that starts the payload of a received syn ack, or 0 if it has none. */
+uint32_t wire_cookie(const packet *pkt) {
+    size_t options = pkt->flags & PKT_MSS ? MSS_OPTION_SIZE : 0;
+    if (pkt->length < options + COOKIE_SIZE)
+        return 0;
+    return get_u32(pkt->payload);
+}
+
+/* Returns the bytes of data at the start of the payload of a received syn, before the segment size. */
+uint16_t wire_syn_data(const packet *pkt) {
+    uint16_t options = pkt->flags & PKT_MSS ? MSS_OPTION_SIZE : 0;
+    return pkt->length > options ? pkt->length - options : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PROJECT_WIRE_H_
+#define PROJECT_WIRE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include "utils.h"
+#include "sack.h"
+
+#define HEADER_SIZE 12      // ack, seq, length, flags and window
+#define SEQ64_SIZE 8        // high halves of ack and seq after the header, with PKT_SEQ64
+#define COMPACT_SIZE 5      // flags and ack, for an ack without data, then the high half of the ack
+                            // with PKT_SEQ64 and the window with PKT_WINDOW
+#define MSS_OPTION_SIZE 2   // segment size at the end of the payload, with PKT_MSS
+#define COOKIE_SIZE 4       // fast open cookie at the start of the payload of a syn ack, see cookie.h
+#define WIRE_MAX_SIZE (HEADER_SIZE + SEQ64_SIZE + MSS_MAX)  // largest datagram
+#define LEGACY_SIZE (HEADER_SIZE + MSS)  // peers that don't trim their datagrams send this many bytes
+#define SEGMENT_IOVS 4      // header, payload in up to two pieces, sack trailer
+
+/* A packet sent from the send buffer, with its payload left where it is.
+The kernel gathers the header, the payload pieces and the trailer into one datagram. */
+typedef struct {
+    uint64_t ack;
+    uint64_t seq;
+    uint16_t length;
+    uint8_t flags;
+    uint8_t window;
+    int pieces;                     // payload iovecs in use
+    struct iovec payload[2];
+    size_t trailer_len;             // 0 without sack blocks, a cookie or a segment size
+    uint8_t trailer[SACK_MAX_LEN];
+    uint64_t txtime;                // departure time in ns for SO_TXTIME, 0 to leave at once
+} segment;
+
+size_t wire_encode(uint8_t *out, const packet *pkt, bool compact);
+size_t wire_gather(uint8_t *out, const segment *seg, struct iovec *iov, int *iovcnt);
+bool wire_decode(packet *pkt, const uint8_t *in, size_t len, bool compact);
+size_t wire_put_mss(uint8_t *out, uint16_t size);
+uint16_t wire_mss(const packet *pkt);
+size_t wire_put_cookie(uint8_t *out, uint32_t cookie);
+uint32_t wire_cookie(const packet *pkt);
+uint16_t wire_syn_data(const packet *pkt);
+
+#endif  // PROJECT_WIRE_H_